@@ -0,0 +1,158 @@
+/***************************************************************************************
+ *
+ * Copyright (c) 2026 Lejent, Inc. All Rights Reserved
+ *
+ **************************************************************************************/
+/**
+ *    @file: ChannelPool.cpp
+ *    @date: 10/17/2026 05:12:08 PM
+ * @version: 1.0
+ *   @brief:
+ *
+ **/
+#include <algorithm>
+#include "ChannelPool.h"
+#include "AutoLock.h"
+#include "Logger.h"
+
+ChannelPool::ChannelPool(std::string host, std::string port, std::string user_name, std::string password, std::string vhost,
+    int max_channels) : _max_channels(max_channels > 0 ? max_channels : 1), _opened(0) {
+  _uri = "amqp://" + user_name + ":" + password + "@" + host + ":" + port + "/" + vhost;
+  pthread_key_create(&_key, ChannelPool::_release);
+}
+
+ChannelPool::ChannelPool(std::string uri, int max_channels) :
+  _max_channels(max_channels > 0 ? max_channels : 1), _opened(0) {
+  _uri = uri;
+  pthread_key_create(&_key, ChannelPool::_release);
+}
+
+ChannelPool::~ChannelPool() {
+  //删除key后线程退出时不再调用_release
+  pthread_key_delete(_key);
+  AutoLock<Mutex> lock(&_mutex);
+  for(std::set<ThreadChannel *>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
+    delete (*it)->channel;
+    delete *it;
+  }
+  _channels.clear();
+}
+
+void ChannelPool::_release(void *param) {
+  ThreadChannel *tc = (ThreadChannel *)param;
+  {
+    AutoLock<Mutex> lock(&tc->pool->_mutex);
+    tc->pool->_channels.erase(tc);
+    --tc->pool->_opened;
+  }
+  delete tc->channel;
+  delete tc;
+}
+
+ChannelPool::ThreadChannel* ChannelPool::_thread_channel() {
+  ThreadChannel *tc = (ThreadChannel *)pthread_getspecific(_key);
+  if(tc != NULL) {
+    return tc;
+  }
+
+  std::map<std::string, std::vector<std::string> > bindings;
+  {
+    AutoLock<Mutex> lock(&_mutex);
+    if(_opened >= _max_channels) {
+      LOG_ERROR(debug_log, "channel pool: more than %d threads", _max_channels);
+      return NULL;
+    }
+    ++_opened;
+    bindings = _bindings;
+  }
+
+  Channel *channel = new Channel(_uri);
+  bool ok = channel->open() == 0;
+  //重新声明已经注册的exchange和绑定关系
+  std::map<std::string, std::vector<std::string> >::iterator it;
+  for(it = bindings.begin(); ok && it != bindings.end(); ++it) {
+    ok = channel->declare_exchange(it->first, it->second) == 0;
+  }
+  if(!ok) {
+    delete channel;
+    AutoLock<Mutex> lock(&_mutex);
+    --_opened;
+    return NULL;
+  }
+
+  tc = new ThreadChannel;
+  tc->pool = this;
+  tc->channel = channel;
+  pthread_setspecific(_key, tc);
+  AutoLock<Mutex> lock(&_mutex);
+  _channels.insert(tc);
+  return tc;
+}
+
+Channel* ChannelPool::channel() {
+  ThreadChannel *tc = _thread_channel();
+  return tc == NULL ? NULL : tc->channel;
+}
+
+int ChannelPool::push(const std::string &queue, const std::string &message, int deliver_mode) {
+  ThreadChannel *tc = _thread_channel();
+  if(tc == NULL) {
+    return -1;
+  }
+  if(tc->queues.find(queue) == tc->queues.end()) {
+    tc->channel->create_producer(queue);
+    tc->queues.insert(queue);
+  }
+  return tc->channel->publish(message, queue, deliver_mode);
+}
+
+int ChannelPool::push_batch(const std::string &queue, const std::vector<std::string> &messages,
+    int deliver_mode, std::vector<int> *failed) {
+  ThreadChannel *tc = _thread_channel();
+  if(tc == NULL) {
+    return -1;
+  }
+  if(tc->queues.find(queue) == tc->queues.end()) {
+    tc->channel->create_producer(queue);
+    tc->queues.insert(queue);
+  }
+  return tc->channel->publish_batch(messages, queue, deliver_mode, "", failed);
+}
+
+int ChannelPool::publish(const std::string &exchange, const std::string &message, int deliver_mode) {
+  Channel *ch = channel();
+  if(ch == NULL) {
+    return -1;
+  }
+  return ch->publish(message, "", deliver_mode, exchange);
+}
+
+int ChannelPool::bind_queue(const std::string &exchange, const std::string &queue) {
+  {
+    AutoLock<Mutex> lock(&_mutex);
+    std::vector<std::string> &queues = _bindings[exchange];
+    if(std::find(queues.begin(), queues.end(), queue) == queues.end()) {
+      queues.push_back(queue);
+    }
+  }
+  //exchange和绑定关系保存在broker中，已经创建的其他线程的Channel不需要重新声明
+  Channel *ch = channel();
+  if(ch == NULL) {
+    return -1;
+  }
+  return ch->declare_exchange(exchange, std::vector<std::string>(1, queue));
+}
+
+Consumer ChannelPool::create_consumer(const std::string &queue, int prefetch) {
+  Channel *ch = channel();
+  if(ch == NULL) {
+    LOG_ERROR(debug_log, "create consumer %s failed, open channel failed", queue.c_str());
+    exit(-1);
+  }
+  return ch->create_consumer(queue, prefetch);
+}
+
+int ChannelPool::size() {
+  AutoLock<Mutex> lock(&_mutex);
+  return _channels.size();
+}
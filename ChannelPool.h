@@ -0,0 +1,113 @@
+/***************************************************************************************
+ *
+ * Copyright (c) 2026 Lejent, Inc. All Rights Reserved
+ *
+ **************************************************************************************/
+/**
+ *    @file: ChannelPool.h
+ *    @date: 10/17/2026 05:12:08 PM
+ * @version: 1.0
+ *   @brief: 每个线程一个Channel，多线程发送和消费时不再争用同一个Channel。
+ *           SimpleAmqpClient的每个Channel独占一条连接，rabbitmq-c的连接也不是线程安全的，
+ *           多个线程的channel复用一条连接仍然需要加锁，所以每个线程的Channel使用自己的连接。
+ *           线程第一次push_batch时Channel还会建立一条confirm模式的rabbitmq-c连接
+ *           （SimpleAmqpClient的连接无法开启confirm），N个线程最多占用2N条连接，
+ *           线程数由max_channels限制。
+ *           Channel在线程第一次使用时创建，并重新声明已经注册的exchange和绑定关系；
+ *           队列在线程第一次向其发送时声明，Channel重建时由Channel::_rebuild重新声明。
+ *
+ **/
+#ifndef __CHANNEL_POOL_H__
+#define __CHANNEL_POOL_H__
+#include <pthread.h>
+#include <set>
+#include <string>
+#include <vector>
+#include "MQClient.h"
+
+class ChannelPool {
+  public:
+    /**
+    * @param [in] max_channels 最多同时使用ChannelPool的线程数，超过时channel()返回NULL
+    **/
+    ChannelPool(std::string host, std::string port, std::string user_name, std::string password, std::string vhost,
+        int max_channels = 64);
+
+    ChannelPool(std::string uri, int max_channels = 64);
+
+    /**
+    * @brief 释放所有Channel，调用前使用ChannelPool的线程必须已经停止
+    **/
+    ~ChannelPool();
+
+    /**
+    * @brief 当前线程的Channel，第一次调用时创建
+    * @return 连接或者声明exchange失败、线程数超过max_channels时为NULL
+    **/
+    Channel* channel();
+
+    /**
+    * @brief 通过当前线程的Channel向队列推送消息，第一次推送时声明队列
+    * @return 成功为0，失败为-1
+    **/
+    int push(const std::string &queue, const std::string &message, int deliver_mode = DM_NONPERSISTENT);
+
+    /**
+    * @brief 通过当前线程的Channel批量推送，参数和返回值与Producer::push_batch一致
+    **/
+    int push_batch(const std::string &queue, const std::vector<std::string> &messages,
+        int deliver_mode = DM_NONPERSISTENT, std::vector<int> *failed = NULL);
+
+    /**
+    * @brief 通过当前线程的Channel向exchange推送消息，exchange需要先通过bind_queue注册
+    * @return 成功为0，失败为-1
+    **/
+    int publish(const std::string &exchange, const std::string &message, int deliver_mode = DM_NONPERSISTENT);
+
+    /**
+    * @brief 注册exchange（fanout类型）和绑定的队列，之后创建的Channel都会重新声明
+    * @return 在当前线程的Channel上声明成功为0，失败为-1（注册仍然有效）
+    **/
+    int bind_queue(const std::string &exchange, const std::string &queue);
+
+    /**
+    * @brief 在当前线程的Channel上创建消费者，只能在当前线程中使用
+    **/
+    Consumer create_consumer(const std::string &queue, int prefetch = 1);
+
+    /**
+    * @brief 已经创建的Channel数
+    **/
+    int size();
+
+  private:
+    struct ThreadChannel {
+      ChannelPool *pool;
+      Channel *channel;
+      //该Channel上已经声明的队列
+      std::set<std::string> queues;
+    };
+
+    /**
+    * @brief 线程退出时释放该线程的Channel
+    **/
+    static void _release(void *param);
+
+    ThreadChannel* _thread_channel();
+
+    //不允许拷贝和赋值操作
+    ChannelPool(const ChannelPool &other);
+    ChannelPool& operator= (const ChannelPool &other);
+
+    std::string _uri;
+    int _max_channels;
+    pthread_key_t _key;
+    Mutex _mutex;
+    //已经创建和正在创建的Channel数，在_mutex下修改
+    int _opened;
+    std::set<ThreadChannel *> _channels;
+    //注册的exchange和绑定的队列
+    std::map<std::string, std::vector<std::string> > _bindings;
+};
+
+#endif
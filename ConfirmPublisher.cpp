@@ -0,0 +1,219 @@
+/***************************************************************************************
+ *
+ * Copyright (c) 2026 Lejent, Inc. All Rights Reserved
+ *
+ **************************************************************************************/
+/**
+ *    @file: ConfirmPublisher.cpp
+ *    @date: 10/17/2026 02:37:12 PM
+ * @version: 1.0
+ *   @brief:
+ *
+ **/
+#include <amqp_tcp_socket.h>
+#include "ConfirmPublisher.h"
+#include "MQInterface.h"
+#include "Logger.h"
+
+static const amqp_channel_t CONFIRM_CHANNEL = 1;
+
+ConfirmPublisher::ConfirmPublisher(const std::string &uri, int max_inflight, int timeout) :
+  _uri(uri), _max_inflight(max_inflight > 0 ? max_inflight : 1), _timeout(timeout),
+  _conn(NULL), _next_tag(1), _first_tag(1), _lowest_pending(0), _pending(0) {
+}
+
+int ConfirmPublisher::open() {
+  close();
+  //amqp_parse_url会修改传入的字符串
+  std::vector<char> url(_uri.begin(), _uri.end());
+  url.push_back('\0');
+  struct amqp_connection_info info;
+  amqp_default_connection_info(&info);
+  if (amqp_parse_url(&url[0], &info) != AMQP_STATUS_OK) {
+    LOG_ERROR(debug_log, "confirm publisher: invalid uri %s", _uri.c_str());
+    return -1;
+  }
+
+  _conn = amqp_new_connection();
+  amqp_socket_t *socket = amqp_tcp_socket_new(_conn);
+  if (socket == NULL || amqp_socket_open(socket, info.host, info.port) != AMQP_STATUS_OK) {
+    LOG_ERROR(debug_log, "confirm publisher: connect %s:%d failed", info.host, info.port);
+    _abort();
+    return -1;
+  }
+  amqp_rpc_reply_t reply = amqp_login(_conn, info.vhost, 0, 131072, 0,
+      AMQP_SASL_METHOD_PLAIN, info.user, info.password);
+  if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
+    LOG_ERROR(debug_log, "confirm publisher: login failed");
+    _abort();
+    return -1;
+  }
+  amqp_channel_open(_conn, CONFIRM_CHANNEL);
+  if (amqp_get_rpc_reply(_conn).reply_type != AMQP_RESPONSE_NORMAL) {
+    LOG_ERROR(debug_log, "confirm publisher: open channel failed");
+    _abort();
+    return -1;
+  }
+  amqp_confirm_select(_conn, CONFIRM_CHANNEL);
+  if (amqp_get_rpc_reply(_conn).reply_type != AMQP_RESPONSE_NORMAL) {
+    LOG_ERROR(debug_log, "confirm publisher: confirm.select failed");
+    _abort();
+    return -1;
+  }
+  _next_tag = 1;
+  return 0;
+}
+
+void ConfirmPublisher::close() {
+  if (_conn == NULL) {
+    return;
+  }
+  amqp_channel_close(_conn, CONFIRM_CHANNEL, AMQP_REPLY_SUCCESS);
+  amqp_connection_close(_conn, AMQP_REPLY_SUCCESS);
+  _abort();
+}
+
+void ConfirmPublisher::_abort() {
+  if (_conn != NULL) {
+    amqp_destroy_connection(_conn);
+    _conn = NULL;
+  }
+}
+
+void ConfirmPublisher::_confirm(uint64_t tag, bool multiple, char state) {
+  if (tag < _first_tag || tag - _first_tag >= _states.size()) {
+    return;
+  }
+  size_t idx = tag - _first_tag;
+  size_t begin = multiple ? _lowest_pending : idx;
+  for (size_t i = begin; i <= idx; ++i) {
+    if (_states[i] == 0) {
+      _states[i] = state;
+      --_pending;
+    }
+  }
+  while (_lowest_pending < _states.size() && _states[_lowest_pending] != 0) {
+    ++_lowest_pending;
+  }
+}
+
+int ConfirmPublisher::_wait_confirm(struct timeval *tv) {
+  amqp_frame_t frame;
+  int ret = amqp_simple_wait_frame_noblock(_conn, &frame, tv);
+  if (ret == AMQP_STATUS_TIMEOUT) {
+    return 1;
+  }
+  if (ret != AMQP_STATUS_OK) {
+    LOG_ERROR(debug_log, "confirm publisher: wait frame failed, %s", amqp_error_string2(ret));
+    return -1;
+  }
+  if (frame.frame_type != AMQP_FRAME_METHOD) {
+    return 0;
+  }
+  switch (frame.payload.method.id) {
+    case AMQP_BASIC_ACK_METHOD: {
+      amqp_basic_ack_t *ack = (amqp_basic_ack_t *)frame.payload.method.decoded;
+      _confirm(ack->delivery_tag, ack->multiple, 1);
+      break;
+    }
+    case AMQP_BASIC_NACK_METHOD: {
+      amqp_basic_nack_t *nack = (amqp_basic_nack_t *)frame.payload.method.decoded;
+      _confirm(nack->delivery_tag, nack->multiple, 2);
+      break;
+    }
+    case AMQP_CHANNEL_CLOSE_METHOD:
+    case AMQP_CONNECTION_CLOSE_METHOD:
+      //例如exchange不存在，broker关闭channel
+      LOG_ERROR(debug_log, "confirm publisher: channel closed by broker");
+      return -1;
+    default:
+      break;
+  }
+  return 0;
+}
+
+int ConfirmPublisher::publish(const std::vector<std::string> &messages,
+    const std::string &exchange, const std::string &routing_key, int deliver_mode,
+    std::vector<int> *failed) {
+  if (failed != NULL) {
+    failed->clear();
+  }
+  if (messages.empty()) {
+    return 0;
+  }
+
+  //与Channel::publish的消息属性一致，否则Python客户端无法解析
+  amqp_basic_properties_t props;
+  props._flags = AMQP_BASIC_CONTENT_TYPE_FLAG | AMQP_BASIC_CONTENT_ENCODING_FLAG
+      | AMQP_BASIC_PRIORITY_FLAG;
+  props.content_type = amqp_cstring_bytes("application/data");
+  props.content_encoding = amqp_cstring_bytes("binary");
+  props.priority = 0;
+  if (deliver_mode == DM_PERSISTENT || deliver_mode == DM_NONPERSISTENT) {
+    props._flags |= AMQP_BASIC_DELIVERY_MODE_FLAG;
+    props.delivery_mode = deliver_mode;
+  }
+  amqp_bytes_t exchange_bytes;
+  exchange_bytes.len = exchange.size();
+  exchange_bytes.bytes = (void *)exchange.data();
+  amqp_bytes_t routing_key_bytes;
+  routing_key_bytes.len = routing_key.size();
+  routing_key_bytes.bytes = (void *)routing_key.data();
+
+  int ret = 0;
+  _states.assign(messages.size(), 0);
+  _lowest_pending = 0;
+  _pending = 0;
+  if (_conn == NULL && open() != 0) {
+    ret = -1;
+  }
+  _first_tag = _next_tag;
+
+  struct timeval tv;
+  for (size_t i = 0; ret == 0 && i < messages.size(); ++i) {
+    //未confirm的消息达到上限时先读取confirm，持久化消息的confirm在落盘后才返回
+    while (ret == 0 && _pending >= (size_t)_max_inflight) {
+      tv.tv_sec = _timeout / 1000;
+      tv.tv_usec = (_timeout % 1000) * 1000;
+      ret = _wait_confirm(&tv) == 0 ? 0 : -1;
+    }
+    if (ret != 0) {
+      break;
+    }
+    amqp_bytes_t body;
+    body.len = messages[i].size();
+    body.bytes = (void *)messages[i].data();
+    if (amqp_basic_publish(_conn, CONFIRM_CHANNEL, exchange_bytes, routing_key_bytes,
+          0, 0, &props, body) != AMQP_STATUS_OK) {
+      LOG_ERROR(debug_log, "confirm publisher: publish failed");
+      ret = -1;
+      break;
+    }
+    ++_next_tag;
+    ++_pending;
+  }
+  //等待剩余的confirm，超过timeout没有收到任何frame认为连接失败
+  while (ret == 0 && _pending > 0) {
+    tv.tv_sec = _timeout / 1000;
+    tv.tv_usec = (_timeout % 1000) * 1000;
+    ret = _wait_confirm(&tv) == 0 ? 0 : -1;
+  }
+
+  if (ret != 0) {
+    //连接状态未知，下次调用时重新建立
+    _abort();
+  } else {
+    amqp_maybe_release_buffers(_conn);
+  }
+  for (size_t i = 0; i < _states.size(); ++i) {
+    if (_states[i] != 1) {
+      if (ret == 0) {
+        ret = -3;
+      }
+      if (failed != NULL) {
+        failed->push_back(i);
+      }
+    }
+  }
+  return ret;
+}
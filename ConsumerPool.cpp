@@ -0,0 +1,170 @@
+/***************************************************************************************
+ *
+ * Copyright (c) 2026 Lejent, Inc. All Rights Reserved
+ *
+ **************************************************************************************/
+/**
+ *    @file: ConsumerPool.cpp
+ *    @date: 10/17/2026 04:05:51 PM
+ * @version: 1.0
+ *   @brief:
+ *
+ **/
+#include <time.h>
+#include <exception>
+#include "ConsumerPool.h"
+#include "Logger.h"
+
+//分发线程拉取消息和等待处理结果的超时，单位毫秒，决定确认的最大延迟
+static const int POLL_TIMEOUT = 10;
+
+ConsumerPool::ConsumerPool(Channel &channel, const std::string &queue, MessageHandler *handler,
+    int workers, int max_inflight) :
+  _channel(channel), _queue(queue), _handler(handler),
+  _workers(workers > 0 ? workers : 1), _max_inflight(max_inflight > 0 ? max_inflight : 1),
+  _inflight(0), _running(false) {
+  pthread_mutex_init(&_mutex, NULL);
+  pthread_cond_init(&_cond, NULL);
+}
+
+int ConsumerPool::start() {
+  if (_running) {
+    return 0;
+  }
+  //prefetch与在途消息上限一致，broker推送的消息都可以立即分给工作线程
+  _channel.create_consumer(_queue, _max_inflight);
+
+  _running = true;
+  for (int i = 0; i < _workers; ++i) {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, ConsumerPool::_work_loop, this) != 0) {
+      LOG_ERROR(debug_log, "consumer pool %s: create worker failed", _queue.c_str());
+      continue;
+    }
+    _threads.push_back(tid);
+  }
+  if (_threads.empty() || pthread_create(&_dispatcher, NULL, ConsumerPool::_dispatch_loop, this) != 0) {
+    _running = false;
+    for (size_t i = 0; i < _threads.size(); ++i) {
+      _tasks.put(NULL);
+    }
+    for (size_t i = 0; i < _threads.size(); ++i) {
+      pthread_join(_threads[i], NULL);
+    }
+    _threads.clear();
+    _channel.cancel_consumer(_queue);
+    return -1;
+  }
+  return 0;
+}
+
+void ConsumerPool::stop() {
+  if (!_running) {
+    return;
+  }
+  _running = false;
+  //分发线程确认所有在途消息后通知工作线程退出
+  pthread_join(_dispatcher, NULL);
+  for (size_t i = 0; i < _threads.size(); ++i) {
+    pthread_join(_threads[i], NULL);
+  }
+  _threads.clear();
+}
+
+void* ConsumerPool::_dispatch_loop(void *param) {
+  ConsumerPool *pool = (ConsumerPool *)param;
+  pool->_dispatch();
+  return NULL;
+}
+
+void* ConsumerPool::_work_loop(void *param) {
+  ConsumerPool *pool = (ConsumerPool *)param;
+  pool->_work();
+  return NULL;
+}
+
+void ConsumerPool::_dispatch() {
+  while (_running) {
+    //在途消息达到上限时只等待处理结果，不再拉取
+    _inflight -= _ack_done(_inflight >= _max_inflight);
+    if (_inflight >= _max_inflight) {
+      continue;
+    }
+    AmqpClient::Envelope::ptr_t envelope;
+    unsigned int generation = 0;
+    if (_channel.consume_message(envelope, _queue, POLL_TIMEOUT, &generation) == -1) {
+      continue;
+    }
+    Delivery *delivery = new Delivery;
+    delivery->envelope = envelope;
+    delivery->generation = generation;
+    delivery->ret = -1;
+    ++_inflight;
+    _tasks.put(delivery);
+  }
+
+  //停止拉取。cancel之后已经预取到本地但没有分发的消息既读不到也不会被broker重新投递，
+  //确认完在途消息后重建连接，旧连接关闭时broker把这些消息重新入队
+  _channel.cancel_consumer(_queue);
+  while (_inflight > 0) {
+    _inflight -= _ack_done(true);
+  }
+  _channel.rebuild();
+  for (size_t i = 0; i < _threads.size(); ++i) {
+    _tasks.put(NULL);
+  }
+}
+
+void ConsumerPool::_work() {
+  for (;;) {
+    Delivery *delivery = _tasks.get();
+    if (delivery == NULL) {
+      break;
+    }
+    try {
+      delivery->ret = _handler->handle(delivery->envelope->Message()->Body());
+    } catch (std::exception &e) {
+      LOG_ERROR(debug_log, "consumer pool %s: handle failed, %s", _queue.c_str(), e.what());
+      delivery->ret = -1;
+    }
+    pthread_mutex_lock(&_mutex);
+    _done.push_back(delivery);
+    pthread_cond_signal(&_cond);
+    pthread_mutex_unlock(&_mutex);
+  }
+}
+
+int ConsumerPool::_ack_done(bool wait) {
+  std::vector<Delivery *> done;
+  pthread_mutex_lock(&_mutex);
+  if (wait && _done.empty()) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    long nsec = deadline.tv_nsec + POLL_TIMEOUT * 1000000L;
+    deadline.tv_sec += nsec / 1000000000;
+    deadline.tv_nsec = nsec % 1000000000;
+    pthread_cond_timedwait(&_cond, &_mutex, &deadline);
+  }
+  done.swap(_done);
+  pthread_mutex_unlock(&_mutex);
+
+  for (size_t i = 0; i < done.size(); ++i) {
+    //channel重建后delivery tag从1重新开始，旧连接的消息已经由broker重新入队，不再确认，
+    //否则旧的tag会确认新连接上的其他消息
+    try {
+      bool current = false;
+      if (done[i]->ret == 0) {
+        current = _channel.ack(done[i]->envelope, done[i]->generation);
+      } else {
+        current = _channel.reject(done[i]->envelope, true, done[i]->generation);
+      }
+      if (!current) {
+        LOG_INFO(debug_log, "consumer pool %s: drop ack of delivery before channel rebuild", _queue.c_str());
+      }
+    } catch (std::exception &e) {
+      LOG_ERROR(debug_log, "consumer pool %s: ack failed, %s", _queue.c_str(), e.what());
+    }
+    delete done[i];
+  }
+  return done.size();
+}
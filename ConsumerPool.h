@@ -0,0 +1,113 @@
+/***************************************************************************************
+ *
+ * Copyright (c) 2026 Lejent, Inc. All Rights Reserved
+ *
+ **************************************************************************************/
+/**
+ *    @file: ConsumerPool.h
+ *    @date: 10/17/2026 04:05:51 PM
+ * @version: 1.0
+ *   @brief: 单个队列的多线程消费：一个分发线程从Channel拉取消息，通过BlockQueue
+ *           分给多个工作线程处理，每条消息持有自己的envelope，处理完成后确认。
+ *           SimpleAmqpClient的Channel不是线程安全的，所有拉取和确认都在分发线程中执行，
+ *           工作线程只把处理结果交回分发线程。
+ *
+ **/
+#ifndef __CONSUMER_POOL_H__
+#define __CONSUMER_POOL_H__
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "MQClient.h"
+#include "BlockQueue.h"
+
+class MessageHandler {
+  public:
+    virtual ~MessageHandler() {}
+
+    /**
+    * @brief 处理一条消息，在工作线程中并发调用
+    * @return 成功为0，消息被确认；失败为-1，消息被拒绝并重新入队
+    **/
+    virtual int handle(const std::string &message) = 0;
+};
+
+class ConsumerPool {
+  public:
+    /**
+    * @param [in] channel 已经open的Channel，生命周期长于ConsumerPool，
+    * 运行期间不能再被其他线程用于消费；stop时重建该Channel，
+    * 其他consumer在该Channel上未确认的消息会被broker重新投递
+    * @param [in] queue 队列名
+    * @param [in] handler 消息处理，生命周期长于ConsumerPool
+    * @param [in] workers 工作线程数
+    * @param [in] max_inflight 已经拉取但是没有确认的消息数上限，同时作为consumer的prefetch
+    **/
+    ConsumerPool(Channel &channel, const std::string &queue, MessageHandler *handler,
+        int workers = 4, int max_inflight = 64);
+
+    ~ConsumerPool() {
+      stop();
+      pthread_mutex_destroy(&_mutex);
+      pthread_cond_destroy(&_cond);
+    }
+
+    /**
+    * @brief 创建consumer，启动分发线程和工作线程
+    * @return 成功为0，失败为-1
+    **/
+    int start();
+
+    /**
+    * @brief 停止拉取，等待已经拉取的消息处理完并确认后重建Channel，
+    * 预取到本地但没有分发的消息由broker重新入队
+    **/
+    void stop();
+
+  private:
+    struct Delivery {
+      AmqpClient::Envelope::ptr_t envelope;
+      //envelope所属连接的代数，Channel重建后旧的消息不再确认
+      unsigned int generation;
+      int ret;
+    };
+
+    static void* _dispatch_loop(void *param);
+
+    static void* _work_loop(void *param);
+
+    void _dispatch();
+
+    void _work();
+
+    /**
+    * @brief 确认已经处理完的消息，wait为true时没有处理完的消息则等待
+    * @return 确认的消息数
+    **/
+    int _ack_done(bool wait);
+
+    //不允许拷贝和赋值操作
+    ConsumerPool(const ConsumerPool &other);
+    ConsumerPool& operator= (const ConsumerPool &other);
+
+    Channel &_channel;
+    std::string _queue;
+    MessageHandler *_handler;
+    int _workers;
+    int _max_inflight;
+
+    //分发线程 -> 工作线程，NULL通知工作线程退出
+    BlockQueue<Delivery *> _tasks;
+    //工作线程 -> 分发线程，处理完等待确认的消息
+    pthread_mutex_t _mutex;
+    pthread_cond_t _cond;
+    std::vector<Delivery *> _done;
+    //只在分发线程中访问
+    int _inflight;
+
+    volatile bool _running;
+    pthread_t _dispatcher;
+    std::vector<pthread_t> _threads;
+};
+
+#endif
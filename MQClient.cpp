@@ -13,6 +13,7 @@
  *  
  **/
 #include <stdio.h>
+#include <algorithm>
 #include <exception>
 #include "MQClient.h"
 #include "AutoLock.h"
@@ -28,10 +29,10 @@ int Channel::open() {
   return 0;
 }
 
-Consumer Channel::create_consumer(std::string queue_name){
+Consumer Channel::create_consumer(std::string queue_name, int prefetch){
   AutoLock<Mutex> lock(&_mutex);
   try {
-    Consumer consumer = _create_consumer(queue_name);
+    Consumer consumer = _create_consumer(queue_name, prefetch);
     return consumer;
   } catch (std::exception &e) {
     LOG_ERROR(debug_log, "create consumer %s failed, %s", queue_name.c_str(), e.what());
@@ -39,11 +40,18 @@ Consumer Channel::create_consumer(std::string queue_name){
   }
 }
 
-Consumer Channel::_create_consumer(std::string queue_name){
+Consumer Channel::_create_consumer(std::string queue_name, int prefetch){
+  //AMQP的prefetch count为16位
+  if(prefetch < 1) {
+    prefetch = 1;
+  } else if(prefetch > 65535) {
+    prefetch = 65535;
+  }
   std::string consumer_queue = _channel->DeclareQueue(queue_name, true, true, false, false); 
-  std::string consumer_name = _channel->BasicConsume(consumer_queue, "", true, false, false); 
-  _channel->BasicQos(consumer_name, 1);
+  std::string consumer_name = _channel->BasicConsume(consumer_queue, "", true, false, false, prefetch); 
+  _channel->BasicQos(consumer_name, prefetch);
   _consumer_name[queue_name] = consumer_name;
+  _consumer_prefetch[queue_name] = prefetch;
   Consumer consumer(queue_name, *this);
   return consumer;
 }
@@ -70,6 +78,8 @@ Exchange Channel::create_exchange(const std::string name) {
   AutoLock<Mutex> lock(&_mutex);
   try {
     Exchange exchange = _create_exchange(name);
+    //记录exchange，重建时重新声明
+    _exchange_name[name];
     return exchange;
   } catch(std::exception &e) {
     LOG_ERROR(debug_log, "create exchange %s failed, %s", name.c_str(), e.what());
@@ -83,20 +93,46 @@ Exchange Channel::_create_exchange(std::string name) {
   return exchange;
 }
 
-int Channel::consume_message(AmqpClient::Envelope::ptr_t &envelope, const std::string &queue, int time_out) {
+int Channel::declare_exchange(const std::string &name, const std::vector<std::string> &queues) {
+  AutoLock<Mutex> lock(&_mutex);
+  try {
+    _create_exchange(name);
+    //记录exchange和绑定关系，重建时重新声明
+    std::vector<std::string> &bound = _exchange_name[name];
+    for(size_t i = 0; i < queues.size(); ++i) {
+      _channel->BindQueue(queues[i], name);
+      if(std::find(bound.begin(), bound.end(), queues[i]) == bound.end()) {
+        bound.push_back(queues[i]);
+      }
+    }
+  } catch(std::exception &e) {
+    LOG_ERROR(debug_log, "declare exchange %s failed, %s", name.c_str(), e.what());
+    return -1;
+  }
+  return 0;
+}
+
+int Channel::consume_message(AmqpClient::Envelope::ptr_t &envelope, const std::string &queue, int time_out,
+    unsigned int *generation) {
   try {
     std::string tag = "";
     std::map<std::string, std::string>::iterator it;
+    //与tag一起取出连接，其他线程重建时消息仍然来自这个连接
+    AmqpClient::Channel::ptr_t channel;
     {
       AutoLock<Mutex> lock(&_mutex);
       it = _consumer_name.find(queue);
       if(it != _consumer_name.end()) {
         tag = it->second;
       }
+      channel = _channel;
+      if(generation != NULL) {
+        *generation = _generation;
+      }
     }
     bool ret = false;
     if(tag != "") {
-      ret = _channel->BasicConsumeMessage(tag, envelope, time_out);
+      ret = channel->BasicConsumeMessage(tag, envelope, time_out);
     } else {
       ret = false;
     }
@@ -154,12 +190,70 @@ int Channel::publish(const std::string &message, const std::string &queue, int d
     AutoLock<Mutex> lock(&_mutex);
     LOG_ERROR(debug_log, "MQ exception:%s then rebuild", e.what());
     _rebuild();
+  } catch (std::exception &e) {
+    //连接被broker或网络断开，同样重建
+    AutoLock<Mutex> lock(&_mutex);
+    LOG_ERROR(debug_log, "MQ publish failed:%s then rebuild", e.what());
+    _rebuild();
   }
   return -1;
 }
 
+int Channel::publish_batch(const std::vector<std::string> &messages, const std::string &queue, int deliver_mode,
+    const std::string &exchange_name, std::vector<int> *failed) {
+  std::string routing_key = "";
+  if(exchange_name == "") {
+    AutoLock<Mutex> lock(&_mutex);
+    std::map<std::string, std::string>::iterator it = _producer_name.find(queue);
+    if(it == _producer_name.end()) {
+      return -1;
+    }
+    routing_key = it->second;
+  }
+
+  //confirm连接与_channel相互独立，_channel重建不影响批量发送
+  AutoLock<Mutex> lock(&_publisher_mutex);
+  if(!_publisher) {
+    _publisher.reset(new ConfirmPublisher(_uri));
+  }
+  int ret = _publisher->publish(messages, exchange_name, routing_key, deliver_mode, failed);
+  if(ret == -1) {
+    LOG_ERROR(debug_log, "MQ publish batch of %d messages failed", (int)messages.size());
+  }
+  return ret;
+}
+
 void Channel::bind_queue(const std::string queue, const std::string exchange) {
+  AutoLock<Mutex> lock(&_mutex);
   _channel->BindQueue(queue, exchange);
+  //记录绑定关系，重建时重新绑定
+  std::vector<std::string> &queues = _exchange_name[exchange];
+  if(std::find(queues.begin(), queues.end(), queue) == queues.end()) {
+    queues.push_back(queue);
+  }
+}
+
+bool Channel::ack(const AmqpClient::Envelope::ptr_t &envelope, unsigned int generation) {
+  AutoLock<Mutex> lock(&_mutex);
+  if(generation != _generation) {
+    return false;
+  }
+  _channel->BasicAck(envelope);
+  return true;
+}
+
+bool Channel::reject(const AmqpClient::Envelope::ptr_t &envelope, bool requeue, unsigned int generation) {
+  AutoLock<Mutex> lock(&_mutex);
+  if(generation != _generation) {
+    return false;
+  }
+  _channel->BasicReject(envelope, requeue);
+  return true;
+}
+
+void Channel::rebuild() {
+  AutoLock<Mutex> lock(&_mutex);
+  _rebuild();
 }
 
 void Channel::_rebuild() {
@@ -176,6 +270,7 @@ void Channel::_rebuild() {
   for(;;) {
     try {
       _channel = AmqpClient::Channel::CreateFromUri(_uri);
+      ++_generation;
       break;
     } catch (std::exception &e) {
       LOG_INFO(debug_log, "Channel create failed: %s, then retry", e.what());
@@ -184,7 +279,7 @@ void Channel::_rebuild() {
   for(it = _consumer_name.begin(); it != _consumer_name.end(); ++it) {
     std::string raw_queue = it->first;
     //如果不cancel所有的consumer会导致有些消息消费不了
-    _create_consumer(raw_queue);
+    _create_consumer(raw_queue, _consumer_prefetch[raw_queue]);
   }
 
   //重建所有生产者
@@ -198,7 +293,7 @@ void Channel::_rebuild() {
     std::vector<std::string> &queue = ex_it->second;
     _create_exchange(ex_it->first);
     for(int i = 0; i < queue.size(); ++i) {
-      bind_queue(queue[i], ex_it->first);
+      _channel->BindQueue(queue[i], ex_it->first);
     }
   }
 }
@@ -207,6 +302,7 @@ void Channel::cancel_consumer(std::string queue) {
   AutoLock<Mutex> mutex(&_mutex);
   _cancel_consumer(queue);
   _consumer_name.erase(queue);
+  _consumer_prefetch.erase(queue);
 }
 
 void Channel::_cancel_consumer(std::string queue) {
@@ -221,7 +317,7 @@ void Channel::_cancel_consumer(std::string queue) {
 
 int Consumer::pull(std::string &message, int time_out) {
   try {
-    int ret = _channel.consume_message(_envelope, _queue, time_out); 
+    int ret = _channel.consume_message(_envelope, _queue, time_out, &_generation); 
     if(ret == -1) {
       return -1;
     }
@@ -234,17 +330,59 @@ int Consumer::pull(std::string &message, int time_out) {
 
 void Consumer::ack() {
   try {
-    _channel.ack(_envelope); 
+    _channel.ack(_envelope, _generation); 
   } catch (std::exception &e) {
     LOG_INFO(debug_log, "ack failed! message=%s", e.what());
   }
 }
 
+int Consumer::pull_batch(std::vector<std::string> &messages, int max_messages, int time_out) {
+  messages.clear();
+  _batch.clear();
+  _batch_generation.clear();
+  AmqpClient::Envelope::ptr_t envelope;
+  unsigned int generation = 0;
+  int wait = time_out;
+  try {
+    while((int)messages.size() < max_messages) {
+      if(_channel.consume_message(envelope, _queue, wait, &generation) == -1) {
+        break;
+      }
+      messages.push_back(envelope->Message()->Body());
+      _batch.push_back(envelope);
+      _batch_generation.push_back(generation);
+      //第一条消息到达后只取已经预取到本地的消息
+      wait = 0;
+    }
+  } catch (std::exception &e) {
+    LOG_INFO(debug_log, "consumer pull batch failed! message=%s", e.what());
+  }
+  return messages.size();
+}
+
+void Consumer::ack_batch() {
+  try {
+    for(size_t i = 0; i < _batch.size(); ++i) {
+      //pull_batch中途重建时，重建前的消息已经重新入队，不再确认
+      _channel.ack(_batch[i], _batch_generation[i]);
+    }
+  } catch (std::exception &e) {
+    LOG_INFO(debug_log, "ack batch failed! message=%s", e.what());
+  }
+  //同一个delivery tag重复确认会导致broker关闭channel，失败时channel已经失效，不再重试
+  _batch.clear();
+  _batch_generation.clear();
+}
+
 int Producer::push(const std::string &message, int deliver_mode) {  
   int ret = _channel.publish(message, _queue, deliver_mode);
   return ret;
 }
 
+int Producer::push_batch(const std::vector<std::string> &messages, int deliver_mode, std::vector<int> *failed) {
+  return _channel.publish_batch(messages, _queue, deliver_mode, "", failed);
+}
+
 void Exchange::bind_queue(std::string queue) {
   _channel.bind_queue(queue, _name);
 }
@@ -254,3 +392,6 @@ int Exchange::push(const std::string &message, int deliver_mode) {
   return ret;
 } 
 
+int Exchange::push_batch(const std::vector<std::string> &messages, int deliver_mode, std::vector<int> *failed) {
+  return _channel.publish_batch(messages, "", deliver_mode, _name, failed);
+}
@@ -17,16 +17,15 @@
 #include <pthread.h>
 #include <SimpleAmqpClient/SimpleAmqpClient.h>
 #include "Mutex.h"
+#include "MQInterface.h"
+#include "ConfirmPublisher.h"
 
 class Channel;
 
-const int DM_NONPERSISTENT = 1;
-const int DM_PERSISTENT = 2;
-
-class Consumer {
+class Consumer : public MessageConsumer {
   public:
     Consumer(std::string queue, Channel &channel) : 
-      _channel(channel), _queue(queue){
+      _channel(channel), _queue(queue), _generation(0) {
     }
   
     /**
@@ -42,14 +41,36 @@ class Consumer {
     * 如果pull失败后执行ack会抛异常。
     **/
     void ack();
+
+    /**
+    * @brief 批量拉取消息，最多等待timeout毫秒到达第一条消息，
+    * 之后只取已经预取到本地的消息，不再等待
+    * @param [out] messages 消息
+    * @param [in] max_messages 最多拉取的消息数，一般不超过prefetch
+    * @param [in] timeout 超时，单位毫秒
+    * @return 拉取到的消息数，超时或者失败为0
+    **/
+    int pull_batch(std::vector<std::string> &messages, int max_messages, int timeout);
+
+    /**
+    * @brief 逐条确认上一次pull_batch拉取的消息。
+    * 不使用multiple标志：delivery tag属于整个channel，累积确认会把同一个Channel上
+    * 其他consumer未确认的消息一起确认
+    **/
+    void ack_batch();
   
   private:
     Channel &_channel;
     std::string _queue;
     AmqpClient::Envelope::ptr_t _envelope; 
+    //_envelope所属连接的代数，见Channel::generation
+    unsigned int _generation;
+    //pull_batch拉取的消息及所属连接的代数，等待ack_batch确认
+    std::vector<AmqpClient::Envelope::ptr_t> _batch;
+    std::vector<unsigned int> _batch_generation;
 };
 
-class Producer {
+class Producer : public MessageProducer {
   public:
     Producer(std::string queue,  Channel &channel) : 
       _channel(channel), _queue(queue) {
@@ -61,13 +82,23 @@ class Producer {
     * @return 成功为0，失败为-1
     **/
     int push(const std::string &message, int deliver_mode = DM_NONPERSISTENT);
+
+    /**
+    * @brief 批量推送消息，连续发送后按delivery tag等待broker的confirm，
+    * 持久化消息也不需要每条等待一个往返
+    * @param [in] messages 消息
+    * @param [out] failed 没有被confirm的消息下标，可以为NULL
+    * @return 全部confirm为0，连接失败为-1，个别消息nack为-3
+    **/
+    int push_batch(const std::vector<std::string> &messages, int deliver_mode = DM_NONPERSISTENT,
+        std::vector<int> *failed = NULL);
   
   private:
     Channel &_channel;
     std::string _queue;
 };
 
-class Exchange {
+class Exchange : public MessageProducer {
   public:
     Exchange(std::string name, Channel &channel) : _channel(channel), _name(name) {
     }
@@ -76,6 +107,12 @@ class Exchange {
 
     int push(const std::string &message, int deliver_mode = DM_NONPERSISTENT);
 
+    /**
+    * @brief 批量推送消息，参数和返回值与Producer::push_batch一致
+    **/
+    int push_batch(const std::vector<std::string> &messages, int deliver_mode = DM_NONPERSISTENT,
+        std::vector<int> *failed = NULL);
+
   private:
     Channel &_channel;
     std::string _name;
@@ -90,10 +127,12 @@ class Channel {
       _password = password;
       _vhost = vhost;
       _uri = "amqp://" + user_name + ":" + password + "@" + host + ":" + port + "/" + vhost;
+      _generation = 0;
     }
 
     Channel(std::string uri) {
       _uri = uri;
+      _generation = 0;
     }
 
     /**
@@ -111,17 +150,51 @@ class Channel {
     void ack(const AmqpClient::Envelope::ptr_t &envelope) {
       _channel->BasicAck(envelope);
     }
-  
+
+    /**
+    * @brief 拒绝消息，requeue为true时重新入队
+    **/
+    void reject(const AmqpClient::Envelope::ptr_t &envelope, bool requeue) {
+      _channel->BasicReject(envelope, requeue);
+    }
+
+    /**
+    * @brief 确认消息，只在消息来自当前连接时执行。重建后delivery tag从1重新开始，
+    * 旧连接的tag会确认新连接上的其他消息；旧连接上未确认的消息已经由broker重新入队
+    * @param [in] generation consume_message返回的连接代数
+    * @return 执行了确认为true，消息来自重建前的连接为false
+    **/
+    bool ack(const AmqpClient::Envelope::ptr_t &envelope, unsigned int generation);
+
+    /**
+    * @brief 拒绝消息，与ack(envelope, generation)一样只在消息来自当前连接时执行
+    **/
+    bool reject(const AmqpClient::Envelope::ptr_t &envelope, bool requeue, unsigned int generation);
+
+    /**
+    * @brief 连接的代数，每次重建加1
+    **/
+    unsigned int generation() {
+      return _generation;
+    }
     
     /**
     * @brief 从队列中拉取一个消息
+    * @param [out] generation 不为NULL时返回消息所属连接的代数，用于ack/reject
     **/
-    int consume_message(AmqpClient::Envelope::ptr_t &envelope, const std::string &queue, int timeout);
+    int consume_message(AmqpClient::Envelope::ptr_t &envelope, const std::string &queue, int timeout,
+        unsigned int *generation = NULL);
     
     /**
     * @brief 发送一个消息
     **/
     int publish(const std::string &message, const std::string &queue, int deliver_mode, const std::string &exchange_name = "");
+
+    /**
+    * @brief 批量发送消息，使用独立的confirm模式连接，等待所有消息的confirm
+    **/
+    int publish_batch(const std::vector<std::string> &messages, const std::string &queue, int deliver_mode,
+        const std::string &exchange_name = "", std::vector<int> *failed = NULL);
     
     /**
     * @brief 把queue绑定到exchange_name上
@@ -130,8 +203,10 @@ class Channel {
 
     /**
     * @brief 创建一个消费者
+    * @param [in] prefetch broker最多推送给该消费者的未确认消息数，
+    * 批量消费时设置为pull_batch的批次大小或者更大
     **/
-    Consumer create_consumer(std::string queue_name);
+    Consumer create_consumer(std::string queue_name, int prefetch = 1);
     
     /**
     * @brief 创建一个生产者
@@ -142,10 +217,19 @@ class Channel {
     * @brief 创建一个Exchange, fanout类型
     **/
     Exchange create_exchange(std::string exchanger_name);
+
+    /**
+    * @brief 声明exchange（fanout类型）并绑定queues，失败时不退出进程
+    * @return 成功为0，失败为-1
+    **/
+    int declare_exchange(const std::string &name, const std::vector<std::string> &queues);
     
     void cancel_consumer(std::string queue);
     
-    void rebuild() { _rebuild();}
+    /**
+    * @brief 重新建立连接，旧连接上未确认的消息由broker重新入队
+    **/
+    void rebuild();
 
   private:
     
@@ -154,7 +238,7 @@ class Channel {
     * 异常，这个时候需要重新连接MQ，重新建立所有已经注册的生产者和消费者。
     **/
     void _rebuild();
-    Consumer _create_consumer(std::string queue_name);
+    Consumer _create_consumer(std::string queue_name, int prefetch);
     Producer _create_producer(std::string queue_name);
     Exchange _create_exchange(std::string name);
     void _cancel_consumer(std::string queue);
@@ -166,11 +250,17 @@ class Channel {
     std::string _password;
     std::string _vhost;
     AmqpClient::Channel::ptr_t _channel;
+    //每次_rebuild加1，在_mutex下修改
+    volatile unsigned int _generation;
     //给人眼看的只是队列名，例如队列名为ocr，但是SimpleClient会生成一个对应的tag,
     //例如:amq.ctag-B0yEXhbbrTFvOjyeQTS09w，所以维护一个映射，简化客户端使用方法。
     std::map<std::string, std::string> _consumer_name; //记录所有的消费者，每个消费者对应唯一的tag
+    std::map<std::string, int> _consumer_prefetch; //每个消费者的prefetch，重建时使用
     std::map<std::string, std::string> _producer_name; //记录所有的生产者，每个生产者对应唯一的tag
     std::map<std::string, std::vector<std::string> > _exchange_name;
+    //批量发送使用的confirm连接，第一次publish_batch时建立
+    boost::shared_ptr<ConfirmPublisher> _publisher;
+    Mutex _publisher_mutex;
 };
 
 #endif
@@ -0,0 +1,52 @@
+/***************************************************************************************
+ *
+ * Copyright (c) 2026 Lejent, Inc. All Rights Reserved
+ *
+ **************************************************************************************/
+/**
+ *    @file: MQInterface.h
+ *    @date: 10/17/2026 10:21:37 AM
+ * @version: 1.0
+ *   @brief: 生产者和消费者的公共接口，RabbitMQ和Redis Streams各有一个实现，
+ *           调用方持有接口指针，可以按队列选择传输方式。
+ *
+ **/
+#ifndef __MQ_INTERFACE_H__
+#define __MQ_INTERFACE_H__
+#include <string>
+
+const int DM_NONPERSISTENT = 1;
+const int DM_PERSISTENT = 2;
+
+class MessageConsumer {
+  public:
+    virtual ~MessageConsumer() {}
+
+    /**
+    * @brief 拉取消息，timeout为超时
+    * @param [out] message 消息
+    * @param [in] timeout 超时，单位毫秒
+    * @return 成功为0，失败为-1
+    **/
+    virtual int pull(std::string &message, int timeout) = 0;
+
+    /**
+    * @brief 对上一次pull到的消息确认
+    **/
+    virtual void ack() = 0;
+};
+
+class MessageProducer {
+  public:
+    virtual ~MessageProducer() {}
+
+    /**
+    * @brief 推送消息
+    * @param [in] message 消息
+    * @param [in] deliver_mode 投递模式，实现不支持时忽略
+    * @return 成功为0，失败为-1
+    **/
+    virtual int push(const std::string &message, int deliver_mode = DM_NONPERSISTENT) = 0;
+};
+
+#endif
@@ -0,0 +1,604 @@
+
+#include "Logger.h"
+#include "AutoLock.h"
+#include "redis_async_client.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <cstdlib>
+#include <cstring>
+
+const int MAX_EPOLL_EVENTS = 4;
+
+RedisFuture::RedisFuture() : integer(0), _ready(false), _ret(-1) {
+  pthread_mutex_init(&_mutex, NULL);
+  pthread_cond_init(&_cond, NULL);
+}
+
+RedisFuture::~RedisFuture() {
+  pthread_mutex_destroy(&_mutex);
+  pthread_cond_destroy(&_cond);
+}
+
+int RedisFuture::wait() {
+  pthread_mutex_lock(&_mutex);
+  while (!_ready) {
+    pthread_cond_wait(&_cond, &_mutex);
+  }
+  int ret = _ret;
+  pthread_mutex_unlock(&_mutex);
+  return ret;
+}
+
+bool RedisFuture::ready() {
+  pthread_mutex_lock(&_mutex);
+  bool ready = _ready;
+  pthread_mutex_unlock(&_mutex);
+  return ready;
+}
+
+void RedisFuture::reset() {
+  pthread_mutex_lock(&_mutex);
+  _ready = false;
+  _ret = -1;
+  value.clear();
+  values.clear();
+  integer = 0;
+  pthread_mutex_unlock(&_mutex);
+}
+
+void RedisFuture::_done(int ret) {
+  pthread_mutex_lock(&_mutex);
+  _ret = ret;
+  _ready = true;
+  pthread_cond_broadcast(&_cond);
+  pthread_mutex_unlock(&_mutex);
+}
+
+RedisAsyncClient::RedisAsyncClient() : _port(0), _db(0), _timeout(0),
+    _epoll_fd(-1), _wakeup_fd(-1), _running(false),
+    _redis_context(NULL), _fd(-1), _events(0) {
+}
+
+RedisAsyncClient::~RedisAsyncClient() {
+  stop();
+}
+
+bool RedisAsyncClient::init(const std::string &server_info_bak,
+    const std::string &password, long timeout) {
+  stop();
+
+  //ip:port:db 或者 ip:port
+  std::string server_info(server_info_bak);
+  size_t idx1 = server_info.find(':');
+  if (idx1 == std::string::npos) {
+    return false;
+  }
+  size_t idx2 = server_info.find(':', idx1 + 1);
+  if (idx2 == std::string::npos) {
+    _db = 0;
+  } else {
+    _db = atoi(server_info.c_str() + idx2 + 1);
+    server_info[idx2] = '\0';
+  }
+  server_info[idx1] = '\0';
+  _port = atoi(server_info.c_str() + idx1 + 1);
+  _host = std::string(server_info.c_str());
+  _password = password;
+  _timeout = timeout;
+
+  _epoll_fd = epoll_create(MAX_EPOLL_EVENTS);
+  if (_epoll_fd < 0) {
+    return false;
+  }
+  _wakeup_fd = eventfd(0, EFD_NONBLOCK);
+  if (_wakeup_fd < 0) {
+    close(_epoll_fd);
+    _epoll_fd = -1;
+    return false;
+  }
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = _wakeup_fd;
+  epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _wakeup_fd, &ev);
+
+  //先在调用线程中建立连接，与同步客户端一样由init的返回值反映连接是否可用
+  if (!_connect()) {
+    close(_wakeup_fd);
+    close(_epoll_fd);
+    _wakeup_fd = -1;
+    _epoll_fd = -1;
+    return false;
+  }
+
+  _running = true;
+  if (pthread_create(&_thread, NULL, RedisAsyncClient::_loop, this) != 0) {
+    _running = false;
+    _disconnect();
+    close(_wakeup_fd);
+    close(_epoll_fd);
+    _wakeup_fd = -1;
+    _epoll_fd = -1;
+    return false;
+  }
+  return true;
+}
+
+void RedisAsyncClient::stop() {
+  {
+    AutoLock<Mutex> lock(&_mutex);
+    if (!_running) {
+      return;
+    }
+    _running = false;
+  }
+  uint64_t one = 1;
+  ssize_t n = write(_wakeup_fd, &one, sizeof(one));
+  (void)n;
+  pthread_join(_thread, NULL);
+
+  //事件循环线程已经退出，剩余的命令在当前线程中以失败结束
+  _disconnect();
+  std::deque<Request *> pending;
+  {
+    AutoLock<Mutex> lock(&_mutex);
+    pending.swap(_pending);
+  }
+  for (size_t i = 0; i < pending.size(); ++i) {
+    _fail(pending[i]);
+  }
+
+  close(_wakeup_fd);
+  close(_epoll_fd);
+  _wakeup_fd = -1;
+  _epoll_fd = -1;
+}
+
+int RedisAsyncClient::command_argv(int argc, const char **argv, const size_t *argv_len,
+    RedisAsyncCallback callback, void *privdata) {
+  if (argc <= 0 || argv == NULL || argv_len == NULL) {
+    return -2;
+  }
+  char *cmd = NULL;
+  int len = redisFormatCommandArgv(&cmd, argc, argv, argv_len);
+  if (len < 0 || cmd == NULL) {
+    return -2;
+  }
+  return _push(cmd, len, callback, privdata);
+}
+
+int RedisAsyncClient::_push(char *cmd, int len, RedisAsyncCallback callback, void *privdata) {
+  Request *req = new Request;
+  req->cmd = cmd;
+  req->len = len;
+  req->callback = callback;
+  req->privdata = privdata;
+  req->start = _now_ms();
+
+  bool wakeup = false;
+  {
+    AutoLock<Mutex> lock(&_mutex);
+    if (!_running) {
+      free(cmd);
+      delete req;
+      return -1;
+    }
+    //队列为空时才需要唤醒，否则事件循环线程还没来得及处理上一次唤醒
+    wakeup = _pending.empty();
+    _pending.push_back(req);
+  }
+  if (wakeup) {
+    uint64_t one = 1;
+    ssize_t n = write(_wakeup_fd, &one, sizeof(one));
+    (void)n;
+  }
+  return 0;
+}
+
+int RedisAsyncClient::set(const std::string &key, const std::string &value, RedisFuture *future) {
+  if (key.empty() || value.empty() || future == NULL) {
+    return -2;
+  }
+  const char *argv[3] = {"SET", key.c_str(), value.c_str()};
+  size_t argv_len[3] = {3, key.length(), value.length()};
+  return command_argv(3, argv, argv_len, RedisAsyncClient::_status_reply, future);
+}
+
+int RedisAsyncClient::get(const std::string &key, RedisFuture *future) {
+  if (key.empty() || future == NULL) {
+    return -2;
+  }
+  const char *argv[2] = {"GET", key.c_str()};
+  size_t argv_len[2] = {3, key.length()};
+  return command_argv(2, argv, argv_len, RedisAsyncClient::_string_reply, future);
+}
+
+int RedisAsyncClient::mset(const std::vector<std::string> &keys,
+    const std::vector<std::string> &values, RedisFuture *future) {
+  if (keys.size() != values.size() || keys.empty() || future == NULL) {
+    return -2;
+  }
+
+  int argc = keys.size() * 2 + 1;
+  std::vector<const char *> argv(argc);
+  std::vector<size_t> argv_len(argc);
+  argv[0] = "MSET";
+  argv_len[0] = 4;
+  for (int i = 0, j = keys.size(), k = 1; i < j; ++i) {
+    argv[k] = keys[i].c_str();
+    argv_len[k] = keys[i].length();
+    ++k;
+    argv[k] = values[i].c_str();
+    argv_len[k] = values[i].length();
+    ++k;
+  }
+  return command_argv(argc, &argv[0], &argv_len[0], RedisAsyncClient::_status_reply, future);
+}
+
+int RedisAsyncClient::mget(const std::vector<std::string> &keys, RedisFuture *future) {
+  if (keys.empty() || future == NULL) {
+    return -2;
+  }
+
+  int argc = keys.size() + 1;
+  std::vector<const char *> argv(argc);
+  std::vector<size_t> argv_len(argc);
+  argv[0] = "MGET";
+  argv_len[0] = 4;
+  for (int i = 0, j = keys.size(), k = 1; i < j; ++i, ++k) {
+    argv[k] = keys[i].c_str();
+    argv_len[k] = keys[i].length();
+  }
+  return command_argv(argc, &argv[0], &argv_len[0], RedisAsyncClient::_array_reply, future);
+}
+
+int RedisAsyncClient::hset(const std::string &key, const std::string &h_key,
+    const std::string &h_value, RedisFuture *future) {
+  if (key.empty() || h_key.empty() || future == NULL) {
+    return -2;
+  }
+  const char *argv[4] = {"HSET", key.c_str(), h_key.c_str(), h_value.c_str()};
+  size_t argv_len[4] = {4, key.length(), h_key.length(), h_value.length()};
+  return command_argv(4, argv, argv_len, RedisAsyncClient::_integer_reply, future);
+}
+
+int RedisAsyncClient::hget(const std::string &key, const std::string &h_key, RedisFuture *future) {
+  if (key.empty() || h_key.empty() || future == NULL) {
+    return -2;
+  }
+  const char *argv[3] = {"HGET", key.c_str(), h_key.c_str()};
+  size_t argv_len[3] = {4, key.length(), h_key.length()};
+  return command_argv(3, argv, argv_len, RedisAsyncClient::_string_reply, future);
+}
+
+int RedisAsyncClient::del(const std::vector<std::string> &keys, RedisFuture *future) {
+  if (keys.empty() || future == NULL) {
+    return -2;
+  }
+
+  int argc = keys.size() + 1;
+  std::vector<const char *> argv(argc);
+  std::vector<size_t> argv_len(argc);
+  argv[0] = "DEL";
+  argv_len[0] = 3;
+  for (int i = 0, j = keys.size(), k = 1; i < j; ++i, ++k) {
+    argv[k] = keys[i].c_str();
+    argv_len[k] = keys[i].length();
+  }
+  return command_argv(argc, &argv[0], &argv_len[0], RedisAsyncClient::_integer_reply, future);
+}
+
+void* RedisAsyncClient::_loop(void *param) {
+  RedisAsyncClient *client = (RedisAsyncClient *)param;
+  client->_run();
+  return NULL;
+}
+
+void RedisAsyncClient::_run() {
+  struct epoll_event events[MAX_EPOLL_EVENTS];
+  //有超时判断时按10ms的粒度检查最早发出的命令
+  int wait_ms = _timeout > 0 ? 10 : -1;
+  while (_running) {
+    int n = epoll_wait(_epoll_fd, events, MAX_EPOLL_EVENTS, wait_ms);
+    for (int i = 0; i < n; ++i) {
+      if (events[i].data.fd == _wakeup_fd) {
+        uint64_t count = 0;
+        ssize_t ret = read(_wakeup_fd, &count, sizeof(count));
+        (void)ret;
+        continue;
+      }
+      if (_redis_context == NULL || events[i].data.fd != _fd) {
+        continue;
+      }
+      if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        redisAsyncHandleRead(_redis_context);
+      }
+      //读的过程中连接可能已经被释放
+      if (_redis_context != NULL && (events[i].events & EPOLLOUT)) {
+        redisAsyncHandleWrite(_redis_context);
+      }
+    }
+    _submit_pending();
+    _check_timeout();
+  }
+}
+
+void RedisAsyncClient::_submit_pending() {
+  std::deque<Request *> pending;
+  {
+    AutoLock<Mutex> lock(&_mutex);
+    pending.swap(_pending);
+  }
+  if (pending.empty()) {
+    return;
+  }
+
+  //连接断开后在有新命令时重连
+  if (_redis_context == NULL && !_connect()) {
+    LOG_ERROR(debug_log, "redis async: connect %s:%d failed", _host.c_str(), _port);
+    for (size_t i = 0; i < pending.size(); ++i) {
+      _fail(pending[i]);
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < pending.size(); ++i) {
+    Request *req = pending[i];
+    if (_redis_context == NULL
+        || redisAsyncFormattedCommand(_redis_context, RedisAsyncClient::_on_reply,
+          req, req->cmd, req->len) != REDIS_OK) {
+      _fail(req);
+      continue;
+    }
+    //命令已经拷贝到hiredis的输出缓冲区
+    free(req->cmd);
+    req->cmd = NULL;
+    _inflight.push_back(req);
+  }
+}
+
+void RedisAsyncClient::_check_timeout() {
+  if (_timeout <= 0 || _inflight.empty()) {
+    return;
+  }
+  if (_now_ms() - _inflight.front()->start > _timeout) {
+    LOG_ERROR(debug_log, "redis async: command timeout, %d commands in flight, then reconnect",
+        (int)_inflight.size());
+    _disconnect();
+  }
+}
+
+bool RedisAsyncClient::_connect() {
+  redisAsyncContext *ac = redisAsyncConnect(_host.c_str(), _port);
+  if (ac == NULL) {
+    return false;
+  }
+  if (ac->err) {
+    LOG_ERROR(debug_log, "redis async: connect error, %s", ac->errstr);
+    redisAsyncFree(ac);
+    return false;
+  }
+
+  _redis_context = ac;
+  _fd = ac->c.fd;
+  _events = 0;
+  ac->data = this;
+  ac->ev.data = this;
+  ac->ev.addRead = RedisAsyncClient::_add_read;
+  ac->ev.delRead = RedisAsyncClient::_del_read;
+  ac->ev.addWrite = RedisAsyncClient::_add_write;
+  ac->ev.delWrite = RedisAsyncClient::_del_write;
+  ac->ev.cleanup = RedisAsyncClient::_cleanup;
+  redisAsyncSetConnectCallback(ac, RedisAsyncClient::_on_connect);
+  redisAsyncSetDisconnectCallback(ac, RedisAsyncClient::_on_disconnect);
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.data.fd = _fd;
+  epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _fd, &ev);
+  //非阻塞连接，可写时表示连接建立完成
+  _add_write(this);
+
+  //AUTH和SELECT作为最先发出的命令，与后续命令一起pipeline
+  if (!_password.empty()) {
+    const char *argv[2] = {"AUTH", _password.c_str()};
+    size_t argv_len[2] = {4, _password.length()};
+    char *cmd = NULL;
+    int len = redisFormatCommandArgv(&cmd, 2, argv, argv_len);
+    Request *req = new Request;
+    req->cmd = NULL;
+    req->len = 0;
+    req->callback = NULL;
+    req->privdata = NULL;
+    req->start = _now_ms();
+    redisAsyncFormattedCommand(ac, RedisAsyncClient::_on_reply, req, cmd, len);
+    free(cmd);
+    _inflight.push_back(req);
+  }
+  if (_db != 0) {
+    char db[16];
+    snprintf(db, sizeof(db), "%d", _db);
+    const char *argv[2] = {"SELECT", db};
+    size_t argv_len[2] = {6, strlen(db)};
+    char *cmd = NULL;
+    int len = redisFormatCommandArgv(&cmd, 2, argv, argv_len);
+    Request *req = new Request;
+    req->cmd = NULL;
+    req->len = 0;
+    req->callback = NULL;
+    req->privdata = NULL;
+    req->start = _now_ms();
+    redisAsyncFormattedCommand(ac, RedisAsyncClient::_on_reply, req, cmd, len);
+    free(cmd);
+    _inflight.push_back(req);
+  }
+  return true;
+}
+
+void RedisAsyncClient::_disconnect() {
+  if (_redis_context != NULL) {
+    //redisAsyncFree会以NULL reply回调所有等待回复的命令
+    redisAsyncContext *ac = _redis_context;
+    _redis_context = NULL;
+    redisAsyncFree(ac);
+  }
+  while (!_inflight.empty()) {
+    _fail(_inflight.front());
+    _inflight.pop_front();
+  }
+  _fd = -1;
+  _events = 0;
+}
+
+void RedisAsyncClient::_update_events() {
+  if (_fd < 0) {
+    return;
+  }
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = _events;
+  ev.data.fd = _fd;
+  epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, _fd, &ev);
+}
+
+void RedisAsyncClient::_fail(Request *req) {
+  if (req->callback != NULL) {
+    req->callback(NULL, req->privdata);
+  }
+  free(req->cmd);
+  delete req;
+}
+
+long RedisAsyncClient::_now_ms() {
+  struct timeval t;
+  gettimeofday(&t, NULL);
+  return t.tv_sec * 1000 + t.tv_usec / 1000;
+}
+
+void RedisAsyncClient::_add_read(void *privdata) {
+  RedisAsyncClient *client = (RedisAsyncClient *)privdata;
+  client->_events |= EPOLLIN;
+  client->_update_events();
+}
+
+void RedisAsyncClient::_del_read(void *privdata) {
+  RedisAsyncClient *client = (RedisAsyncClient *)privdata;
+  client->_events &= ~EPOLLIN;
+  client->_update_events();
+}
+
+void RedisAsyncClient::_add_write(void *privdata) {
+  RedisAsyncClient *client = (RedisAsyncClient *)privdata;
+  client->_events |= EPOLLOUT;
+  client->_update_events();
+}
+
+void RedisAsyncClient::_del_write(void *privdata) {
+  RedisAsyncClient *client = (RedisAsyncClient *)privdata;
+  client->_events &= ~EPOLLOUT;
+  client->_update_events();
+}
+
+void RedisAsyncClient::_cleanup(void *privdata) {
+  RedisAsyncClient *client = (RedisAsyncClient *)privdata;
+  if (client->_fd >= 0) {
+    epoll_ctl(client->_epoll_fd, EPOLL_CTL_DEL, client->_fd, NULL);
+  }
+  client->_fd = -1;
+  client->_events = 0;
+}
+
+void RedisAsyncClient::_on_reply(redisAsyncContext *ac, void *reply, void *privdata) {
+  RedisAsyncClient *client = (RedisAsyncClient *)ac->data;
+  Request *req = (Request *)privdata;
+  //redis按序回复，回调的一般是最早发出的命令
+  std::deque<Request *>::iterator it;
+  for (it = client->_inflight.begin(); it != client->_inflight.end(); ++it) {
+    if (*it == req) {
+      client->_inflight.erase(it);
+      break;
+    }
+  }
+  redisReply *r = (redisReply *)reply;
+  if (req->callback == NULL && r != NULL && r->type == REDIS_REPLY_ERROR) {
+    //内部命令（AUTH/SELECT）失败
+    LOG_ERROR(debug_log, "redis async: %s", r->str);
+  }
+  if (req->callback != NULL) {
+    req->callback(r, req->privdata);
+  }
+  free(req->cmd);
+  delete req;
+}
+
+void RedisAsyncClient::_on_connect(const redisAsyncContext *ac, int status) {
+  if (status != REDIS_OK) {
+    RedisAsyncClient *client = (RedisAsyncClient *)ac->data;
+    LOG_ERROR(debug_log, "redis async: connect %s:%d failed, %s",
+        client->_host.c_str(), client->_port, ac->errstr);
+    //hiredis会在回调返回后释放连接
+    client->_redis_context = NULL;
+  }
+}
+
+void RedisAsyncClient::_on_disconnect(const redisAsyncContext *ac, int status) {
+  RedisAsyncClient *client = (RedisAsyncClient *)ac->data;
+  if (status != REDIS_OK) {
+    LOG_ERROR(debug_log, "redis async: disconnected from %s:%d, %s",
+        client->_host.c_str(), client->_port, ac->errstr);
+  }
+  client->_redis_context = NULL;
+}
+
+void RedisAsyncClient::_status_reply(redisReply *reply, void *privdata) {
+  RedisFuture *future = (RedisFuture *)privdata;
+  int ret = -1;
+  if (reply != NULL && reply->type == REDIS_REPLY_STATUS && strcmp(reply->str, "OK") == 0) {
+    ret = 0;
+  }
+  future->_done(ret);
+}
+
+void RedisAsyncClient::_string_reply(redisReply *reply, void *privdata) {
+  RedisFuture *future = (RedisFuture *)privdata;
+  int ret = -1;
+  if (reply != NULL) {
+    if (reply->type == REDIS_REPLY_NIL) {
+      //该key不存在
+      ret = 1;
+    } else if (reply->type == REDIS_REPLY_STRING) {
+      future->value.assign(reply->str, reply->len);
+      ret = 0;
+    }
+  }
+  future->_done(ret);
+}
+
+void RedisAsyncClient::_array_reply(redisReply *reply, void *privdata) {
+  RedisFuture *future = (RedisFuture *)privdata;
+  int ret = -1;
+  if (reply != NULL && reply->type == REDIS_REPLY_ARRAY) {
+    future->values.resize(reply->elements);
+    for (size_t i = 0; i < reply->elements; ++i) {
+      redisReply *one_reply = reply->element[i];
+      if (one_reply->type == REDIS_REPLY_STRING) {
+        future->values[i].assign(one_reply->str, one_reply->len);
+      }
+    }
+    ret = 0;
+  }
+  future->_done(ret);
+}
+
+void RedisAsyncClient::_integer_reply(redisReply *reply, void *privdata) {
+  RedisFuture *future = (RedisFuture *)privdata;
+  int ret = -1;
+  if (reply != NULL && reply->type == REDIS_REPLY_INTEGER) {
+    future->integer = reply->integer;
+    ret = 0;
+  }
+  future->_done(ret);
+}
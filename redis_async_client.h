@@ -0,0 +1,214 @@
+
+#ifndef AFANTI_REDIS_ASYNC_CLIENT_H_
+#define AFANTI_REDIS_ASYNC_CLIENT_H_
+
+#include <hircluster.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include "Mutex.h"
+
+/**
+ * @brief 异步命令的回调，在事件循环线程中执行，reply在回调返回后由hiredis释放，
+ *        连接失败或超时时reply为NULL。回调中不能阻塞，可以继续调用异步接口提交命令。
+ **/
+typedef void (*RedisAsyncCallback)(redisReply *reply, void *privdata);
+
+/**
+ * RedisFuture
+ * 异步命令的执行结果，由事件循环线程填充，调用方通过wait等待。
+ * 命令完成（成功、失败或超时）之前不能析构。
+ **/
+class RedisFuture {
+
+public:
+
+  RedisFuture();
+
+  ~RedisFuture();
+
+  /**
+   * @brief 阻塞等待命令完成
+   * @return int，与RedisClient同步接口的返回值含义一致
+   *  0：命令执行成功
+   *  1：该key不存在（get/hget）
+   *  -1：命令执行失败（连接断开、超时等）
+   **/
+  int wait();
+
+  /**
+   * @brief 命令是否已经完成
+   **/
+  bool ready();
+
+  /**
+   * @brief 重置状态，以便复用该对象提交下一个命令
+   **/
+  void reset();
+
+  //get/hget的结果
+  std::string value;
+  //mget的结果，key不存在or读取失败的value设置为""
+  std::vector<std::string> values;
+  //del/hset等整数类型的结果
+  long long integer;
+
+private:
+
+  friend class RedisAsyncClient;
+
+  void _done(int ret);
+
+  pthread_mutex_t _mutex;
+  pthread_cond_t _cond;
+  bool _ready;
+  int _ret;
+
+  //不允许拷贝和赋值操作
+  RedisFuture(const RedisFuture &other);
+  RedisFuture& operator= (const RedisFuture &other);
+};
+
+/**
+ * RedisAsyncClient
+ * 基于redisAsyncContext的非集群异步客户端，一个epoll事件循环线程驱动一条连接，
+ * 所有线程提交的命令在这条连接上pipeline发送，不再每条命令等待一个RTT。
+ * @note 线程安全，命令在调用线程中编码，由事件循环线程写入连接
+ **/
+class RedisAsyncClient {
+
+public:
+
+  RedisAsyncClient();
+
+  virtual ~RedisAsyncClient();
+
+  /**
+   * @brief 初始化方法，启动事件循环线程并建立与server的连接
+   * @param [in]  server_info，字符串格式 ip:port:db or ip:port（此时默认db为0）
+   * @param [in]  password
+   * @param [in]  timeout，命令的超时时间（单位ms）：<=0，无超时判断；
+   *              最早发出的命令超时后断开连接，所有未完成的命令以失败结束
+   * @return bool
+   **/
+  bool init(const std::string &server_info, const std::string &password = "", long timeout = 0);
+
+  /**
+   * @brief 提交任意命令
+   * @param [in]  argc/argv/argv_len，与redisCommandArgv一致，调用返回后即可释放
+   * @param [in]  callback，可以为NULL
+   * @param [in]  privdata
+   * @return int
+   *  0：提交成功，callback一定会被调用一次
+   *  -1：客户端未初始化或已经停止
+   *  -2：输入的参数问题
+   **/
+  int command_argv(int argc, const char **argv, const size_t *argv_len,
+      RedisAsyncCallback callback, void *privdata);
+
+  /**
+   * @brief 以下接口与RedisNonClusterClient同名接口语义一致，结果写入future
+   * @return int
+   *  0：提交成功
+   *  -1：客户端未初始化或已经停止
+   *  -2：输入的key/value问题
+   **/
+  int set(const std::string &key, const std::string &value, RedisFuture *future);
+
+  int get(const std::string &key, RedisFuture *future);
+
+  int mset(const std::vector<std::string> &keys,
+      const std::vector<std::string> &values, RedisFuture *future);
+
+  int mget(const std::vector<std::string> &keys, RedisFuture *future);
+
+  int hset(const std::string &key, const std::string &h_key,
+      const std::string &h_value, RedisFuture *future);
+
+  int hget(const std::string &key, const std::string &h_key, RedisFuture *future);
+
+  int del(const std::vector<std::string> &keys, RedisFuture *future);
+
+  /**
+   * @brief 停止事件循环线程，未完成的命令以失败结束
+   **/
+  void stop();
+
+private:
+
+  struct Request {
+    char *cmd;
+    int len;
+    RedisAsyncCallback callback;
+    void *privdata;
+    long start;
+  };
+
+  static void* _loop(void *param);
+
+  void _run();
+
+  void _submit_pending();
+
+  void _check_timeout();
+
+  bool _connect();
+
+  void _disconnect();
+
+  int _push(char *cmd, int len, RedisAsyncCallback callback, void *privdata);
+
+  void _update_events();
+
+  static void _fail(Request *req);
+
+  static long _now_ms();
+
+  //hiredis事件适配器
+  static void _add_read(void *privdata);
+  static void _del_read(void *privdata);
+  static void _add_write(void *privdata);
+  static void _del_write(void *privdata);
+  static void _cleanup(void *privdata);
+
+  static void _on_reply(redisAsyncContext *ac, void *reply, void *privdata);
+  static void _on_connect(const redisAsyncContext *ac, int status);
+  static void _on_disconnect(const redisAsyncContext *ac, int status);
+
+  //将reply转换为RedisFuture的结果
+  static void _status_reply(redisReply *reply, void *privdata);
+  static void _string_reply(redisReply *reply, void *privdata);
+  static void _array_reply(redisReply *reply, void *privdata);
+  static void _integer_reply(redisReply *reply, void *privdata);
+
+  //不允许拷贝和赋值操作
+  RedisAsyncClient(const RedisAsyncClient &other);
+  RedisAsyncClient& operator= (const RedisAsyncClient &other);
+
+private:
+
+  std::string _host;
+  int _port;
+  int _db;
+  std::string _password;
+  long _timeout;
+
+  int _epoll_fd;
+  int _wakeup_fd;
+  pthread_t _thread;
+  volatile bool _running;
+
+  //调用线程提交、尚未写入连接的命令
+  Mutex _mutex;
+  std::deque<Request *> _pending;
+
+  //以下只在事件循环线程中访问
+  redisAsyncContext *_redis_context;
+  int _fd;
+  int _events;
+  //已经写入连接、等待回复的命令，redis按序回复
+  std::deque<Request *> _inflight;
+};
+
+#endif
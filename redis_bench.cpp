@@ -0,0 +1,430 @@
+
+/**
+ * redis_bench
+ * RedisNonClusterClient/RedisClusterClient的性能测试程序。
+ * 启动本地redis-server（单机，以及3个节点的集群），按value大小、批量大小、线程数
+ * 测试get/mget/mset/hmset的吞吐和延迟，输出p50/p99/p999以及每个操作的内存分配次数。
+ *
+ * 用法：redis_bench [-s redis-server路径] [-c redis-cli路径] [-p 起始端口]
+ *                   [-m single|cluster|all] [-b 每组测试的数据量（单位MB）]
+ * 编译：g++ -O2 redis_bench.cpp redis_client.cpp redis_slot.cpp redis_reply_arena.cpp
+ *       redis_circuit_breaker.cpp redis_stats.cpp redis_codec.cpp
+ *       redis_script.cpp redis_replica_reader.cpp Logger.cpp -lhiredis_vip -lpthread
+ * @note 内存分配次数通过替换malloc/calloc/realloc统计（依赖glibc的__libc_malloc），
+ *       包括hiredis内部的分配
+ **/
+
+#include "redis_client.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t num, size_t size);
+void* __libc_realloc(void *ptr, size_t size);
+}
+
+//进程内所有线程的内存分配次数
+static volatile unsigned long long g_allocs = 0;
+
+extern "C" void* malloc(size_t size) {
+  __sync_fetch_and_add(&g_allocs, 1);
+  return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t num, size_t size) {
+  __sync_fetch_and_add(&g_allocs, 1);
+  return __libc_calloc(num, size);
+}
+
+extern "C" void* realloc(void *ptr, size_t size) {
+  __sync_fetch_and_add(&g_allocs, 1);
+  return __libc_realloc(ptr, size);
+}
+
+enum BenchOp {
+  OP_GET = 0,
+  OP_MGET,
+  OP_MSET,
+  OP_HMSET
+};
+
+static const char *OP_NAMES[] = {"get", "mget", "mset", "hmset"};
+
+static const int VALUE_SIZES[] = {16, 256, 4096, 65536, 1048576};
+static const int BATCH_SIZES[] = {1, 10, 100, 1000};
+static const int THREAD_NUMS[] = {1, 4, 16};
+
+struct BenchConfig {
+  std::string server_bin;
+  std::string cli_bin;
+  int base_port;
+  std::string mode;
+  //每组测试每个线程读写的数据量上限
+  long long bytes_budget;
+};
+
+struct BenchCase {
+  bool cluster;
+  std::string server_info;
+  BenchOp op;
+  int value_size;
+  int batch_size;
+  int ops;
+  int thread_id;
+  //每个操作的耗时（单位us）
+  std::vector<long> latencies;
+  bool failed;
+};
+
+static long now_us() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000L + t.tv_nsec / 1000;
+}
+
+/**
+ * @brief fork/exec一个子进程，返回pid，失败返回-1
+ **/
+static pid_t spawn(const std::vector<std::string> &args) {
+  pid_t pid = fork();
+  if (pid != 0) {
+    return pid;
+  }
+  std::vector<char *> argv;
+  for (size_t i = 0; i < args.size(); ++i) {
+    argv.push_back(const_cast<char *>(args[i].c_str()));
+  }
+  argv.push_back(NULL);
+  //子进程的输出不影响测试结果
+  freopen("/dev/null", "w", stdout);
+  execvp(argv[0], &argv[0]);
+  _exit(127);
+}
+
+static std::string to_string(long long n) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%lld", n);
+  return buf;
+}
+
+/**
+ * @brief 启动redis-server，数据不落盘，等待可以PING通
+ **/
+static pid_t start_server(const BenchConfig &config, int port, bool cluster) {
+  std::vector<std::string> args;
+  args.push_back(config.server_bin);
+  args.push_back("--port");
+  args.push_back(to_string(port));
+  args.push_back("--save");
+  args.push_back("");
+  args.push_back("--appendonly");
+  args.push_back("no");
+  args.push_back("--dir");
+  args.push_back("/tmp");
+  if (cluster) {
+    args.push_back("--cluster-enabled");
+    args.push_back("yes");
+    args.push_back("--cluster-config-file");
+    args.push_back("redis_bench_nodes_" + to_string(port) + ".conf");
+  }
+  pid_t pid = spawn(args);
+  if (pid < 0) {
+    return -1;
+  }
+
+  for (int i = 0; i < 100; ++i) {
+    RedisNonClusterClient client;
+    if (client.init("127.0.0.1:" + to_string(port)) && client.ping()) {
+      return pid;
+    }
+    usleep(50000);
+  }
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+  return -1;
+}
+
+static void stop_server(pid_t pid) {
+  if (pid > 0) {
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+  }
+}
+
+/**
+ * @brief 用redis-cli把3个节点组成集群，等待cluster_state:ok
+ **/
+static bool create_cluster(const BenchConfig &config, const std::vector<int> &ports) {
+  std::vector<std::string> args;
+  args.push_back(config.cli_bin);
+  args.push_back("--cluster");
+  args.push_back("create");
+  for (size_t i = 0; i < ports.size(); ++i) {
+    args.push_back("127.0.0.1:" + to_string(ports[i]));
+  }
+  args.push_back("--cluster-replicas");
+  args.push_back("0");
+  args.push_back("--cluster-yes");
+  pid_t pid = spawn(args);
+  int status = 0;
+  if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)
+      || WEXITSTATUS(status) != 0) {
+    return false;
+  }
+
+  for (int i = 0; i < 100; ++i) {
+    bool ok = true;
+    for (size_t j = 0; j < ports.size() && ok; ++j) {
+      redisContext *c = redisConnect("127.0.0.1", ports[j]);
+      redisReply *reply = c == NULL || c->err ? NULL
+          : (redisReply *)redisCommand(c, "CLUSTER INFO");
+      ok = reply != NULL && reply->type == REDIS_REPLY_STRING
+          && strstr(reply->str, "cluster_state:ok") != NULL;
+      freeReplyObject(reply);
+      if (c != NULL) {
+        redisFree(c);
+      }
+    }
+    if (ok) {
+      return true;
+    }
+    usleep(100000);
+  }
+  return false;
+}
+
+static std::string make_key(int thread_id, int i) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "bench:%d:%d", thread_id, i);
+  return buf;
+}
+
+/**
+ * @brief 单个线程：建立自己的连接，准备数据（不计时），然后逐个操作计时
+ **/
+static void* run_case(void *param) {
+  BenchCase *c = (BenchCase *)param;
+  c->failed = false;
+  RedisClient *client = NULL;
+  if (c->cluster) {
+    client = new RedisClusterClient();
+  } else {
+    client = new RedisNonClusterClient();
+  }
+  if (!client->init(c->server_info)) {
+    c->failed = true;
+    delete client;
+    return NULL;
+  }
+
+  std::string value(c->value_size, 'v');
+  std::vector<std::string> keys;
+  std::vector<std::string> values(c->batch_size, value);
+  for (int i = 0; i < c->batch_size; ++i) {
+    keys.push_back(make_key(c->thread_id, i));
+  }
+  if ((c->op == OP_GET || c->op == OP_MGET) && client->mset(keys, values) != 0) {
+    c->failed = true;
+  }
+
+  std::string hash_key = make_key(c->thread_id, -1);
+  std::vector<std::string> results;
+  std::string result;
+  results.reserve(c->batch_size);
+  c->latencies.reserve(c->ops);
+  for (int i = 0; i < c->ops && !c->failed; ++i) {
+    long begin = now_us();
+    int ret = 0;
+    switch (c->op) {
+      case OP_GET:
+        ret = client->get(keys[i % keys.size()], result);
+        break;
+      case OP_MGET:
+        results.clear();
+        ret = client->mget(keys, results);
+        break;
+      case OP_MSET:
+        ret = client->mset(keys, values);
+        break;
+      case OP_HMSET:
+        ret = ((RedisNonClusterClient *)client)->hmset(hash_key, keys, values);
+        break;
+    }
+    c->latencies.push_back(now_us() - begin);
+    if (ret < 0) {
+      c->failed = true;
+    }
+  }
+  delete client;
+  return NULL;
+}
+
+static long percentile(const std::vector<long> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t i = (size_t)(p * sorted.size());
+  return sorted[i < sorted.size() ? i : sorted.size() - 1];
+}
+
+/**
+ * @brief 跑一组测试并输出一行结果
+ **/
+static void bench(const BenchConfig &config, bool cluster, const std::string &server_info,
+    BenchOp op, int value_size, int batch_size, int thread_num) {
+  long long bytes = (long long)value_size * batch_size;
+  int ops = (int)(config.bytes_budget / bytes);
+  if (ops < 10) {
+    //单次操作的数据量太大，跳过
+    return;
+  }
+  if (ops > 100000) {
+    ops = 100000;
+  }
+
+  std::vector<BenchCase> cases(thread_num);
+  std::vector<pthread_t> threads(thread_num);
+  for (int t = 0; t < thread_num; ++t) {
+    cases[t].cluster = cluster;
+    cases[t].server_info = server_info;
+    cases[t].op = op;
+    cases[t].value_size = value_size;
+    cases[t].batch_size = batch_size;
+    cases[t].ops = ops;
+    cases[t].thread_id = t;
+  }
+
+  unsigned long long allocs = g_allocs;
+  long begin = now_us();
+  for (int t = 0; t < thread_num; ++t) {
+    pthread_create(&threads[t], NULL, run_case, &cases[t]);
+  }
+  for (int t = 0; t < thread_num; ++t) {
+    pthread_join(threads[t], NULL);
+  }
+  long cost = now_us() - begin;
+  allocs = g_allocs - allocs;
+
+  std::vector<long> latencies;
+  bool failed = false;
+  for (int t = 0; t < thread_num; ++t) {
+    latencies.insert(latencies.end(), cases[t].latencies.begin(), cases[t].latencies.end());
+    failed = failed || cases[t].failed;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  //准备数据和建立连接的分配也计算在内，ops足够多时可以忽略
+  double total_ops = latencies.empty() ? 1 : latencies.size();
+
+  printf("%-8s %-6s %8d %6d %4d %8d %12.0f %8ld %8ld %8ld %10.1f%s\n",
+      cluster ? "cluster" : "single", OP_NAMES[op], value_size, batch_size, thread_num,
+      (int)latencies.size(), latencies.size() * 1000000.0 / (cost > 0 ? cost : 1),
+      percentile(latencies, 0.5), percentile(latencies, 0.99), percentile(latencies, 0.999),
+      allocs / total_ops, failed ? " FAILED" : "");
+  fflush(stdout);
+}
+
+static void bench_all(const BenchConfig &config, bool cluster, const std::string &server_info) {
+  BenchOp ops[] = {OP_GET, OP_MGET, OP_MSET, OP_HMSET};
+  for (size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); ++o) {
+    if (cluster && ops[o] == OP_HMSET) {
+      //RedisClusterClient没有hmset
+      continue;
+    }
+    for (size_t v = 0; v < sizeof(VALUE_SIZES) / sizeof(VALUE_SIZES[0]); ++v) {
+      for (size_t b = 0; b < sizeof(BATCH_SIZES) / sizeof(BATCH_SIZES[0]); ++b) {
+        //get只测单个key，批量操作不测单个key
+        if ((ops[o] == OP_GET) != (BATCH_SIZES[b] == 1)) {
+          continue;
+        }
+        for (size_t t = 0; t < sizeof(THREAD_NUMS) / sizeof(THREAD_NUMS[0]); ++t) {
+          bench(config, cluster, server_info, ops[o], VALUE_SIZES[v],
+              BATCH_SIZES[b], THREAD_NUMS[t]);
+        }
+      }
+    }
+  }
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-s redis-server] [-c redis-cli] [-p base_port]"
+      " [-m single|cluster|all] [-b budget_mb]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+  BenchConfig config;
+  config.server_bin = "redis-server";
+  config.cli_bin = "redis-cli";
+  config.base_port = 17000;
+  config.mode = "all";
+  config.bytes_budget = 64LL * 1024 * 1024;
+
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "s:c:p:m:b:h")) != -1) {
+    switch (opt) {
+      case 's': config.server_bin = optarg; break;
+      case 'c': config.cli_bin = optarg; break;
+      case 'p': config.base_port = atoi(optarg); break;
+      case 'm': config.mode = optarg; break;
+      case 'b': config.bytes_budget = atoll(optarg) * 1024 * 1024; break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  printf("%-8s %-6s %8s %6s %4s %8s %12s %8s %8s %8s %10s\n",
+      "client", "op", "value", "batch", "thr", "ops", "ops/s",
+      "p50(us)", "p99(us)", "p999(us)", "allocs/op");
+
+  int ret = 0;
+  if (config.mode == "single" || config.mode == "all") {
+    pid_t pid = start_server(config, config.base_port, false);
+    if (pid < 0) {
+      fprintf(stderr, "start %s on port %d failed\n",
+          config.server_bin.c_str(), config.base_port);
+      ret = 1;
+    } else {
+      bench_all(config, false, "127.0.0.1:" + to_string(config.base_port));
+      stop_server(pid);
+    }
+  }
+
+  if (config.mode == "cluster" || config.mode == "all") {
+    std::vector<int> ports;
+    std::vector<pid_t> pids;
+    std::string server_info;
+    bool ok = true;
+    for (int i = 1; i <= 3; ++i) {
+      int port = config.base_port + i;
+      //旧的集群配置文件会导致节点无法组成新集群
+      unlink(("/tmp/redis_bench_nodes_" + to_string(port) + ".conf").c_str());
+      pid_t pid = start_server(config, port, true);
+      ok = ok && pid > 0;
+      if (pid > 0) {
+        pids.push_back(pid);
+      }
+      ports.push_back(port);
+      server_info += (i > 1 ? "," : "") + std::string("127.0.0.1:") + to_string(port);
+    }
+    if (ok && create_cluster(config, ports)) {
+      bench_all(config, true, server_info);
+    } else {
+      fprintf(stderr, "create local redis cluster failed\n");
+      ret = 1;
+    }
+    for (size_t i = 0; i < pids.size(); ++i) {
+      stop_server(pids[i]);
+    }
+  }
+  return ret;
+}
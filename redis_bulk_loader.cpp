@@ -0,0 +1,450 @@
+
+#include "Logger.h"
+#include "redis_bulk_loader.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+
+//每条连接最多打印的错误reply数，避免日志刷屏
+static const int MAX_LOGGED_ERRORS = 10;
+
+RedisBulkLoader::RedisBulkLoader(int connections, size_t buffer_size, long max_inflight)
+  : _connections(connections > 0 ? connections : 1),
+    _buffer_size(buffer_size > 0 ? buffer_size : 1),
+    _max_inflight(max_inflight > 0 ? max_inflight : 1),
+    _port(0), _db(0), _timeout(0), _format(REDIS_BULK_TSV),
+    _records(0), _errors(0), _bytes(0) {
+}
+
+bool RedisBulkLoader::init(const std::string &server_info, const std::string &password,
+    long timeout) {
+  _password = password;
+  _timeout = timeout;
+
+  //ip:port:db 或者 ip:port
+  size_t idx1 = server_info.find(':');
+  if (idx1 == std::string::npos) {
+    return false;
+  }
+  _host = server_info.substr(0, idx1);
+  _port = atoi(server_info.c_str() + idx1 + 1);
+  size_t idx2 = server_info.find(':', idx1 + 1);
+  _db = idx2 == std::string::npos ? 0 : atoi(server_info.c_str() + idx2 + 1);
+
+  redisContext *context = _connect();
+  if (context == NULL) {
+    return false;
+  }
+  redisFree(context);
+  return true;
+}
+
+redisContext* RedisBulkLoader::_connect() {
+  redisContext *context = NULL;
+  if (_timeout > 0) {
+    struct timeval tv;
+    tv.tv_sec = _timeout / 1000;
+    tv.tv_usec = (_timeout % 1000) * 1000;
+    context = redisConnectWithTimeout(_host.c_str(), _port, tv);
+  } else {
+    context = redisConnect(_host.c_str(), _port);
+  }
+  if (context == NULL || context->err) {
+    LOG_ERROR(debug_log, "redis bulk loader: connect %s:%d failed", _host.c_str(), _port);
+    if (context != NULL) {
+      redisFree(context);
+    }
+    return NULL;
+  }
+
+  redisReply *reply = NULL;
+  if (!_password.empty()) {
+    //需要密码验证
+    reply = (redisReply *)redisCommand(context, "AUTH %s", _password.c_str());
+    bool bval = reply != NULL && reply->type == REDIS_REPLY_STATUS && strcmp(reply->str, "OK") == 0;
+    freeReplyObject(reply);
+    if (!bval) {
+      redisFree(context);
+      return NULL;
+    }
+  }
+  if (_db != 0) {
+    //切换到指定db
+    reply = (redisReply *)redisCommand(context, "SELECT %d", _db);
+    bool bval = reply != NULL && reply->type == REDIS_REPLY_STATUS && strcmp(reply->str, "OK") == 0;
+    freeReplyObject(reply);
+    if (!bval) {
+      redisFree(context);
+      return NULL;
+    }
+  }
+  return context;
+}
+
+int RedisBulkLoader::load_file(const std::string &path, RedisBulkFormat format, long ttl) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG_ERROR(debug_log, "redis bulk loader: open %s failed, errno=%d", path.c_str(), errno);
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return load(NULL, 0, format, ttl);
+  }
+
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    LOG_ERROR(debug_log, "redis bulk loader: mmap %s failed, errno=%d", path.c_str(), errno);
+    return -1;
+  }
+  //顺序读取，提示内核预读
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+  int ret = load((const char *)data, st.st_size, format, ttl);
+  munmap(data, st.st_size);
+  return ret;
+}
+
+int RedisBulkLoader::load(const char *data, size_t len, RedisBulkFormat format, long ttl) {
+  _records = 0;
+  _errors = 0;
+  _bytes = 0;
+  _format = format;
+  _ttl.clear();
+  if (ttl > 0) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%ld", ttl);
+    _ttl = buf;
+  }
+  if (len == 0) {
+    return 0;
+  }
+
+  std::vector<const char *> bounds;
+  _split(data, len, format, bounds);
+
+  std::vector<Connection *> conns;
+  int ret = 0;
+  for (size_t i = 0; i + 1 < bounds.size(); ++i) {
+    if (bounds[i] == bounds[i + 1]) {
+      continue;
+    }
+    redisContext *context = _connect();
+    if (context == NULL) {
+      ret = -1;
+      break;
+    }
+    Connection *conn = new Connection;
+    conn->loader = this;
+    conn->context = context;
+    conn->begin = bounds[i];
+    conn->end = bounds[i + 1];
+    conn->sent = 0;
+    conn->received = 0;
+    conn->reply_errors = 0;
+    conn->bad_records = 0;
+    conn->bytes = 0;
+    conn->writer_done = false;
+    conn->failed = false;
+    pthread_mutex_init(&conn->mutex, NULL);
+    pthread_cond_init(&conn->cond, NULL);
+    conns.push_back(conn);
+  }
+
+  if (ret == 0) {
+    for (size_t i = 0; i < conns.size(); ++i) {
+      pthread_create(&conns[i]->reader, NULL, RedisBulkLoader::_read, conns[i]);
+      pthread_create(&conns[i]->writer, NULL, RedisBulkLoader::_write, conns[i]);
+    }
+    for (size_t i = 0; i < conns.size(); ++i) {
+      pthread_join(conns[i]->writer, NULL);
+      pthread_join(conns[i]->reader, NULL);
+    }
+  }
+
+  for (size_t i = 0; i < conns.size(); ++i) {
+    Connection *conn = conns[i];
+    if (conn->failed) {
+      ret = -1;
+    }
+    //格式错误的记录没有发出，不在received中
+    _records += conn->received - conn->reply_errors;
+    _errors += conn->reply_errors + conn->bad_records;
+    _bytes += conn->bytes;
+    redisFree(conn->context);
+    pthread_mutex_destroy(&conn->mutex);
+    pthread_cond_destroy(&conn->cond);
+    delete conn;
+  }
+  if (ret == 0 && _errors > 0) {
+    ret = -3;
+  }
+  return ret;
+}
+
+const char* RedisBulkLoader::_next_record(const char *p, const char *end, RedisBulkFormat format,
+    const char *&key, size_t &key_len, const char *&value, size_t &value_len) {
+  key = NULL;
+  if (format == REDIS_BULK_BINARY) {
+    uint32_t len = 0;
+    if (end - p < 4) {
+      return end;
+    }
+    memcpy(&len, p, 4);
+    if ((size_t)(end - p - 4) < len) {
+      return end;
+    }
+    const char *k = p + 4;
+    size_t k_len = len;
+    p = k + k_len;
+    if (end - p < 4) {
+      return end;
+    }
+    memcpy(&len, p, 4);
+    if ((size_t)(end - p - 4) < len) {
+      return end;
+    }
+    key = k;
+    key_len = k_len;
+    value = p + 4;
+    value_len = len;
+    return value + value_len;
+  }
+
+  const char *nl = (const char *)memchr(p, '\n', end - p);
+  const char *line_end = nl == NULL ? end : nl;
+  const char *next = nl == NULL ? end : nl + 1;
+  if (line_end > p && line_end[-1] == '\r') {
+    --line_end;
+  }
+  const char *tab = (const char *)memchr(p, '\t', line_end - p);
+  if (tab == NULL || tab == p) {
+    //空行或者格式错误，空行不算错误
+    key_len = line_end - p;
+    return next;
+  }
+  key = p;
+  key_len = tab - p;
+  value = tab + 1;
+  value_len = line_end - value;
+  return next;
+}
+
+void RedisBulkLoader::_split(const char *data, size_t len, RedisBulkFormat format,
+    std::vector<const char *> &bounds) {
+  const char *end = data + len;
+  bounds.clear();
+  bounds.push_back(data);
+  if (format == REDIS_BULK_TSV) {
+    //切分点移到下一行的开头
+    for (int i = 1; i < _connections; ++i) {
+      const char *p = data + len / _connections * i;
+      if (p < bounds.back()) {
+        p = bounds.back();
+      }
+      const char *nl = (const char *)memchr(p, '\n', end - p);
+      bounds.push_back(nl == NULL ? end : nl + 1);
+    }
+  } else {
+    //二进制记录只能从头顺序定位，只跳过长度不拷贝数据
+    size_t target = len / _connections;
+    const char *p = data;
+    const char *key = NULL;
+    const char *value = NULL;
+    size_t key_len = 0;
+    size_t value_len = 0;
+    while (p < end && (int)bounds.size() < _connections) {
+      p = _next_record(p, end, format, key, key_len, value, value_len);
+      if ((size_t)(p - bounds.back()) >= target) {
+        bounds.push_back(p);
+      }
+    }
+  }
+  bounds.push_back(end);
+}
+
+void RedisBulkLoader::_encode(std::string &buf, const char *key, size_t key_len,
+    const char *value, size_t value_len) {
+  //*3\r\n$3\r\nSET\r\n$<key_len>\r\n<key>\r\n$<value_len>\r\n<value>\r\n [$2\r\nEX\r\n$<n>\r\n<ttl>\r\n]
+  char head[32];
+  if (_ttl.empty()) {
+    buf.append("*3\r\n$3\r\nSET\r\n", 13);
+  } else {
+    buf.append("*5\r\n$3\r\nSET\r\n", 13);
+  }
+  int n = snprintf(head, sizeof(head), "$%lu\r\n", (unsigned long)key_len);
+  buf.append(head, n);
+  buf.append(key, key_len);
+  buf.append("\r\n", 2);
+  n = snprintf(head, sizeof(head), "$%lu\r\n", (unsigned long)value_len);
+  buf.append(head, n);
+  buf.append(value, value_len);
+  buf.append("\r\n", 2);
+  if (!_ttl.empty()) {
+    n = snprintf(head, sizeof(head), "$2\r\nEX\r\n$%lu\r\n", (unsigned long)_ttl.size());
+    buf.append(head, n);
+    buf.append(_ttl);
+    buf.append("\r\n", 2);
+  }
+}
+
+bool RedisBulkLoader::_flush(Connection *conn, std::string &buf, long long commands) {
+  if (buf.empty()) {
+    return true;
+  }
+
+  //未收到reply的命令太多时等待，至少允许一个缓冲区在途
+  pthread_mutex_lock(&conn->mutex);
+  while (!conn->failed && conn->sent > conn->received
+      && conn->sent - conn->received + commands > _max_inflight) {
+    pthread_cond_wait(&conn->cond, &conn->mutex);
+  }
+  bool failed = conn->failed;
+  conn->sent += commands;
+  pthread_mutex_unlock(&conn->mutex);
+  if (failed) {
+    return false;
+  }
+
+  const char *p = buf.data();
+  size_t left = buf.size();
+  while (left > 0) {
+    ssize_t n = write(conn->context->fd, p, left);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+      continue;
+    }
+    if (n <= 0) {
+      LOG_ERROR(debug_log, "redis bulk loader: write failed, errno=%d", errno);
+      pthread_mutex_lock(&conn->mutex);
+      conn->failed = true;
+      pthread_cond_broadcast(&conn->cond);
+      pthread_mutex_unlock(&conn->mutex);
+      return false;
+    }
+    p += n;
+    left -= n;
+  }
+  conn->bytes += buf.size();
+  buf.clear();
+  return true;
+}
+
+void* RedisBulkLoader::_write(void *param) {
+  Connection *conn = (Connection *)param;
+  RedisBulkLoader *loader = conn->loader;
+
+  std::string buf;
+  buf.reserve(loader->_buffer_size + 1024);
+  long long commands = 0;
+  long long bad_records = 0;
+  const char *key = NULL;
+  const char *value = NULL;
+  size_t key_len = 0;
+  size_t value_len = 0;
+  const char *p = conn->begin;
+  while (p < conn->end) {
+    p = loader->_next_record(p, conn->end, loader->_format, key, key_len, value, value_len);
+    if (key == NULL) {
+      if (key_len > 0 || loader->_format == REDIS_BULK_BINARY) {
+        ++bad_records;
+      }
+      continue;
+    }
+    loader->_encode(buf, key, key_len, value, value_len);
+    ++commands;
+    if (buf.size() >= loader->_buffer_size) {
+      if (!loader->_flush(conn, buf, commands)) {
+        break;
+      }
+      commands = 0;
+    }
+  }
+  loader->_flush(conn, buf, commands);
+  if (bad_records > 0) {
+    LOG_ERROR(debug_log, "redis bulk loader: %lld bad records skipped", bad_records);
+  }
+
+  pthread_mutex_lock(&conn->mutex);
+  conn->bad_records += bad_records;
+  conn->writer_done = true;
+  pthread_cond_broadcast(&conn->cond);
+  pthread_mutex_unlock(&conn->mutex);
+  return NULL;
+}
+
+void* RedisBulkLoader::_read(void *param) {
+  Connection *conn = (Connection *)param;
+  redisReader *reader = redisReaderCreate();
+  char buf[64 * 1024];
+  int logged = 0;
+
+  for (;;) {
+    pthread_mutex_lock(&conn->mutex);
+    bool done = conn->failed || (conn->writer_done && conn->received == conn->sent);
+    pthread_mutex_unlock(&conn->mutex);
+    if (done) {
+      break;
+    }
+
+    //写线程可能还没有发出命令，超时后重新检查
+    struct pollfd pfd;
+    pfd.fd = conn->context->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 100) <= 0) {
+      continue;
+    }
+    ssize_t n = read(conn->context->fd, buf, sizeof(buf));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+      continue;
+    }
+    bool failed = n <= 0 || redisReaderFeed(reader, buf, n) != REDIS_OK;
+
+    long long replies = 0;
+    long long errors = 0;
+    void *reply = NULL;
+    while (!failed) {
+      if (redisReaderGetReply(reader, &reply) != REDIS_OK) {
+        failed = true;
+        break;
+      }
+      if (reply == NULL) {
+        break;
+      }
+      redisReply *r = (redisReply *)reply;
+      if (r->type == REDIS_REPLY_ERROR) {
+        ++errors;
+        if (logged++ < MAX_LOGGED_ERRORS) {
+          LOG_ERROR(debug_log, "redis bulk loader: %s", r->str);
+        }
+      }
+      ++replies;
+      freeReplyObject(reply);
+    }
+
+    pthread_mutex_lock(&conn->mutex);
+    conn->received += replies;
+    conn->reply_errors += errors;
+    if (failed) {
+      LOG_ERROR(debug_log, "redis bulk loader: read reply failed, errno=%d", errno);
+      conn->failed = true;
+    }
+    pthread_cond_broadcast(&conn->cond);
+    pthread_mutex_unlock(&conn->mutex);
+  }
+
+  redisReaderFree(reader);
+  return NULL;
+}
@@ -0,0 +1,152 @@
+
+#ifndef AFANTI_REDIS_BULK_LOADER_H_
+#define AFANTI_REDIS_BULK_LOADER_H_
+
+#include <hiredis.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+enum RedisBulkFormat {
+  //每行一条记录：key\tvalue\n，key和value中不能包含\t和\n
+  REDIS_BULK_TSV = 0,
+  //每条记录：4字节key长度（小端）、key、4字节value长度（小端）、value
+  REDIS_BULK_BINARY = 1
+};
+
+/**
+ * RedisBulkLoader
+ * 批量导入数据，效果与redis-cli --pipe相同：
+ * 输入文件mmap到内存，记录直接编码为RESP格式的SET命令写入大缓冲区，
+ * 不构造key/value的string；数据按记录边界分给多条连接，
+ * 每条连接一个写线程和一个读线程，写线程不等待reply，读线程异步统计reply，
+ * 未收到reply的命令数超过上限时写线程等待。
+ * @note 线程不安全；只支持非集群（ip:port:db），导入期间不保证命令之间的顺序
+ **/
+class RedisBulkLoader {
+
+public:
+
+  /**
+   * @param [in]  connections，连接数
+   * @param [in]  buffer_size，每条连接每次写出的字节数
+   * @param [in]  max_inflight，每条连接已经发出但是没有收到reply的命令数上限
+   **/
+  RedisBulkLoader(int connections = 4, size_t buffer_size = 4 * 1024 * 1024,
+      long max_inflight = 100000);
+
+  ~RedisBulkLoader() {}
+
+  /**
+   * @brief 初始化方法，参数与RedisNonClusterClient::init一致，检查是否可以连接
+   * @return bool
+   **/
+  bool init(const std::string &server_info, const std::string &password = "", long timeout = 0);
+
+  /**
+   * @brief 导入文件
+   * @param [in]  path
+   * @param [in]  format
+   * @param [in]  ttl，过期时间（单位s）：<=0，不过期
+   * @return int
+   *  0：全部导入成功
+   *  -1：打开文件失败或者与redis-server的连接失败，已经发出的命令可能已经执行
+   *  -3：个别记录导入失败（格式错误或者redis-server返回错误），见errors()
+   **/
+  int load_file(const std::string &path, RedisBulkFormat format, long ttl = 0);
+
+  /**
+   * @brief 导入内存中的数据，格式和返回值与load_file一致
+   **/
+  int load(const char *data, size_t len, RedisBulkFormat format, long ttl = 0);
+
+  /**
+   * @brief 上一次导入的统计：成功写入的记录数、失败的记录数、写出的字节数
+   **/
+  long long records() {
+    return _records;
+  }
+
+  long long errors() {
+    return _errors;
+  }
+
+  long long bytes() {
+    return _bytes;
+  }
+
+private:
+
+  struct Connection {
+    RedisBulkLoader *loader;
+    redisContext *context;
+    //该连接负责的记录范围
+    const char *begin;
+    const char *end;
+
+    pthread_t writer;
+    pthread_t reader;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    //已经发出的命令数，已经收到的reply数
+    long long sent;
+    long long received;
+    //redis-server返回错误的reply数
+    long long reply_errors;
+    //格式错误、没有发出的记录数
+    long long bad_records;
+    long long bytes;
+    bool writer_done;
+    bool failed;
+  };
+
+  redisContext* _connect();
+
+  /**
+   * @brief 解析下一条记录
+   * @return const char*，下一条记录的起始位置，格式错误时key为NULL
+   **/
+  const char* _next_record(const char *p, const char *end, RedisBulkFormat format,
+      const char *&key, size_t &key_len, const char *&value, size_t &value_len);
+
+  /**
+   * @brief 把数据按记录边界切分为_connections份
+   **/
+  void _split(const char *data, size_t len, RedisBulkFormat format,
+      std::vector<const char *> &bounds);
+
+  void _encode(std::string &buf, const char *key, size_t key_len,
+      const char *value, size_t value_len);
+
+  bool _flush(Connection *conn, std::string &buf, long long commands);
+
+  static void* _write(void *param);
+
+  static void* _read(void *param);
+
+  //不允许拷贝和赋值操作
+  RedisBulkLoader(const RedisBulkLoader &other);
+  RedisBulkLoader& operator= (const RedisBulkLoader &other);
+
+private:
+
+  int _connections;
+  size_t _buffer_size;
+  long _max_inflight;
+
+  std::string _host;
+  int _port;
+  int _db;
+  std::string _password;
+  long _timeout;
+
+  //本次导入的参数
+  RedisBulkFormat _format;
+  std::string _ttl;
+
+  long long _records;
+  long long _errors;
+  long long _bytes;
+};
+
+#endif
@@ -0,0 +1,128 @@
+
+#include "Logger.h"
+#include "redis_circuit_breaker.h"
+#include "redis_client.h"
+#include <sys/time.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <errno.h>
+
+RedisCircuitBreaker::RedisCircuitBreaker(int failure_threshold, long min_backoff, long max_backoff)
+  : _failure_threshold(failure_threshold > 0 ? failure_threshold : 1),
+    _min_backoff(min_backoff > 0 ? min_backoff : 1),
+    _max_backoff(max_backoff > min_backoff ? max_backoff : min_backoff),
+    _cluster(false), _timeout(0), _failures(0), _open(false), _running(false) {
+  pthread_mutex_init(&_mutex, NULL);
+  pthread_cond_init(&_cond, NULL);
+}
+
+RedisCircuitBreaker::~RedisCircuitBreaker() {
+  if (_running) {
+    pthread_mutex_lock(&_mutex);
+    _running = false;
+    pthread_cond_signal(&_cond);
+    pthread_mutex_unlock(&_mutex);
+    pthread_join(_thread, NULL);
+  }
+  pthread_mutex_destroy(&_mutex);
+  pthread_cond_destroy(&_cond);
+}
+
+bool RedisCircuitBreaker::init(bool cluster, const std::string &server_info,
+    const std::string &password, long timeout) {
+  _cluster = cluster;
+  _server_info = server_info;
+  _password = password;
+  _timeout = timeout;
+
+  if (_running) {
+    return true;
+  }
+  _running = true;
+  if (pthread_create(&_thread, NULL, RedisCircuitBreaker::_probe, this) != 0) {
+    _running = false;
+    return false;
+  }
+  return true;
+}
+
+void RedisCircuitBreaker::failed() {
+  if (__sync_add_and_fetch(&_failures, 1) < _failure_threshold || _open) {
+    return;
+  }
+  pthread_mutex_lock(&_mutex);
+  if (!_running) {
+    //没有探测线程时熔断后无法恢复，只计数不熔断
+    pthread_mutex_unlock(&_mutex);
+    return;
+  }
+  if (!_open) {
+    LOG_ERROR(debug_log, "redis circuit breaker: %s open after %d failures",
+        _server_info.c_str(), (int)_failures);
+    _open = true;
+    pthread_cond_signal(&_cond);
+  }
+  pthread_mutex_unlock(&_mutex);
+}
+
+void* RedisCircuitBreaker::_probe(void *param) {
+  RedisCircuitBreaker *breaker = (RedisCircuitBreaker *)param;
+  breaker->_run();
+  return NULL;
+}
+
+void RedisCircuitBreaker::_run() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  unsigned int seed = now.tv_sec ^ now.tv_usec;
+  long backoff = _min_backoff;
+
+  pthread_mutex_lock(&_mutex);
+  while (_running) {
+    if (!_open) {
+      backoff = _min_backoff;
+      pthread_cond_wait(&_cond, &_mutex);
+      continue;
+    }
+
+    //在[backoff/2, backoff]之间随机等待，避免多个进程同时探测
+    long wait = backoff / 2 + rand_r(&seed) % (backoff / 2 + 1);
+    gettimeofday(&now, NULL);
+    long nsec = now.tv_usec * 1000 + (wait % 1000) * 1000000;
+    struct timespec deadline;
+    deadline.tv_sec = now.tv_sec + wait / 1000 + nsec / 1000000000;
+    deadline.tv_nsec = nsec % 1000000000;
+    int ret = 0;
+    while (_running && ret != ETIMEDOUT) {
+      ret = pthread_cond_timedwait(&_cond, &_mutex, &deadline);
+    }
+    if (!_running) {
+      break;
+    }
+    pthread_mutex_unlock(&_mutex);
+
+    bool ok = _try_connect();
+
+    pthread_mutex_lock(&_mutex);
+    if (ok) {
+      LOG_ERROR(debug_log, "redis circuit breaker: %s recovered, close", _server_info.c_str());
+      _failures = 0;
+      _open = false;
+    } else {
+      backoff = backoff * 2 < _max_backoff ? backoff * 2 : _max_backoff;
+    }
+  }
+  pthread_mutex_unlock(&_mutex);
+}
+
+bool RedisCircuitBreaker::_try_connect() {
+  RedisClient *client = NULL;
+  if (_cluster) {
+    client = new RedisClusterClient();
+  } else {
+    client = new RedisNonClusterClient();
+  }
+  bool ok = client->init(_server_info, _password, _timeout) && client->ping();
+  delete client;
+  return ok;
+}
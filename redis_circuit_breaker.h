@@ -0,0 +1,90 @@
+
+#ifndef AFANTI_REDIS_CIRCUIT_BREAKER_H_
+#define AFANTI_REDIS_CIRCUIT_BREAKER_H_
+
+#include <pthread.h>
+#include <string>
+
+/**
+ * RedisCircuitBreaker
+ * 同一个redis-server（或集群）的所有RedisClient共享一个熔断器。
+ * 连续失败次数达到阈值后熔断，熔断期间所有请求直接失败，不再在请求线程中重连；
+ * 后台线程按指数退避（带随机抖动）探测server，探测成功后恢复，
+ * 各client在下一次请求时重新建立连接。
+ * @note 线程安全
+ **/
+class RedisCircuitBreaker {
+
+public:
+
+  /**
+   * @param [in]  failure_threshold，连续失败多少次后熔断
+   * @param [in]  min_backoff，第一次探测前的等待时间（单位ms）
+   * @param [in]  max_backoff，探测间隔的上限（单位ms）
+   **/
+  RedisCircuitBreaker(int failure_threshold = 5, long min_backoff = 100, long max_backoff = 10000);
+
+  ~RedisCircuitBreaker();
+
+  /**
+   * @brief 初始化方法，参数与RedisClient::init一致，用于后台探测，启动探测线程
+   * @param [in]  cluster，true：按RedisClusterClient探测
+   * @return bool
+   **/
+  bool init(bool cluster, const std::string &server_info,
+      const std::string &password = "", long timeout = 0);
+
+  /**
+   * @brief 是否允许发出请求，熔断期间返回false
+   **/
+  bool allow() {
+    return !_open;
+  }
+
+  /**
+   * @brief 重连成功
+   **/
+  void succeed() {
+    if (_failures != 0) {
+      _failures = 0;
+    }
+  }
+
+  /**
+   * @brief 重连失败，连续失败达到阈值后熔断；init没有调用或者探测线程没有启动时不熔断
+   **/
+  void failed();
+
+private:
+
+  static void* _probe(void *param);
+
+  void _run();
+
+  bool _try_connect();
+
+  //不允许拷贝和赋值操作
+  RedisCircuitBreaker(const RedisCircuitBreaker &other);
+  RedisCircuitBreaker& operator= (const RedisCircuitBreaker &other);
+
+private:
+
+  int _failure_threshold;
+  long _min_backoff;
+  long _max_backoff;
+
+  bool _cluster;
+  std::string _server_info;
+  std::string _password;
+  long _timeout;
+
+  volatile int _failures;
+  volatile bool _open;
+
+  pthread_mutex_t _mutex;
+  pthread_cond_t _cond;
+  pthread_t _thread;
+  volatile bool _running;
+};
+
+#endif
@@ -1,15 +1,157 @@
 #include "Logger.h"
 #include "redis_client.h"
+#include "redis_slot.h"
+#include "redis_stats.h"
+#include <algorithm>
+#include <set>
 #include <iostream>
 #include <cstdlib>
+#include <cstdio>
 
 const int MAX_TRY_TIMES = 3;
 
+/**
+ * @brief 从下标begin开始所有元素的字节数之和，用于统计
+ **/
+static size_t total_size(const std::vector<std::string> &items, size_t begin = 0) {
+  size_t size = 0;
+  for (size_t i = begin; i < items.size(); ++i) {
+    size += items[i].size();
+  }
+  return size;
+}
+
+/**
+ * @brief 把数组类型reply的n个元素按顺序填充到values，不是字符串的元素设置为""
+ * @param [out] bytes，累加填充的字节数
+ * @return bool，reply不是n个元素的数组时返回false，此时values全部设置为""
+ **/
+static bool assign_array(redisReply *reply, std::string *values, size_t n, size_t &bytes) {
+  if (reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements != n) {
+    for (size_t i = 0; i < n; ++i) {
+      values[i].clear();
+    }
+    return false;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    redisReply *one_reply = reply->element[i];
+    if (one_reply->type == REDIS_REPLY_STRING) {
+      values[i].assign(one_reply->str, one_reply->len);
+      bytes += one_reply->len;
+    } else {
+      values[i].clear();
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief 构造EVALSHA/EVAL的参数：cmd body numkeys key... arg...
+ * @param [in]  body，EVALSHA为sha，EVAL为脚本源码
+ * @param [out] numkeys，keys个数的字符串，需要在argv使用期间有效
+ **/
+static void build_eval_argv(const char *cmd, const std::string &body,
+    const std::vector<std::string> &keys, const std::vector<std::string> &args,
+    char *numkeys, size_t numkeys_size,
+    std::vector<const char *> &argv, std::vector<size_t> &argv_len) {
+  snprintf(numkeys, numkeys_size, "%d", (int)keys.size());
+  argv.clear();
+  argv_len.clear();
+  argv.push_back(cmd);
+  argv_len.push_back(strlen(cmd));
+  argv.push_back(body.c_str());
+  argv_len.push_back(body.length());
+  argv.push_back(numkeys);
+  argv_len.push_back(strlen(numkeys));
+  for (size_t i = 0; i < keys.size(); ++i) {
+    argv.push_back(keys[i].c_str());
+    argv_len.push_back(keys[i].length());
+  }
+  for (size_t i = 0; i < args.size(); ++i) {
+    argv.push_back(args[i].c_str());
+    argv_len.push_back(args[i].length());
+  }
+}
+
+/**
+ * @brief 脚本不在server的缓存中
+ **/
+static bool is_noscript(redisReply *reply) {
+  return reply != NULL && reply->type == REDIS_REPLY_ERROR
+      && strncmp(reply->str, "NOSCRIPT", 8) == 0;
+}
+
+/**
+ * @brief 把HGETALL的reply拆分为fields和values
+ * @return bool，reply不是数组时返回false
+ **/
+static bool assign_pairs(redisReply *reply, std::vector<std::string> &fields,
+    std::vector<std::string> &values, size_t &bytes) {
+  if (reply == NULL || reply->type != REDIS_REPLY_ARRAY) {
+    return false;
+  }
+  size_t n = reply->elements / 2;
+  fields.resize(n);
+  values.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    redisReply *field = reply->element[2 * i];
+    redisReply *value = reply->element[2 * i + 1];
+    fields[i].assign(field->str, field->len);
+    values[i].assign(value->str, value->len);
+    bytes += field->len + value->len;
+  }
+  return true;
+}
+
+const std::vector<std::string>& RedisClient::_encode(const std::vector<std::string> &values,
+    std::vector<std::string> &buf) {
+  if (_codec == NULL) {
+    return values;
+  }
+  buf.resize(values.size());
+  for (size_t i = 0; i < values.size(); ++i) {
+    _codec->encode(values[i], buf[i]);
+  }
+  return buf;
+}
+
+bool RedisClient::_decode(const char *data, size_t len, std::vector<unsigned char> &vec) {
+  if (_codec == NULL) {
+    vec.assign(data, data + len);
+    return true;
+  }
+  std::string value;
+  if (!_codec->decode(data, len, value)) {
+    vec.clear();
+    return false;
+  }
+  vec.assign(value.begin(), value.end());
+  return true;
+}
+
+int RedisClient::_decode(std::vector<std::string> &values, size_t begin) {
+  if (_codec == NULL) {
+    return 0;
+  }
+  int failed = 0;
+  for (size_t i = begin; i < values.size(); ++i) {
+    if (!_codec->decode(values[i])) {
+      values[i].clear();
+      ++failed;
+    }
+  }
+  return failed;
+}
+
 int RedisClient::set(const std::string &key, const std::string &value) {
   if (key.empty() || value.empty()) {
     return -2;
   }
-  redisReply *reply = (redisReply *)_real_set_one(key, value);
+  RedisStatsScope stats(REDIS_CMD_SET);
+  std::string buf;
+  const std::string &data = _encode(value, buf);
+  stats.add_bytes_out(key.size() + data.size());
+  redisReply *reply = (redisReply *)_real_set_one(key, data);
 
   //判断执行是否成功
   int ret = -1;
@@ -17,27 +159,88 @@ int RedisClient::set(const std::string &key, const std::string &value) {
     ret = 0;
   }
   freeReplyObject(reply);
-  return ret;
+  return stats.done(ret);
 }
 
 int RedisClient::get(const std::string &key, std::string &value) {
   if (key.empty()) {
     return -2;
   }
+  RedisStatsScope stats(REDIS_CMD_GET);
+  stats.add_bytes_out(key.size());
 
   redisReply *reply = (redisReply *)_real_get_one(key);
   //判断执行是否成功
   int ret = -1;
+  if (reply == NULL) {
+    return stats.done(ret);
+  }
   if (reply->type == REDIS_REPLY_NIL) {
     //该key不存在
     ret = 1;
   } else if (reply->type == REDIS_REPLY_STRING) {
     //返回结果
     value.assign(reply->str, reply->len);
-    ret = 0;
+    stats.add_bytes_in(reply->len);
+    ret = _decode(value) ? 0 : -1;
   }
   freeReplyObject(reply);
-  return ret;
+  return stats.done(ret);
+}
+
+int RedisClient::get(const std::string &key, RedisReplyHandle &handle) {
+  handle.reset();
+  if (key.empty()) {
+    return -2;
+  }
+  RedisStatsScope stats(REDIS_CMD_GET);
+  stats.add_bytes_out(key.size());
+
+  redisReply *reply = (redisReply *)_real_get_one(key);
+  //判断执行是否成功
+  int ret = -1;
+  if (reply == NULL) {
+    return stats.done(ret);
+  }
+  if (reply->type == REDIS_REPLY_NIL) {
+    //该key不存在
+    ret = 1;
+  } else if (reply->type == REDIS_REPLY_STRING) {
+    //reply交给handle持有，不拷贝
+    stats.add_bytes_in(reply->len);
+    handle.reset(reply);
+    return stats.done(0);
+  }
+  freeReplyObject(reply);
+  return stats.done(ret);
+}
+
+int RedisClient::get(const std::string &key, char *buf, size_t buf_len, size_t &value_len) {
+  value_len = 0;
+  RedisReplyHandle handle;
+  int ret = get(key, handle);
+  if (ret != 0) {
+    return ret;
+  }
+  if (_codec != NULL) {
+    //压缩的value先解压到临时string
+    std::string value;
+    if (!_codec->decode(handle.data(), handle.size(), value)) {
+      return -1;
+    }
+    value_len = value.size();
+    if (value_len > buf_len) {
+      return -4;
+    }
+    memcpy(buf, value.data(), value_len);
+    return 0;
+  }
+  value_len = handle.size();
+  if (value_len > buf_len) {
+    return -4;
+  }
+  memcpy(buf, handle.data(), value_len);
+  return 0;
 }
 
 bool RedisNonClusterClient::init(const std::string &server_info_bak,
@@ -49,6 +252,7 @@ bool RedisNonClusterClient::init(const std::string &server_info_bak,
   
   _password = password;
   _server_info = server_info_bak;
+  _timeout = timeout;
   //ip:port:db 或者 ip:port
   std::string server_info(server_info_bak);
 
@@ -124,34 +328,85 @@ bool RedisNonClusterClient::init(const std::string &server_info_bak,
 }
 
 int RedisNonClusterClient::mset(const std::vector<std::string> &keys,
-    const std::vector<std::string> &values) {
+    const std::vector<std::string> &values, long ttl) {
   if (keys.size() != values.size() || keys.empty()) {
     return -2;
   }
+  RedisStatsScope stats(REDIS_CMD_MSET, keys.size());
+  std::vector<std::string> buf;
+  const std::vector<std::string> &data = _encode(values, buf);
+  stats.add_bytes_out(total_size(keys) + total_size(data));
+  if (!_available()) {
+    return stats.done(-1);
+  }
 
-  int argc = keys.size() * 2 + 1;
-  const char **argv = new const char *[argc];
-  size_t *argv_len = new size_t[argc];
-  argv[0] = "MSET";
-  argv_len[0] = 4;
-  for (int i = 0, j = keys.size(), k = 1; i < j; ++i) {
-    argv[k] = keys[i].c_str();
-    argv_len[k] = keys[i].length();
-    ++k;
-    argv[k] = values[i].c_str();
-    argv_len[k] = values[i].length();
-    ++k;
-  }
-  redisReply *reply = (redisReply *)redisCommandArgv(_redis_context, argc, argv, argv_len);
+  std::vector<redisReply *> replies;
+  int ret = 0;
+  if (ttl > 0) {
+    ret = _pipeline_setex(keys, data, ttl, replies);
+  } else {
+    ret = _pipeline_chunks("MSET", NULL, keys, &data, replies);
+  }
   //判断执行是否成功
-  int ret = -1;
-  if (reply != NULL && reply->type == REDIS_REPLY_STATUS && strcmp(reply->str, "OK") == 0) {
-    ret = 0;
+  for (size_t i = 0; i < replies.size(); ++i) {
+    redisReply *reply = replies[i];
+    if (reply == NULL) {
+      ret = -1;
+    } else if (reply->type != REDIS_REPLY_STATUS || strcmp(reply->str, "OK") != 0) {
+      if (ttl <= 0) {
+        ret = -1;
+      } else if (ret != -1) {
+        //SET EX时每个key一条命令，个别key失败
+        ret = -3;
+      }
+    }
+    freeReplyObject(reply);
   }
+  if (_redis_context->err) {
+    //连接出错，重建连接供下一次请求使用
+    _reconnect();
+  }
+  return stats.done(ret);
+}
 
-  freeReplyObject(reply);
-  delete []argv;
-  delete []argv_len;
+int RedisNonClusterClient::_pipeline_setex(const std::vector<std::string> &keys,
+    const std::vector<std::string> &values, long ttl, std::vector<redisReply *> &replies) {
+  char ttl_buf[32];
+  int ttl_len = snprintf(ttl_buf, sizeof(ttl_buf), "%ld", ttl);
+
+  int size = keys.size();
+  int appended = 0;
+  for (int i = 0; i < size; ++i) {
+    //复用参数缓冲区，避免每次调用分配
+    _argv.clear();
+    _argv_len.clear();
+    _argv.push_back("SET");
+    _argv_len.push_back(3);
+    _argv.push_back(keys[i].c_str());
+    _argv_len.push_back(keys[i].length());
+    _argv.push_back(values[i].c_str());
+    _argv_len.push_back(values[i].length());
+    _argv.push_back("EX");
+    _argv_len.push_back(2);
+    _argv.push_back(ttl_buf);
+    _argv_len.push_back(ttl_len);
+    if (redisAppendCommandArgv(_redis_context, _argv.size(), &_argv[0], &_argv_len[0]) != REDIS_OK) {
+      break;
+    }
+    ++appended;
+  }
+
+  int ret = appended == size ? 0 : -1;
+  replies.assign(size, NULL);
+  for (int i = 0; i < appended; ++i) {
+    redisReply *reply = NULL;
+    if (redisGetReply(_redis_context, (void **)&reply) != REDIS_OK) {
+      //连接出错，后续的reply也无法读取
+      ret = -1;
+      break;
+    }
+    replies[i] = reply;
+  }
   return ret;
 }
 
@@ -160,44 +415,145 @@ int RedisNonClusterClient::mget(const std::vector<std::string> &keys,
   if (keys.empty()) {
     return -2;
   }
+  RedisStatsScope stats(REDIS_CMD_MGET, keys.size());
+  stats.add_bytes_out(total_size(keys));
+  if (!_available()) {
+    values.resize(values.size() + keys.size());
+    return stats.done(-1);
+  }
 
-  int argc = keys.size() + 1;
-  const char **argv = new const char *[argc];
-  size_t *argv_len = new size_t[argc];
-  argv[0] = "MGET";
-  argv_len[0] = 4;
-  for (int i = 0, j = keys.size(), k = 1; i < j; ++i) {
-    argv[k] = keys[i].c_str();
-    argv_len[k] = keys[i].length();
-    ++k;
+  //reply构造在arena中，读完后一次释放，不需要freeReplyObject
+  std::vector<redisReply *> replies;
+  int ret = _pipeline_chunks("MGET", NULL, keys, NULL, replies, &_arena);
+  //直接在vector中构造value，避免临时string的分配和拷贝
+  //与_pipeline_chunks的拆分方式一致，每个分片的起始位置固定，失败的分片对应的value为""
+  size_t base = values.size();
+  size_t chunk_size = MAX_ARGV_SIZE - 1;
+  size_t bytes = 0;
+  values.resize(base + keys.size());
+  for (size_t i = 0; i < replies.size(); ++i) {
+    size_t offset = i * chunk_size;
+    size_t n = std::min(chunk_size, keys.size() - offset);
+    //key不存在或者value不是字符串类型（这种情况基本上不会发生）时为""
+    if (!assign_array(replies[i], &values[base + offset], n, bytes)) {
+      ret = -1;
+    }
+  }
+  stats.add_bytes_in(bytes);
+  _arena.reset();
+  if (_redis_context->err) {
+    //连接出错，重建连接供下一次请求使用
+    _reconnect();
   }
-  redisReply *reply = (redisReply *)redisCommandArgv(_redis_context, argc, argv, argv_len);
+  if (_decode(values, base) > 0 && ret == 0) {
+    ret = -3;
+  }
+  return stats.done(ret);
+}
+
+int RedisNonClusterClient::_pipeline_chunks(const char *cmd, const std::string *key,
+    const std::vector<std::string> &items, const std::vector<std::string> *values,
+    std::vector<redisReply *> &replies, RedisReplyArena *arena) {
+  //每条命令的参数个数不超过MAX_ARGV_SIZE
+  int head = key == NULL ? 1 : 2;
+  int step = values == NULL ? 1 : 2;
+  int chunk_size = (MAX_ARGV_SIZE - head) / step;
+  int size = items.size();
+  int chunk_num = (size + chunk_size - 1) / chunk_size;
+
+  int appended = 0;
+  for (int begin = 0; begin < size; begin += chunk_size) {
+    int end = begin + chunk_size < size ? begin + chunk_size : size;
+    //复用参数缓冲区，避免每次调用分配
+    _argv.clear();
+    _argv_len.clear();
+    _argv.push_back(cmd);
+    _argv_len.push_back(strlen(cmd));
+    if (key != NULL) {
+      _argv.push_back(key->c_str());
+      _argv_len.push_back(key->length());
+    }
+    for (int i = begin; i < end; ++i) {
+      _argv.push_back(items[i].c_str());
+      _argv_len.push_back(items[i].length());
+      if (values != NULL) {
+        _argv.push_back((*values)[i].c_str());
+        _argv_len.push_back((*values)[i].length());
+      }
+    }
+    if (redisAppendCommandArgv(_redis_context, _argv.size(), &_argv[0], &_argv_len[0]) != REDIS_OK) {
+      break;
+    }
+    ++appended;
+  }
+
+  //第一次redisGetReply时所有分片在一次写操作中发出
+  int ret = appended == chunk_num ? 0 : -1;
+  replies.assign(chunk_num, NULL);
+  RedisReplyArenaScope scope(arena != NULL ? _redis_context : NULL, arena);
+  for (int i = 0; i < appended; ++i) {
+    redisReply *reply = NULL;
+    if (redisGetReply(_redis_context, (void **)&reply) != REDIS_OK) {
+      //连接出错，后续的reply也无法读取
+      ret = -1;
+      break;
+    }
+    replies[i] = reply;
+  }
+  return ret;
+}
+
+int RedisNonClusterClient::mget(const std::vector<std::string> &keys, RedisReplyHandle &handle) {
+  handle.reset();
+  if (keys.empty()) {
+    return -2;
+  }
+
+  RedisStatsScope stats(REDIS_CMD_MGET, keys.size());
+  stats.add_bytes_out(total_size(keys));
+  if (!_available()) {
+    return stats.done(-1);
+  }
+
+  //reply需要整体交给handle，不拆分，复用参数缓冲区
+  _argv.clear();
+  _argv_len.clear();
+  _argv.push_back("MGET");
+  _argv_len.push_back(4);
+  for (int i = 0, j = keys.size(); i < j; ++i) {
+    _argv.push_back(keys[i].c_str());
+    _argv_len.push_back(keys[i].length());
+  }
+  redisReply *reply = (redisReply *)redisCommandArgv(_redis_context,
+      _argv.size(), &_argv[0], &_argv_len[0]);
+
   //判断执行是否成功
-  int ret = -1;
   if (reply != NULL && reply->type == REDIS_REPLY_ARRAY) {
-    redisReply *one_reply = NULL;
     for (size_t i = 0; i < reply->elements; ++i) {
-      one_reply = reply->element[i];
-      if (one_reply->type == REDIS_REPLY_NIL) {
-        //key不存在
-        values.push_back("");
-      } else if (one_reply->type == REDIS_REPLY_STRING) {
-        values.push_back(std::string(one_reply->str, one_reply->len));
-      } else {
-        //key对应的value不是字符串类型（这种情况基本上不会发生）
-        values.push_back("");
-      }
+      stats.add_bytes_in(reply->element[i]->len);
     }
-    ret = 0;
+    handle.reset(reply);
+    return stats.done(0);
   }
   freeReplyObject(reply);
-
-  delete []argv;
-  delete []argv_len;
-  return ret;
+  if (_redis_context->err) {
+    //连接出错，重建连接供下一次请求使用
+    _reconnect();
+  }
+  return stats.done(-1);
 }
 
 int RedisNonClusterClient::get(const std::string &key, std::vector<unsigned char> &vec) {
+  RedisStatsScope stats(REDIS_CMD_GET);
+  stats.add_bytes_out(key.size());
+  if (_breaker != NULL && !_breaker->allow()) {
+    //熔断期间直接失败
+    return stats.done(-1);
+  }
+  if (_redis_context == NULL && !_reconnect()) {
+    //上一次重连失败
+    return stats.done(-1);
+  }
   int ret = 0;
   redisReply *reply = NULL;
   redisAppendCommand(_redis_context, "GET %b", key.c_str(), key.size());
@@ -210,9 +566,12 @@ int RedisNonClusterClient::get(const std::string &key, std::vector<unsigned char
       reply = NULL;
     }
     LOG_ERROR(debug_log, "get key=%s error, then retry", key.c_str());
-    init(_server_info, _password);
-    redisAppendCommand(_redis_context, "GET %b", key.c_str(), key.size());
-    ret = redisGetReply(_redis_context, (void **)&reply);
+    if (_reconnect()) {
+      redisAppendCommand(_redis_context, "GET %b", key.c_str(), key.size());
+      ret = redisGetReply(_redis_context, (void **)&reply);
+    } else {
+      ret = REDIS_ERR;
+    }
     if(ret == REDIS_ERR || reply == NULL) {
       ret = -1;
       LOG_ERROR(debug_log, "get key=%s error and retry still failed!", key.c_str());
@@ -222,9 +581,9 @@ int RedisNonClusterClient::get(const std::string &key, std::vector<unsigned char
       if(reply->type == REDIS_REPLY_NIL) {
         LOG_ERROR(debug_log, "get key=%s not exist", key.c_str());
       } else {
-        vec.resize(reply->len);
-        for(int i = 0; i < reply->len; ++i) {
-          vec[i] = reply->str[i];
+        stats.add_bytes_in(reply->len);
+        if (!_decode(reply->str, reply->len, vec)) {
+          ret = -1;
         }
       }
     }
@@ -233,17 +592,78 @@ int RedisNonClusterClient::get(const std::string &key, std::vector<unsigned char
       ret = 0;
       LOG_ERROR(debug_log, "get key=%s not exist", key.c_str());
     } else {
-      vec.resize(reply->len);
-      for(int i = 0; i < reply->len; ++i) {
-        vec[i] = reply->str[i];
-      }
-      ret = 0;
+      stats.add_bytes_in(reply->len);
+      ret = _decode(reply->str, reply->len, vec) ? 0 : -1;
     }
   }
 
   if(reply != NULL) {
     freeReplyObject(reply);
   }
+  return stats.done(ret);
+}
+
+bool RedisNonClusterClient::_available() {
+  if (_breaker != NULL && !_breaker->allow()) {
+    //熔断期间直接失败
+    return false;
+  }
+  if (_redis_context == NULL || _redis_context->err) {
+    //上一次重连失败
+    return _reconnect();
+  }
+  return true;
+}
+
+bool RedisNonClusterClient::_reconnect() {
+  RedisStats::reconnect();
+  if (_breaker == NULL) {
+    return init(_server_info, _password, _timeout);
+  }
+  //熔断后由熔断器的后台线程探测，请求线程不再重连
+  if (!_breaker->allow()) {
+    return false;
+  }
+  //只按实际的重连结果计数：熔断恢复后持有旧连接的请求各失败一次，
+  //这些请求重连成功，不会再次触发熔断
+  bool ret = init(_server_info, _password, _timeout);
+  if (ret) {
+    _breaker->succeed();
+  } else {
+    _breaker->failed();
+  }
+  return ret;
+}
+
+bool RedisClusterClient::_available() {
+  if (_breaker != NULL && !_breaker->allow()) {
+    //熔断期间直接失败
+    return false;
+  }
+  if (_redis_context == NULL || _redis_context->err) {
+    //上一次重连失败
+    return _reconnect();
+  }
+  return true;
+}
+
+bool RedisClusterClient::_reconnect() {
+  RedisStats::reconnect();
+  if (_breaker == NULL) {
+    return init(_server_info, _password, _timeout);
+  }
+  //熔断后由熔断器的后台线程探测，请求线程不再重新发现集群
+  if (!_breaker->allow()) {
+    return false;
+  }
+  //只按实际的重连结果计数：熔断恢复后持有旧连接的请求各失败一次，
+  //这些请求重连成功，不会再次触发熔断
+  bool ret = init(_server_info, _password, _timeout);
+  if (ret) {
+    _breaker->succeed();
+  } else {
+    _breaker->failed();
+  }
   return ret;
 }
 
@@ -255,6 +675,8 @@ bool RedisClusterClient::init(const std::string &server_info,
   }
 
   _server_info = server_info;
+  _password = password;
+  _timeout = timeout;
 
   if (timeout > 0) {
     struct timeval tv;
@@ -272,157 +694,313 @@ bool RedisClusterClient::init(const std::string &server_info,
   return true;
 }
 
+bool RedisClusterClient::enable_replica_reads(bool hedge, long min_hedge_delay,
+    long max_hedge_delay) {
+  RedisReplicaReader *reader = new RedisReplicaReader(hedge, min_hedge_delay, max_hedge_delay);
+  if (!reader->init(_server_info, _password, _timeout)) {
+    delete reader;
+    return false;
+  }
+  delete _replica_reader;
+  _replica_reader = reader;
+  return true;
+}
+
 int RedisClusterClient::mset(const std::vector<std::string> &keys,
-    const std::vector<std::string> &values) {
+    const std::vector<std::string> &values, long ttl) {
   if (keys.empty() || keys.size() != values.size()) {
     return -2;
   }
+  RedisStatsScope stats(REDIS_CMD_MSET, keys.size());
+  std::vector<std::string> buf;
+  const std::vector<std::string> &data = _encode(values, buf);
+  stats.add_bytes_out(total_size(keys) + total_size(data));
+  if (!_available()) {
+    return stats.done(-1);
+  }
 
+  std::vector<int> indexes(keys.size());
   for (int i = 0, j = keys.size(); i < j; ++i) {
-    redisClusterAppendCommand(_redis_context, "SET %b %b", keys[i].c_str(), keys[i].length(),
-        values[i].c_str(), values[i].length());
+    indexes[i] = i;
   }
 
-  //记录请求失败的keys
+  //记录请求失败的keys，失败的key重新分组后重试
   std::vector<int> failed_keys;
-  redisReply *reply = NULL;
-  int ret = 0;
-  for (int i = 0, j = keys.size(); i < j; ++i) {
-    reply = NULL;
-    ret = redisClusterGetReply(_redis_context, (void **)&reply);
-    if (ret == REDIS_ERR || reply == NULL
-        || reply->type != REDIS_REPLY_STATUS || strcmp(reply->str, "OK") != 0) {
-      failed_keys.push_back(i);
+  for (int try_times = 0; try_times < MAX_TRY_TIMES; ++try_times) {
+    failed_keys.clear();
+    if (try_times > 0) {
+      RedisStats::retry();
     }
-    freeReplyObject(reply);
+    _mset_by_slot(keys, data, indexes, ttl, failed_keys);
+    if (failed_keys.empty()) {
+      return stats.done(0);
+    }
+    indexes.swap(failed_keys);
   }
+  return stats.done(-3);
+}
 
-  redisClusterReset(_redis_context);
-
-  if (failed_keys.empty()) {
+int RedisClusterClient::mget(const std::vector<std::string> &keys,
+    std::vector<std::string> &values) {
+  if (keys.empty()) {
     return 0;
   }
+  RedisStatsScope stats(REDIS_CMD_MGET, keys.size());
+  stats.add_bytes_out(total_size(keys));
+
+  //按keys的顺序放在values的末尾，失败的value为""
+  size_t offset = values.size();
+  values.resize(offset + keys.size());
+  if (!_available()) {
+    return stats.done(-1);
+  }
 
-  int try_times = 1;
-  int failed_size = 0;
-
-retry:
-
-  failed_size = failed_keys.size();
-  for (int i = 0; i < failed_size; ++i) {
-    redisClusterAppendCommand(_redis_context, "SET %b %b",
-        keys[failed_keys[i]].c_str(), keys[failed_keys[i]].length(),
-        values[failed_keys[i]].c_str(), values[failed_keys[i]].length());
+  std::vector<int> indexes(keys.size());
+  for (int i = 0, j = keys.size(); i < j; ++i) {
+    indexes[i] = i;
   }
 
-  failed_keys.clear();
-  for (int i = 0; i < failed_size; ++i) {
-    reply = NULL;
-    ret = redisClusterGetReply(_redis_context, (void **)&reply);
-    if (ret == REDIS_ERR || reply == NULL
-        || reply->type != REDIS_REPLY_STATUS || strcmp(reply->str, "OK") != 0) {
-      //failed
-      failed_keys.push_back(i);
+  //记录请求失败的keys，失败的key重新分组后重试
+  std::vector<int> failed_keys;
+  for (int try_times = 0; try_times < MAX_TRY_TIMES; ++try_times) {
+    failed_keys.clear();
+    if (try_times > 0) {
+      RedisStats::retry();
     }
-    freeReplyObject(reply);
+    _mget_by_slot(keys, indexes, &values[offset], failed_keys);
+    if (failed_keys.empty()) {
+      break;
+    }
+    indexes.swap(failed_keys);
   }
-
-  redisClusterReset(_redis_context);
-  ++try_times;
-
-  if (failed_keys.empty()) {
-    return 0;
-  } else if (try_times < MAX_TRY_TIMES) {
-    goto retry;
-  } else {
-    return -3;
+  stats.add_bytes_in(total_size(values, offset));
+  if (_decode(values, offset) > 0 || !failed_keys.empty()) {
+    return stats.done(-3);
   }
+  return stats.done(0);
 }
 
-int RedisClusterClient::mget(const std::vector<std::string> &keys,
-    std::vector<std::string> &values) {
-  if (keys.empty()) {
-    return 0;
+void RedisClusterClient::_flush_nodes(const std::vector<std::pair<unsigned int, int> > &groups,
+    const std::vector<size_t> &starts) {
+  //redisClusterGetReply在读取某个节点的第一个reply时才把该节点的命令写出去，
+  //各节点串行执行。先把所有涉及节点的输出缓冲区写出，各节点并行执行，
+  //批量操作的耗时从各节点耗时之和变为最慢节点的耗时。
+  std::set<cluster_node *> nodes;
+  for (size_t g = 0; g + 1 < starts.size(); ++g) {
+    cluster_node *node = _redis_context->table[groups[starts[g]].first];
+    if (node == NULL || node->con == NULL || node->con->err) {
+      continue;
+    }
+    if (!nodes.insert(node).second) {
+      continue;
+    }
+    int done = 0;
+    while (!done) {
+      if (redisBufferWrite(node->con, &done) == REDIS_ERR) {
+        //写失败时交给redisClusterGetReply处理重连和重试
+        break;
+      }
+    }
   }
+}
 
-  for (int i = 0, j = keys.size(); i < j; ++i) {
-    redisClusterAppendCommand(_redis_context, "GET %b", keys[i].c_str(), keys[i].length());
+void RedisClusterClient::_mget_by_slot(const std::vector<std::string> &keys,
+    const std::vector<int> &indexes, std::string *values, std::vector<int> &failed_keys) {
+  std::vector<std::pair<unsigned int, int> > groups;
+  std::vector<size_t> starts;
+  redis_group_by_slot(keys, indexes, groups, starts);
+
+  //同一slot的key合并为一条MGET，只有一个key时使用GET
+  int group_num = starts.size() - 1;
+  std::vector<char> appended(group_num, 0);
+  std::vector<const char *> argv;
+  std::vector<size_t> argv_len;
+  for (int g = 0; g < group_num; ++g) {
+    size_t begin = starts[g];
+    size_t end = starts[g + 1];
+    argv.clear();
+    argv_len.clear();
+    if (end - begin == 1) {
+      argv.push_back("GET");
+      argv_len.push_back(3);
+    } else {
+      argv.push_back("MGET");
+      argv_len.push_back(4);
+    }
+    for (size_t i = begin; i < end; ++i) {
+      argv.push_back(keys[groups[i].second].c_str());
+      argv_len.push_back(keys[groups[i].second].length());
+    }
+    appended[g] = redisClusterAppendCommandArgv(_redis_context, argv.size(),
+        &argv[0], &argv_len[0]) == REDIS_OK;
   }
+  _flush_nodes(groups, starts);
 
-  //记录请求失败的keys
-  std::vector<int> failed_keys;
   redisReply *reply = NULL;
-  int ret = 0;
-  for (int i = 0, j = keys.size(); i < j; ++i) {
+  for (int g = 0; g < group_num; ++g) {
+    size_t begin = starts[g];
+    size_t end = starts[g + 1];
     reply = NULL;
-    ret = redisClusterGetReply(_redis_context, (void **)&reply);
+    int ret = REDIS_ERR;
+    if (appended[g]) {
+      ret = redisClusterGetReply(_redis_context, (void **)&reply);
+    }
+
+    bool ok = false;
     if (ret == REDIS_ERR || reply == NULL) {
-      failed_keys.push_back(i);
-      values.push_back("");
-    } else if (reply->type == REDIS_REPLY_STRING) {
-      //获取到该key的value
-      values.push_back(std::string(reply->str, reply->len));
-    } else if (reply->type == REDIS_REPLY_NIL) {
-      //该key不存在
-      values.push_back("");
-    } else {
-      failed_keys.push_back(i);
-      values.push_back("");
+      ok = false;
+    } else if (end - begin == 1) {
+      if (reply->type == REDIS_REPLY_STRING) {
+        //获取到该key的value
+        values[groups[begin].second].assign(reply->str, reply->len);
+        ok = true;
+      } else if (reply->type == REDIS_REPLY_NIL) {
+        //该key不存在
+        values[groups[begin].second].clear();
+        ok = true;
+      }
+    } else if (reply->type == REDIS_REPLY_ARRAY && reply->elements == end - begin) {
+      for (size_t i = begin; i < end; ++i) {
+        redisReply *one_reply = reply->element[i - begin];
+        if (one_reply->type == REDIS_REPLY_STRING) {
+          values[groups[i].second].assign(one_reply->str, one_reply->len);
+        } else {
+          values[groups[i].second].clear();
+        }
+      }
+      ok = true;
+    }
+
+    if (!ok) {
+      for (size_t i = begin; i < end; ++i) {
+        failed_keys.push_back(groups[i].second);
+      }
     }
     freeReplyObject(reply);
   }
 
   redisClusterReset(_redis_context);
+}
 
-  if (failed_keys.empty()) {
-    return 0;
+void RedisClusterClient::_mset_by_slot(const std::vector<std::string> &keys,
+    const std::vector<std::string> &values, const std::vector<int> &indexes, long ttl,
+    std::vector<int> &failed_keys) {
+  std::vector<std::pair<unsigned int, int> > groups;
+  std::vector<size_t> starts;
+  redis_group_by_slot(keys, indexes, groups, starts);
+  if (ttl > 0) {
+    _setex_by_slot(keys, values, groups, starts, ttl, failed_keys);
+    return;
   }
 
-  std::vector<int> failed_keys2;
-  int try_times = 1;
-  int failed_size = 0;
-
-retry:
-
-  //前面失败的value都已经设置为""
-  failed_size = failed_keys.size();
-  for (int i = 0; i < failed_size; ++i) {
-    redisClusterAppendCommand(_redis_context, "GET %b",
-        keys[failed_keys[i]].c_str(), keys[failed_keys[i]].length());
+  //同一slot的key合并为一条MSET，只有一个key时使用SET
+  int group_num = starts.size() - 1;
+  std::vector<char> appended(group_num, 0);
+  std::vector<const char *> argv;
+  std::vector<size_t> argv_len;
+  for (int g = 0; g < group_num; ++g) {
+    size_t begin = starts[g];
+    size_t end = starts[g + 1];
+    argv.clear();
+    argv_len.clear();
+    if (end - begin == 1) {
+      argv.push_back("SET");
+      argv_len.push_back(3);
+    } else {
+      argv.push_back("MSET");
+      argv_len.push_back(4);
+    }
+    for (size_t i = begin; i < end; ++i) {
+      int k = groups[i].second;
+      argv.push_back(keys[k].c_str());
+      argv_len.push_back(keys[k].length());
+      argv.push_back(values[k].c_str());
+      argv_len.push_back(values[k].length());
+    }
+    appended[g] = redisClusterAppendCommandArgv(_redis_context, argv.size(),
+        &argv[0], &argv_len[0]) == REDIS_OK;
   }
+  _flush_nodes(groups, starts);
 
-  failed_keys2.clear();
-  for (int i = 0; i < failed_size; ++i) {
+  redisReply *reply = NULL;
+  for (int g = 0; g < group_num; ++g) {
     reply = NULL;
-    ret = redisClusterGetReply(_redis_context, (void **)&reply);
-    if (ret == REDIS_ERR || reply == NULL) {
-      failed_keys2.push_back(i);
-    } else if (reply->type == REDIS_REPLY_STRING) {
-      values[failed_keys[i]].assign(reply->str, reply->len);
-    } else if (reply->type != REDIS_REPLY_NIL) {
-      //不是REDIS_REPLY_STRING 、不是REDIS_REPLY_NIL
-      failed_keys2.push_back(i);
+    int ret = REDIS_ERR;
+    if (appended[g]) {
+      ret = redisClusterGetReply(_redis_context, (void **)&reply);
+    }
+    if (ret == REDIS_ERR || reply == NULL
+        || reply->type != REDIS_REPLY_STATUS || strcmp(reply->str, "OK") != 0) {
+      for (size_t i = starts[g]; i < starts[g + 1]; ++i) {
+        failed_keys.push_back(groups[i].second);
+      }
     }
     freeReplyObject(reply);
   }
 
   redisClusterReset(_redis_context);
-  ++try_times;
+}
 
-  if (failed_keys2.empty()) {
-    return 0;
-  } else if (try_times < MAX_TRY_TIMES) {
-    failed_keys.swap(failed_keys2);
-    goto retry;
-  } else {
-    return -3;
+void RedisClusterClient::_setex_by_slot(const std::vector<std::string> &keys,
+    const std::vector<std::string> &values,
+    const std::vector<std::pair<unsigned int, int> > &groups,
+    const std::vector<size_t> &starts, long ttl, std::vector<int> &failed_keys) {
+  char ttl_buf[32];
+  size_t ttl_len = snprintf(ttl_buf, sizeof(ttl_buf), "%ld", ttl);
+
+  //MSET不支持过期时间，每个key一条SET EX，按slot分组后pipeline
+  std::vector<char> appended(groups.size(), 0);
+  const char *argv[5];
+  size_t argv_len[5];
+  argv[0] = "SET";
+  argv_len[0] = 3;
+  argv[3] = "EX";
+  argv_len[3] = 2;
+  argv[4] = ttl_buf;
+  argv_len[4] = ttl_len;
+  for (size_t i = 0; i < groups.size(); ++i) {
+    int k = groups[i].second;
+    argv[1] = keys[k].c_str();
+    argv_len[1] = keys[k].length();
+    argv[2] = values[k].c_str();
+    argv_len[2] = values[k].length();
+    appended[i] = redisClusterAppendCommandArgv(_redis_context, 5, argv, argv_len) == REDIS_OK;
   }
+  _flush_nodes(groups, starts);
+
+  redisReply *reply = NULL;
+  for (size_t i = 0; i < groups.size(); ++i) {
+    reply = NULL;
+    int ret = REDIS_ERR;
+    if (appended[i]) {
+      ret = redisClusterGetReply(_redis_context, (void **)&reply);
+    }
+    if (ret == REDIS_ERR || reply == NULL
+        || reply->type != REDIS_REPLY_STATUS || strcmp(reply->str, "OK") != 0) {
+      failed_keys.push_back(groups[i].second);
+    }
+    freeReplyObject(reply);
+  }
+
+  redisClusterReset(_redis_context);
 }
 
 int RedisNonClusterClient::hset(const std::string &key, const std::string &h_key, const std::string &h_value) {
+  RedisStatsScope stats(REDIS_CMD_HSET);
+  std::string buf;
+  const std::string &data = _encode(h_value, buf);
+  stats.add_bytes_out(key.size() + h_key.size() + data.size());
+  if (_breaker != NULL && !_breaker->allow()) {
+    //熔断期间直接失败
+    return stats.done(-1);
+  }
+  if (_redis_context == NULL && !_reconnect()) {
+    //上一次重连失败
+    return stats.done(-1);
+  }
   int ret = 0;
   redisReply *reply = NULL;
-  redisAppendCommand(_redis_context, "HSET %b %b %b", key.c_str(), key.size(), h_key.c_str(), h_key.size(), h_value.c_str(), h_value.size());
+  redisAppendCommand(_redis_context, "HSET %b %b %b", key.c_str(), key.size(), h_key.c_str(), h_key.size(), data.c_str(), data.size());
   ret = redisGetReply(_redis_context, (void **)&reply);
 
   if (ret == REDIS_ERR || reply == NULL) {
@@ -430,9 +1008,12 @@ int RedisNonClusterClient::hset(const std::string &key, const std::string &h_key
       freeReplyObject(reply);
       reply = NULL;
     }
-    init(_server_info, _password);
-    redisAppendCommand(_redis_context, "HSET %b %b %b", key.c_str(), key.size(), h_key.c_str(), h_key.size(), h_value.c_str(), h_value.size());
-    ret = redisGetReply(_redis_context, (void **)&reply);
+    if (_reconnect()) {
+      redisAppendCommand(_redis_context, "HSET %b %b %b", key.c_str(), key.size(), h_key.c_str(), h_key.size(), data.c_str(), data.size());
+      ret = redisGetReply(_redis_context, (void **)&reply);
+    } else {
+      ret = REDIS_ERR;
+    }
     LOG_ERROR(debug_log, "redis: set key=%s error then retry", key.c_str());
     if(ret == REDIS_ERR || reply == NULL) {
       ret = -1;
@@ -447,23 +1028,37 @@ int RedisNonClusterClient::hset(const std::string &key, const std::string &h_key
   if(reply != NULL) {
     freeReplyObject(reply);
   }
-  return ret;
+  return stats.done(ret);
 }
 
 int RedisNonClusterClient::hmset(const std::string &key,
     const std::vector<std::string> &fields, const std::vector<std::string> &values) {
-  int ret = _hmset(key, fields, values);
+  RedisStatsScope stats(REDIS_CMD_HMSET, fields.size());
+  std::vector<std::string> buf;
+  const std::vector<std::string> &data = _encode(values, buf);
+  stats.add_bytes_out(key.size() + total_size(fields) + total_size(data));
+  if (_breaker != NULL && !_breaker->allow()) {
+    //熔断期间直接失败
+    return stats.done(-1);
+  }
+  if (_redis_context == NULL && !_reconnect()) {
+    //上一次重连失败
+    return stats.done(-1);
+  }
+  int ret = _hmset(key, fields, data);
   if(ret == -1) {
     LOG_ERROR(debug_log, "redis: hmset key=%s error and then retry", key.c_str());
-    init(_server_info, _password);
-    ret = _hmset(key, fields, values);
+    if (_reconnect()) {
+      ret = _hmset(key, fields, data);
+    }
     if(ret == -1) {
       LOG_ERROR(debug_log, "redis: hmset key=%s error and retry failed", key.c_str());
     } else {
       LOG_ERROR(debug_log, "redis: hmset key=%s error and retry succeed", key.c_str());
     }
   }
-} 
+  return stats.done(ret);
+}
 
 int RedisNonClusterClient::_hmset(const std::string &key,
     const std::vector<std::string> &fields, const std::vector<std::string> &values) {
@@ -471,36 +1066,17 @@ int RedisNonClusterClient::_hmset(const std::string &key,
     return -2;
   }
 
-  int argc = fields.size() * 2 + 2;
-  if (argc > MAX_ARGV_SIZE) {
-    return -4;
-  }
-
-  const char *argv[MAX_ARGV_SIZE];
-  size_t argv_len[MAX_ARGV_SIZE];
-  argv[0] = "HMSET";
-  argv_len[0] = 5;
-  argv[1] = key.c_str();
-  argv_len[1] = key.length();
-  for (int i = 0, j = fields.size(), k = 2; i < j; ++i) {
-    argv[k] = fields[i].c_str();
-    argv_len[k] = fields[i].length();
-    ++k;
-    argv[k] = values[i].c_str();
-    argv_len[k] = values[i].length();
-    ++k;
-  }
-  redisReply *reply = (redisReply *)redisCommandArgv(_redis_context, argc, argv, argv_len);
+  std::vector<redisReply *> replies;
+  int ret = _pipeline_chunks("HMSET", &key, fields, &values, replies);
   //判断执行是否成功
-  int ret = -1;
-  if (reply != NULL && reply->type == REDIS_REPLY_STATUS) {
-    if(reply->str == NULL) {
+  for (size_t i = 0; i < replies.size(); ++i) {
+    redisReply *reply = replies[i];
+    if (reply == NULL || reply->type != REDIS_REPLY_STATUS
+        || reply->str == NULL || strcmp(reply->str, "OK") != 0) {
       ret = -1;
-    } else {
-      ret = (strcmp(reply->str, "OK") == 0) ? 0 : -1;
     }
+    freeReplyObject(reply);
   }
-  freeReplyObject(reply);
   return ret;
 }
 
@@ -508,32 +1084,40 @@ int RedisNonClusterClient::del(const std::vector<std::string> &keys) {
   if (keys.empty()) {
     return -2;
   }
-
-  int argc = keys.size() + 1;
-  if (argc > MAX_ARGV_SIZE) {
-    return -4;
+  RedisStatsScope stats(REDIS_CMD_DEL, keys.size());
+  stats.add_bytes_out(total_size(keys));
+  if (!_available()) {
+    return stats.done(-1);
   }
 
-  const char *argv[MAX_ARGV_SIZE];
-  size_t argv_len[MAX_ARGV_SIZE];
-  argv[0] = "DEL";
-  argv_len[0] = 3;
-  for (int i = 0, j = keys.size(), k = 1; i < j; ++i, ++k) {
-    argv[k] = keys[i].c_str();
-    argv_len[k] = keys[i].length();
-  }
-  redisReply *reply = (redisReply *)redisCommandArgv(_redis_context, argc, argv, argv_len);
+  std::vector<redisReply *> replies;
+  int ret = _pipeline_chunks("DEL", NULL, keys, NULL, replies);
   //判断执行是否成功
-  int ret = -1;
-  if (reply != NULL && reply->type == REDIS_REPLY_INTEGER) {
-    ret = 0;
+  for (size_t i = 0; i < replies.size(); ++i) {
+    redisReply *reply = replies[i];
+    if (reply == NULL || reply->type != REDIS_REPLY_INTEGER) {
+      ret = -1;
+    }
+    freeReplyObject(reply);
   }
-
-  freeReplyObject(reply);
-  return ret;
+  if (_redis_context->err) {
+    //连接出错，重建连接供下一次请求使用
+    _reconnect();
+  }
+  return stats.done(ret);
 }
 
 int RedisNonClusterClient::hget(const std::string &key, const std::string &h_key, std::string &h_value) {
+  RedisStatsScope stats(REDIS_CMD_HGET);
+  stats.add_bytes_out(key.size() + h_key.size());
+  if (_breaker != NULL && !_breaker->allow()) {
+    //熔断期间直接失败
+    return stats.done(-1);
+  }
+  if (_redis_context == NULL && !_reconnect()) {
+    //上一次重连失败
+    return stats.done(-1);
+  }
   int ret = 0;
   redisReply *reply = NULL;
   redisAppendCommand(_redis_context, "HGET %b %b", key.c_str(), key.size(), h_key.c_str(), h_key.size());
@@ -543,9 +1127,12 @@ int RedisNonClusterClient::hget(const std::string &key, const std::string &h_key
       freeReplyObject(reply);
       reply = NULL;
     }
-    init(_server_info, _password);
-    redisAppendCommand(_redis_context, "HGET %b %b", key.c_str(), key.size(), h_key.c_str(), h_key.size());
-    ret = redisGetReply(_redis_context, (void **)&reply);
+    if (_reconnect()) {
+      redisAppendCommand(_redis_context, "HGET %b %b", key.c_str(), key.size(), h_key.c_str(), h_key.size());
+      ret = redisGetReply(_redis_context, (void **)&reply);
+    } else {
+      ret = REDIS_ERR;
+    }
     if(ret == REDIS_ERR || reply == NULL) {
       ret = -1;
       LOG_ERROR(debug_log, "redis: set key=%s error and retry failed", key.c_str());
@@ -558,22 +1145,286 @@ int RedisNonClusterClient::hget(const std::string &key, const std::string &h_key
   }
   
   if(ret == 0) {
-    if(reply->str != NULL) {
-      h_value = std::string(reply->str);
+    if(reply->type == REDIS_REPLY_STRING) {
+      //value可能包含'\0'，按长度拷贝
+      h_value.assign(reply->str, reply->len);
+      stats.add_bytes_in(reply->len);
+      if (!_decode(h_value)) {
+        ret = -1;
+      }
     }
   }
 
   if(reply != NULL) {
     freeReplyObject(reply);
   }
-  return ret;
+  return stats.done(ret);
 
 }
 
+int RedisNonClusterClient::hmget(const std::string &key,
+    const std::vector<std::string> &fields, std::vector<std::string> &values) {
+  if (key.empty() || fields.empty()) {
+    return -2;
+  }
+  RedisStatsScope stats(REDIS_CMD_HMGET, fields.size());
+  stats.add_bytes_out(key.size() + total_size(fields));
+  if (!_available()) {
+    return stats.done(-1);
+  }
+
+  //reply构造在arena中，读完后一次释放
+  std::vector<redisReply *> replies;
+  int ret = _pipeline_chunks("HMGET", &key, fields, NULL, replies, &_arena);
+  //与_pipeline_chunks的拆分方式一致
+  size_t chunk_size = MAX_ARGV_SIZE - 2;
+  size_t bytes = 0;
+  values.resize(fields.size());
+  for (size_t i = 0, offset = 0; i < replies.size(); ++i, offset += chunk_size) {
+    size_t n = std::min(chunk_size, fields.size() - offset);
+    if (!assign_array(replies[i], &values[offset], n, bytes)) {
+      ret = -1;
+    }
+  }
+  _arena.reset();
+  stats.add_bytes_in(bytes);
+  if (_decode(values) > 0 && ret == 0) {
+    ret = -3;
+  }
+  if (_redis_context->err) {
+    //连接出错，重建连接供下一次请求使用
+    _reconnect();
+  }
+  return stats.done(ret);
+}
+
+int RedisNonClusterClient::hmget(const std::vector<std::string> &keys,
+    const std::vector<std::string> &fields, std::vector<std::vector<std::string> > &values) {
+  if (keys.empty() || fields.empty() || fields.size() > MAX_ARGV_SIZE - 2) {
+    return -2;
+  }
+  RedisStatsScope stats(REDIS_CMD_HMGET, keys.size() * fields.size());
+  stats.add_bytes_out(total_size(keys) + keys.size() * total_size(fields));
+  if (!_available()) {
+    return stats.done(-1);
+  }
+
+  //每个key一条HMGET，全部追加后一次写出
+  size_t appended = 0;
+  for (; appended < keys.size(); ++appended) {
+    _argv.clear();
+    _argv_len.clear();
+    _argv.push_back("HMGET");
+    _argv_len.push_back(5);
+    _argv.push_back(keys[appended].c_str());
+    _argv_len.push_back(keys[appended].length());
+    for (size_t i = 0; i < fields.size(); ++i) {
+      _argv.push_back(fields[i].c_str());
+      _argv_len.push_back(fields[i].length());
+    }
+    if (redisAppendCommandArgv(_redis_context, _argv.size(), &_argv[0], &_argv_len[0]) != REDIS_OK) {
+      break;
+    }
+  }
+
+  int ret = appended == keys.size() ? 0 : -1;
+  size_t failed = 0;
+  size_t bytes = 0;
+  values.resize(keys.size());
+  {
+    RedisReplyArenaScope scope(_redis_context, &_arena);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      values[i].resize(fields.size());
+      redisReply *reply = NULL;
+      if (i < appended && redisGetReply(_redis_context, (void **)&reply) != REDIS_OK) {
+        //连接出错，后续的reply也无法读取
+        reply = NULL;
+        appended = i;
+        ret = -1;
+      }
+      if (!assign_array(reply, &values[i][0], fields.size(), bytes)) {
+        ++failed;
+      } else if (_decode(values[i]) > 0) {
+        ++failed;
+      }
+    }
+  }
+  _arena.reset();
+  stats.add_bytes_in(bytes);
+  if (ret == 0 && failed > 0) {
+    ret = -3;
+  }
+  if (_redis_context->err) {
+    //连接出错，重建连接供下一次请求使用
+    _reconnect();
+  }
+  return stats.done(ret);
+}
+
+int RedisNonClusterClient::hgetall(const std::string &key,
+    std::vector<std::string> &fields, std::vector<std::string> &values) {
+  fields.clear();
+  values.clear();
+  if (key.empty()) {
+    return -2;
+  }
+  RedisStatsScope stats(REDIS_CMD_HGETALL);
+  stats.add_bytes_out(key.size());
+  if (!_available()) {
+    return stats.done(-1);
+  }
+
+  int ret = -1;
+  size_t bytes = 0;
+  if (redisAppendCommand(_redis_context, "HGETALL %b", key.c_str(), key.size()) == REDIS_OK) {
+    RedisReplyArenaScope scope(_redis_context, &_arena);
+    redisReply *reply = NULL;
+    if (redisGetReply(_redis_context, (void **)&reply) == REDIS_OK
+        && assign_pairs(reply, fields, values, bytes)) {
+      ret = 0;
+    }
+  }
+  _arena.reset();
+  if (_decode(values) > 0 && ret == 0) {
+    ret = -3;
+  }
+  stats.add_bytes_in(bytes);
+  if (_redis_context->err) {
+    //连接出错，重建连接供下一次请求使用
+    _reconnect();
+  }
+  return stats.done(ret);
+}
+
+int RedisNonClusterClient::eval(const RedisScript &script, const std::vector<std::string> &keys,
+    const std::vector<std::string> &args, RedisReplyHandle &result) {
+  result.reset();
+  RedisStatsScope stats(REDIS_CMD_EVAL, keys.size());
+  stats.add_bytes_out(total_size(keys) + total_size(args));
+  if (!_available()) {
+    return stats.done(-1);
+  }
+
+  char numkeys[16];
+  build_eval_argv("EVALSHA", script.sha(), keys, args, numkeys, sizeof(numkeys), _argv, _argv_len);
+  redisReply *reply = (redisReply *)redisCommandArgv(_redis_context,
+      _argv.size(), &_argv[0], &_argv_len[0]);
+  if (is_noscript(reply)) {
+    //发送源码执行，server同时缓存该脚本
+    freeReplyObject(reply);
+    build_eval_argv("EVAL", script.source(), keys, args, numkeys, sizeof(numkeys), _argv, _argv_len);
+    reply = (redisReply *)redisCommandArgv(_redis_context, _argv.size(), &_argv[0], &_argv_len[0]);
+  }
+  if (_redis_context->err) {
+    //连接出错，重建连接供下一次请求使用
+    _reconnect();
+  }
+  if (reply == NULL) {
+    return stats.done(-1);
+  }
+  result.reset(reply);
+  return stats.done(reply->type == REDIS_REPLY_ERROR ? -1 : 0);
+}
+
+int RedisNonClusterClient::eval(const RedisScript &script,
+    const std::vector<RedisScriptCall> &calls, RedisReplyList &results) {
+  results.reset(calls.size());
+  if (calls.empty()) {
+    return -2;
+  }
+  RedisStatsScope stats(REDIS_CMD_EVAL, calls.size());
+  if (!_available()) {
+    return stats.done(-1);
+  }
+
+  //第一轮全部EVALSHA，第二轮只对NOSCRIPT的调用EVAL
+  std::vector<size_t> pending(calls.size());
+  for (size_t i = 0; i < calls.size(); ++i) {
+    pending[i] = i;
+  }
+  char numkeys[16];
+  int ret = 0;
+  for (int round = 0; round < 2 && !pending.empty() && ret == 0; ++round) {
+    size_t appended = 0;
+    for (; appended < pending.size(); ++appended) {
+      const RedisScriptCall &call = calls[pending[appended]];
+      build_eval_argv(round == 0 ? "EVALSHA" : "EVAL", round == 0 ? script.sha() : script.source(),
+          call.keys, call.args, numkeys, sizeof(numkeys), _argv, _argv_len);
+      if (redisAppendCommandArgv(_redis_context, _argv.size(), &_argv[0], &_argv_len[0]) != REDIS_OK) {
+        ret = -1;
+        break;
+      }
+    }
+
+    std::vector<size_t> noscript;
+    for (size_t i = 0; i < appended; ++i) {
+      redisReply *reply = NULL;
+      if (redisGetReply(_redis_context, (void **)&reply) != REDIS_OK) {
+        //连接出错，后续的reply也无法读取
+        ret = -1;
+        break;
+      }
+      if (is_noscript(reply)) {
+        freeReplyObject(reply);
+        noscript.push_back(pending[i]);
+        continue;
+      }
+      results.set(pending[i], reply);
+    }
+    pending.swap(noscript);
+  }
+
+  if (ret == 0) {
+    for (size_t i = 0; i < results.size(); ++i) {
+      if (results.reply(i) == NULL || results.reply(i)->type == REDIS_REPLY_ERROR) {
+        ret = -3;
+        break;
+      }
+    }
+  }
+  if (_redis_context->err) {
+    //连接出错，重建连接供下一次请求使用
+    _reconnect();
+  }
+  return stats.done(ret);
+}
+
+int RedisNonClusterClient::load_script(const RedisScript &script) {
+  RedisStatsScope stats(REDIS_CMD_SCRIPT_LOAD);
+  stats.add_bytes_out(script.source().size());
+  if (!_available()) {
+    return stats.done(-1);
+  }
+  redisReply *reply = (redisReply *)redisCommand(_redis_context, "SCRIPT LOAD %b",
+      script.source().c_str(), script.source().size());
+  int ret = -1;
+  if (reply != NULL && reply->type == REDIS_REPLY_STRING && script.sha() == reply->str) {
+    ret = 0;
+  }
+  freeReplyObject(reply);
+  if (_redis_context->err) {
+    //连接出错，重建连接供下一次请求使用
+    _reconnect();
+  }
+  return stats.done(ret);
+}
+
 int RedisClusterClient::hset(const std::string &key, const std::string &h_key, const std::string &h_value) {
+  RedisStatsScope stats(REDIS_CMD_HSET);
+  std::string buf;
+  const std::string &data = _encode(h_value, buf);
+  stats.add_bytes_out(key.size() + h_key.size() + data.size());
+  if (_breaker != NULL && !_breaker->allow()) {
+    //熔断期间直接失败
+    return stats.done(-1);
+  }
+  if (_redis_context == NULL && !_reconnect()) {
+    //上一次重连失败
+    return stats.done(-1);
+  }
   int ret = 0;
   redisReply *reply = NULL;
-  redisClusterAppendCommand(_redis_context, "HSET %b %b %b", key.c_str(), key.size(), h_key.c_str(), h_key.size(), h_value.c_str(), h_value.size());
+  redisClusterAppendCommand(_redis_context, "HSET %b %b %b", key.c_str(), key.size(), h_key.c_str(), h_key.size(), data.c_str(), data.size());
   ret = redisClusterGetReply(_redis_context, (void **)&reply);
 
   if (ret == REDIS_ERR || reply == NULL) {
@@ -581,10 +1432,12 @@ int RedisClusterClient::hset(const std::string &key, const std::string &h_key, c
       freeReplyObject(reply);
       reply = NULL;
     }
-    redisClusterReset(_redis_context);
-    init(_server_info);
-    redisClusterAppendCommand(_redis_context, "HSET %b %b %b", key.c_str(), key.size(), h_key.c_str(), h_key.size(), h_value.c_str(), h_value.size());
-    ret = redisClusterGetReply(_redis_context, (void **)&reply);
+    if (_reconnect()) {
+      redisClusterAppendCommand(_redis_context, "HSET %b %b %b", key.c_str(), key.size(), h_key.c_str(), h_key.size(), data.c_str(), data.size());
+      ret = redisClusterGetReply(_redis_context, (void **)&reply);
+    } else {
+      ret = REDIS_ERR;
+    }
     LOG_ERROR(debug_log, "redis: set key=%s error then retry", key.c_str());
     if(ret == REDIS_ERR || reply == NULL) {
       ret = -1;
@@ -599,11 +1452,33 @@ int RedisClusterClient::hset(const std::string &key, const std::string &h_key, c
   if(reply != NULL) {
     freeReplyObject(reply);
   }
-  redisClusterReset(_redis_context);
-  return ret;
+  if (_redis_context != NULL) {
+    redisClusterReset(_redis_context);
+  }
+  return stats.done(ret);
 }
 
 int RedisClusterClient::get(const std::string &key, std::vector<unsigned char> &vec) {
+  RedisStatsScope stats(REDIS_CMD_GET);
+  stats.add_bytes_out(key.size());
+  if (_breaker != NULL && !_breaker->allow()) {
+    //熔断期间直接失败
+    return stats.done(-1);
+  }
+  if (_redis_context == NULL && !_reconnect()) {
+    //上一次重连失败
+    return stats.done(-1);
+  }
+  if (_replica_reader != NULL) {
+    //从节点读取失败时回退到master
+    redisReply *replica_reply = _replica_reader->get(key);
+    if (replica_reply != NULL) {
+      stats.add_bytes_in(replica_reply->len);
+      int ret = _decode(replica_reply->str, replica_reply->len, vec) ? vec.size() : -1;
+      freeReplyObject(replica_reply);
+      return stats.done(ret);
+    }
+  }
   int ret = 0;
   redisReply *reply = NULL;
   redisClusterAppendCommand(_redis_context, "GET %b", key.c_str(), key.size());
@@ -616,28 +1491,336 @@ int RedisClusterClient::get(const std::string &key, std::vector<unsigned char> &
       freeReplyObject(reply);
       reply = NULL;
     }
-    redisClusterReset(_redis_context);
-    init(_server_info);
-    redisClusterAppendCommand(_redis_context, "GET %b", key.c_str(), key.size());
-    ret = redisClusterGetReply(_redis_context, (void **)&reply);
+    if (_reconnect()) {
+      redisClusterAppendCommand(_redis_context, "GET %b", key.c_str(), key.size());
+      ret = redisClusterGetReply(_redis_context, (void **)&reply);
+    } else {
+      ret = REDIS_ERR;
+    }
     if(ret == REDIS_ERR || reply == NULL) {
       ret = -1;
       LOG_ERROR(debug_log, "get key=%s error and retry still failed!", key.c_str());
     }
   } else {
-    vec.resize(reply->len);
-    for(int i = 0; i < reply->len; ++i) {
-      vec[i] = reply->str[i];
-    }
-    ret = reply->len;
+    stats.add_bytes_in(reply->len);
+    ret = _decode(reply->str, reply->len, vec) ? vec.size() : -1;
   }
 
   if(reply != NULL) {
     freeReplyObject(reply);
   }
   
+  if (_redis_context != NULL) {
+    redisClusterReset(_redis_context);
+  }
+  return stats.done(ret);
+}
+
+int RedisClusterClient::hmget(const std::string &key,
+    const std::vector<std::string> &fields, std::vector<std::string> &values) {
+  if (key.empty() || fields.empty()) {
+    return -2;
+  }
+  RedisStatsScope stats(REDIS_CMD_HMGET, fields.size());
+  stats.add_bytes_out(key.size() + total_size(fields));
+  if (!_available()) {
+    return stats.done(-1);
+  }
+
+  std::vector<const char *> argv;
+  std::vector<size_t> argv_len;
+  argv.push_back("HMGET");
+  argv_len.push_back(5);
+  argv.push_back(key.c_str());
+  argv_len.push_back(key.length());
+  for (size_t i = 0; i < fields.size(); ++i) {
+    argv.push_back(fields[i].c_str());
+    argv_len.push_back(fields[i].length());
+  }
+  redisReply *reply = (redisReply *)redisClusterCommandArgv(_redis_context,
+      argv.size(), &argv[0], &argv_len[0]);
+
+  size_t bytes = 0;
+  values.resize(fields.size());
+  int ret = assign_array(reply, &values[0], fields.size(), bytes) ? 0 : -1;
+  freeReplyObject(reply);
+  if (_decode(values) > 0 && ret == 0) {
+    ret = -3;
+  }
+  stats.add_bytes_in(bytes);
+  if (_redis_context->err) {
+    //连接出错，重建连接供下一次请求使用
+    _reconnect();
+  }
+  return stats.done(ret);
+}
+
+int RedisClusterClient::hmget(const std::vector<std::string> &keys,
+    const std::vector<std::string> &fields, std::vector<std::vector<std::string> > &values) {
+  if (keys.empty() || fields.empty() || fields.size() > MAX_ARGV_SIZE - 2) {
+    return -2;
+  }
+  RedisStatsScope stats(REDIS_CMD_HMGET, keys.size() * fields.size());
+  stats.add_bytes_out(total_size(keys) + keys.size() * total_size(fields));
+  if (!_available()) {
+    return stats.done(-1);
+  }
+
+  values.resize(keys.size());
+  std::vector<int> indexes(keys.size());
+  for (int i = 0, j = keys.size(); i < j; ++i) {
+    indexes[i] = i;
+    values[i].resize(fields.size());
+  }
+
+  //记录请求失败的keys，失败的key重新分组后重试
+  std::vector<int> failed_keys;
+  size_t bytes = 0;
+  int ret = -3;
+  for (int try_times = 0; try_times < MAX_TRY_TIMES; ++try_times) {
+    if (try_times > 0) {
+      RedisStats::retry();
+    }
+    failed_keys.clear();
+    _hmget_by_slot(keys, fields, indexes, values, failed_keys, bytes);
+    if (failed_keys.empty()) {
+      ret = 0;
+      break;
+    }
+    indexes.swap(failed_keys);
+  }
+  stats.add_bytes_in(bytes);
+  for (size_t i = 0; i < values.size(); ++i) {
+    if (_decode(values[i]) > 0) {
+      ret = -3;
+    }
+  }
+  if (_redis_context->err) {
+    //连接出错，重建连接供下一次请求使用
+    _reconnect();
+  }
+  return stats.done(ret);
+}
+
+void RedisClusterClient::_hmget_by_slot(const std::vector<std::string> &keys,
+    const std::vector<std::string> &fields, const std::vector<int> &indexes,
+    std::vector<std::vector<std::string> > &values, std::vector<int> &failed_keys,
+    size_t &bytes) {
+  std::vector<std::pair<unsigned int, int> > groups;
+  std::vector<size_t> starts;
+  redis_group_by_slot(keys, indexes, groups, starts);
+
+  //每个key一条HMGET，按slot排序追加，使同一节点的命令连续
+  std::vector<char> appended(groups.size(), 0);
+  std::vector<const char *> argv;
+  std::vector<size_t> argv_len;
+  for (size_t i = 0; i < groups.size(); ++i) {
+    const std::string &key = keys[groups[i].second];
+    argv.clear();
+    argv_len.clear();
+    argv.push_back("HMGET");
+    argv_len.push_back(5);
+    argv.push_back(key.c_str());
+    argv_len.push_back(key.length());
+    for (size_t j = 0; j < fields.size(); ++j) {
+      argv.push_back(fields[j].c_str());
+      argv_len.push_back(fields[j].length());
+    }
+    appended[i] = redisClusterAppendCommandArgv(_redis_context, argv.size(),
+        &argv[0], &argv_len[0]) == REDIS_OK;
+  }
+  _flush_nodes(groups, starts);
+
+  redisReply *reply = NULL;
+  for (size_t i = 0; i < groups.size(); ++i) {
+    reply = NULL;
+    int ret = REDIS_ERR;
+    if (appended[i]) {
+      ret = redisClusterGetReply(_redis_context, (void **)&reply);
+    }
+    std::vector<std::string> &one_values = values[groups[i].second];
+    if (ret == REDIS_ERR || !assign_array(reply, &one_values[0], fields.size(), bytes)) {
+      failed_keys.push_back(groups[i].second);
+    }
+    freeReplyObject(reply);
+  }
+
   redisClusterReset(_redis_context);
-  return ret;
 }
 
+int RedisClusterClient::hgetall(const std::string &key,
+    std::vector<std::string> &fields, std::vector<std::string> &values) {
+  fields.clear();
+  values.clear();
+  if (key.empty()) {
+    return -2;
+  }
+  RedisStatsScope stats(REDIS_CMD_HGETALL);
+  stats.add_bytes_out(key.size());
+  if (!_available()) {
+    return stats.done(-1);
+  }
+
+  redisReply *reply = (redisReply *)redisClusterCommand(_redis_context,
+      "HGETALL %b", key.c_str(), key.size());
+  size_t bytes = 0;
+  int ret = assign_pairs(reply, fields, values, bytes) ? 0 : -1;
+  freeReplyObject(reply);
+  if (_decode(values) > 0 && ret == 0) {
+    ret = -3;
+  }
+  stats.add_bytes_in(bytes);
+  if (_redis_context->err) {
+    //连接出错，重建连接供下一次请求使用
+    _reconnect();
+  }
+  return stats.done(ret);
+}
+
+int RedisClusterClient::eval(const RedisScript &script, const std::vector<std::string> &keys,
+    const std::vector<std::string> &args, RedisReplyHandle &result) {
+  result.reset();
+  if (keys.empty()) {
+    //集群根据key路由
+    return -2;
+  }
+  RedisStatsScope stats(REDIS_CMD_EVAL, keys.size());
+  stats.add_bytes_out(total_size(keys) + total_size(args));
+  if (!_available()) {
+    return stats.done(-1);
+  }
 
+  std::vector<const char *> argv;
+  std::vector<size_t> argv_len;
+  char numkeys[16];
+  build_eval_argv("EVALSHA", script.sha(), keys, args, numkeys, sizeof(numkeys), argv, argv_len);
+  redisReply *reply = (redisReply *)redisClusterCommandArgv(_redis_context,
+      argv.size(), &argv[0], &argv_len[0]);
+  if (is_noscript(reply)) {
+    //该节点还没有缓存脚本，发送源码执行
+    freeReplyObject(reply);
+    build_eval_argv("EVAL", script.source(), keys, args, numkeys, sizeof(numkeys), argv, argv_len);
+    reply = (redisReply *)redisClusterCommandArgv(_redis_context, argv.size(), &argv[0], &argv_len[0]);
+  }
+  if (_redis_context->err) {
+    //连接出错，重建连接供下一次请求使用
+    _reconnect();
+  }
+  if (reply == NULL) {
+    return stats.done(-1);
+  }
+  result.reset(reply);
+  return stats.done(reply->type == REDIS_REPLY_ERROR ? -1 : 0);
+}
+
+int RedisClusterClient::eval(const RedisScript &script,
+    const std::vector<RedisScriptCall> &calls, RedisReplyList &results) {
+  results.reset(calls.size());
+  if (calls.empty()) {
+    return -2;
+  }
+  for (size_t i = 0; i < calls.size(); ++i) {
+    if (calls[i].keys.empty()) {
+      //集群根据key路由
+      return -2;
+    }
+  }
+  RedisStatsScope stats(REDIS_CMD_EVAL, calls.size());
+  if (!_available()) {
+    return stats.done(-1);
+  }
+
+  //第一轮全部EVALSHA，第二轮只对NOSCRIPT的调用EVAL
+  std::vector<size_t> pending(calls.size());
+  for (size_t i = 0; i < calls.size(); ++i) {
+    pending[i] = i;
+  }
+  std::vector<const char *> argv;
+  std::vector<size_t> argv_len;
+  char numkeys[16];
+  for (int round = 0; round < 2 && !pending.empty(); ++round) {
+    //每个调用单独一组，用于一次写出所有节点
+    std::vector<std::pair<unsigned int, int> > groups(pending.size());
+    std::vector<size_t> starts(pending.size() + 1);
+    std::vector<char> appended(pending.size(), 0);
+    for (size_t i = 0; i < pending.size(); ++i) {
+      const RedisScriptCall &call = calls[pending[i]];
+      groups[i].first = redis_key_slot(call.keys[0]);
+      groups[i].second = pending[i];
+      starts[i] = i;
+      build_eval_argv(round == 0 ? "EVALSHA" : "EVAL", round == 0 ? script.sha() : script.source(),
+          call.keys, call.args, numkeys, sizeof(numkeys), argv, argv_len);
+      appended[i] = redisClusterAppendCommandArgv(_redis_context, argv.size(),
+          &argv[0], &argv_len[0]) == REDIS_OK;
+    }
+    starts[pending.size()] = pending.size();
+    _flush_nodes(groups, starts);
+
+    std::vector<size_t> noscript;
+    for (size_t i = 0; i < pending.size(); ++i) {
+      redisReply *reply = NULL;
+      if (!appended[i] || redisClusterGetReply(_redis_context, (void **)&reply) != REDIS_OK) {
+        freeReplyObject(reply);
+        continue;
+      }
+      if (is_noscript(reply)) {
+        freeReplyObject(reply);
+        noscript.push_back(pending[i]);
+        continue;
+      }
+      results.set(pending[i], reply);
+    }
+    redisClusterReset(_redis_context);
+    pending.swap(noscript);
+  }
+
+  int ret = 0;
+  for (size_t i = 0; i < results.size(); ++i) {
+    if (results.reply(i) == NULL || results.reply(i)->type == REDIS_REPLY_ERROR) {
+      ret = -3;
+      break;
+    }
+  }
+  if (_redis_context->err) {
+    //连接出错，重建连接供下一次请求使用
+    _reconnect();
+  }
+  return stats.done(ret);
+}
+
+int RedisClusterClient::load_script(const RedisScript &script) {
+  RedisStatsScope stats(REDIS_CMD_SCRIPT_LOAD);
+  stats.add_bytes_out(script.source().size());
+  if (!_available()) {
+    return stats.done(-1);
+  }
+  //hiredis-vip只能按key路由，对slot表中的每个master直接发送SCRIPT LOAD，
+  //还没有连接的节点由ctx_get_by_node建立连接，之后路由到该节点的命令复用
+  std::set<cluster_node *> nodes;
+  int loaded = 0;
+  int ret = 0;
+  for (int slot = 0; slot < REDIS_CLUSTER_SLOT_NUM; ++slot) {
+    cluster_node *node = _redis_context->table[slot];
+    if (node == NULL || !nodes.insert(node).second) {
+      continue;
+    }
+    redisContext *con = ctx_get_by_node(_redis_context, node);
+    if (con == NULL || con->err) {
+      ret = -1;
+      continue;
+    }
+    redisReply *reply = (redisReply *)redisCommand(con, "SCRIPT LOAD %b",
+        script.source().c_str(), script.source().size());
+    if (reply == NULL || reply->type != REDIS_REPLY_STRING) {
+      ret = -1;
+    } else {
+      ++loaded;
+    }
+    freeReplyObject(reply);
+  }
+  if (loaded == 0) {
+    //slot表为空或者所有节点都失败
+    ret = -1;
+  }
+  return stats.done(ret);
+}
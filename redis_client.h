@@ -6,9 +6,144 @@
 #include <string>
 #include <vector>
 #include <cstring>
+#include "redis_reply_arena.h"
+#include "redis_circuit_breaker.h"
+#include "redis_codec.h"
+#include "redis_script.h"
+#include "redis_replica_reader.h"
 
 #define MAX_ARGV_SIZE 1024
 
+/**
+ * RedisReplyHandle
+ * 持有hiredis的redisReply，直接访问reply中的数据，避免拷贝，析构或reset时释放
+ **/
+class RedisReplyHandle {
+
+public:
+
+  RedisReplyHandle() : _reply(NULL) {}
+
+  ~RedisReplyHandle() {
+    reset();
+  }
+
+  /**
+   * @brief 释放当前持有的reply，改为持有reply
+   **/
+  void reset(redisReply *reply = NULL) {
+    if (_reply != NULL) {
+      freeReplyObject(_reply);
+    }
+    _reply = reply;
+  }
+
+  /**
+   * @brief 放弃持有reply，由调用方负责freeReplyObject
+   **/
+  redisReply* release() {
+    redisReply *reply = _reply;
+    _reply = NULL;
+    return reply;
+  }
+
+  redisReply* reply() const {
+    return _reply;
+  }
+
+  /**
+   * @brief 字符串类型reply的数据，不存在时返回NULL
+   **/
+  const char* data() const {
+    return (_reply != NULL && _reply->type == REDIS_REPLY_STRING) ? _reply->str : NULL;
+  }
+
+  size_t size() const {
+    return (_reply != NULL && _reply->type == REDIS_REPLY_STRING) ? _reply->len : 0;
+  }
+
+  /**
+   * @brief 数组类型reply（mget）的元素个数
+   **/
+  size_t elements() const {
+    return (_reply != NULL && _reply->type == REDIS_REPLY_ARRAY) ? _reply->elements : 0;
+  }
+
+  /**
+   * @brief 数组类型reply第i个元素的数据，key不存在时返回NULL
+   **/
+  const char* data(size_t i) const {
+    if (i >= elements() || _reply->element[i]->type != REDIS_REPLY_STRING) {
+      return NULL;
+    }
+    return _reply->element[i]->str;
+  }
+
+  size_t size(size_t i) const {
+    if (i >= elements() || _reply->element[i]->type != REDIS_REPLY_STRING) {
+      return 0;
+    }
+    return _reply->element[i]->len;
+  }
+
+private:
+
+  redisReply *_reply;
+
+  //不允许拷贝和赋值操作
+  RedisReplyHandle(const RedisReplyHandle &other);
+  RedisReplyHandle& operator= (const RedisReplyHandle &other);
+};
+
+/**
+ * RedisReplyList
+ * 持有批量操作的多个redisReply，析构或reset时释放
+ **/
+class RedisReplyList {
+
+public:
+
+  RedisReplyList() {}
+
+  ~RedisReplyList() {
+    reset();
+  }
+
+  /**
+   * @brief 释放所有reply，调整为size个NULL
+   **/
+  void reset(size_t size = 0) {
+    for (size_t i = 0; i < _replies.size(); ++i) {
+      freeReplyObject(_replies[i]);
+    }
+    _replies.assign(size, NULL);
+  }
+
+  /**
+   * @brief 第i个位置改为持有reply，原来的reply被释放
+   **/
+  void set(size_t i, redisReply *reply) {
+    freeReplyObject(_replies[i]);
+    _replies[i] = reply;
+  }
+
+  size_t size() const {
+    return _replies.size();
+  }
+
+  redisReply* reply(size_t i) const {
+    return _replies[i];
+  }
+
+private:
+
+  std::vector<redisReply *> _replies;
+
+  //不允许拷贝和赋值操作
+  RedisReplyList(const RedisReplyList &other);
+  RedisReplyList& operator= (const RedisReplyList &other);
+};
+
 /**
  * RedisClient
  * @note 线程不安全
@@ -17,7 +152,7 @@ class RedisClient {
 
 public:
 
-  RedisClient() {}
+  RedisClient() : _codec(NULL) {}
 
   virtual ~RedisClient() {}
 
@@ -47,6 +182,8 @@ public:
    * @brief key-value批量写入方法
    * @param [in]  keys
    * @param [in]  values
+   * @param [in]  ttl，过期时间（单位s）：<=0，不过期；>0，MSET不支持过期时间，
+   *              每个key pipeline一条SET key value EX ttl
    * @return int
    *  0：命令执行成功
    *  -1：redis-server执行命令失败，
@@ -55,7 +192,7 @@ public:
    *  -3：批量操作存在个别失败的情况
    **/
   virtual int mset(const std::vector<std::string> &keys,
-      const std::vector<std::string> &values) = 0;
+      const std::vector<std::string> &values, long ttl = 0) = 0;
 
   /**
    * @brief key-value单条读取方法
@@ -70,6 +207,25 @@ public:
    **/
   int get(const std::string &key, std::string &value);
 
+  /**
+   * @brief key-value单条读取方法，value不拷贝，直接由handle持有
+   * @param [in]  key
+   * @param [out] handle，命令执行成功时持有reply，否则为空
+   * @return int，与get(key, value)一致
+   **/
+  int get(const std::string &key, RedisReplyHandle &handle);
+
+  /**
+   * @brief key-value单条读取方法，value拷贝到调用方提供的buf中
+   * @param [in]  key
+   * @param [out] buf
+   * @param [in]  buf_len
+   * @param [out] value_len，value的实际长度
+   * @return int，与get(key, value)一致，另外
+   *  -4：buf_len小于value的长度，value_len为需要的长度
+   **/
+  int get(const std::string &key, char *buf, size_t buf_len, size_t &value_len);
+
   /**
    * @brief key-value批量读取方法，key不存在or读取失败的value设置为""
    * @param [in]  keys
@@ -84,10 +240,94 @@ public:
   virtual int mget(const std::vector<std::string> &keys,
       std::vector<std::string> &values) = 0;
 
-  
-  virtual int hmset(const std::string &key, const std::string &h_key, const std::string &h_value){}
-  virtual int hget(const std::string &key, const std::string &h_key, std::string &h_value){}
-  
+  /**
+   * @brief 子类没有实现时返回-1
+   **/
+  virtual int hmset(const std::string &key, const std::string &h_key, const std::string &h_value) {
+    return -1;
+  }
+
+  virtual int hget(const std::string &key, const std::string &h_key, std::string &h_value) {
+    return -1;
+  }
+
+  /**
+   * @brief hash单key多field读取方法，field不存在or读取失败的value设置为""
+   * @param [in]  key
+   * @param [in]  fields
+   * @param [out] values，调整为fields.size()个元素，按fields的顺序填充，复用已有的string
+   * @return int
+   *  0：命令执行成功
+   *  -1：redis-server执行命令失败
+   *  -2：输入的key/fields问题
+   **/
+  virtual int hmget(const std::string &key, const std::vector<std::string> &fields,
+      std::vector<std::string> &values) = 0;
+
+  /**
+   * @brief hash多key多field读取方法，每个key读取相同的fields，pipeline一次发出
+   * @param [in]  keys
+   * @param [in]  fields，个数不超过MAX_ARGV_SIZE - 2
+   * @param [out] values，调整为keys.size()个元素，values[i]与hmget(keys[i], fields, values[i])一致
+   * @return int
+   *  0：命令执行成功
+   *  -1：redis-server执行命令失败
+   *  -2：输入的keys/fields问题
+   *  -3：批量操作存在个别失败的情况（失败的key的values全部为""）
+   **/
+  virtual int hmget(const std::vector<std::string> &keys, const std::vector<std::string> &fields,
+      std::vector<std::vector<std::string> > &values) = 0;
+
+  /**
+   * @brief 读取hash的所有field和value
+   * @param [in]  key
+   * @param [out] fields
+   * @param [out] values，与fields一一对应，key不存在时两者都为空
+   * @return int
+   *  0：命令执行成功
+   *  -1：redis-server执行命令失败
+   *  -2：输入的key问题
+   **/
+  virtual int hgetall(const std::string &key, std::vector<std::string> &fields,
+      std::vector<std::string> &values) = 0;
+
+  /**
+   * @brief 执行Lua脚本，先EVALSHA，脚本不在server的缓存中时改用EVAL
+   * @param [in]  script
+   * @param [in]  keys，集群模式下至少一个，且都在同一个slot
+   * @param [in]  args
+   * @param [out] result，脚本的返回值；脚本执行出错时为错误信息（REDIS_REPLY_ERROR）
+   * @return int
+   *  0：命令执行成功
+   *  -1：redis-server执行命令失败或者脚本执行出错
+   *  -2：输入的keys问题
+   **/
+  virtual int eval(const RedisScript &script, const std::vector<std::string> &keys,
+      const std::vector<std::string> &args, RedisReplyHandle &result) = 0;
+
+  /**
+   * @brief 批量执行同一个Lua脚本，所有EVALSHA pipeline一次发出，
+   *        返回NOSCRIPT的调用再用EVAL pipeline一次
+   * @param [in]  script
+   * @param [in]  calls，每次调用的keys和args
+   * @param [out] results，与calls一一对应，读取失败的为NULL
+   * @return int
+   *  0：命令执行成功
+   *  -1：与redis-server的连接失败
+   *  -2：输入的calls问题
+   *  -3：个别调用失败（对应的reply为NULL或者REDIS_REPLY_ERROR）
+   **/
+  virtual int eval(const RedisScript &script, const std::vector<RedisScriptCall> &calls,
+      RedisReplyList &results) = 0;
+
+  /**
+   * @brief 预先把脚本加载到server的缓存中（SCRIPT LOAD），不调用时第一次执行会多一次往返
+   * @return int
+   *  0：命令执行成功
+   *  -1：redis-server执行命令失败
+   **/
+  virtual int load_script(const RedisScript &script) = 0;
+
   /**
    * @brief 获取操作失败的信息
    * @param [in]  keys
@@ -98,6 +338,58 @@ public:
     return NULL;
   }
 
+  /**
+   * @brief 检查连接是否可用
+   * @return bool
+   **/
+  virtual bool ping() {
+    return get_error_info() == NULL;
+  }
+
+  /**
+   * @brief 设置value的压缩层，set/mset/hset/hmset写入前压缩，get/mget/hget/hmget/hgetall读取后解压；
+   *        解压失败时单条读取返回-1，批量读取该value设置为""并返回-3；
+   *        get(key, handle)和mget(keys, handle)不拷贝数据，返回压缩后的原始数据，需要调用方解压
+   * @param [in]  codec，生命周期长于client，NULL：不压缩
+   **/
+  void set_codec(RedisCodec *codec) {
+    _codec = codec;
+  }
+
+protected:
+
+  /**
+   * @brief 设置了codec时把value压缩到buf中并返回buf，否则直接返回value
+   **/
+  const std::string& _encode(const std::string &value, std::string &buf) {
+    if (_codec == NULL) {
+      return value;
+    }
+    _codec->encode(value, buf);
+    return buf;
+  }
+
+  const std::vector<std::string>& _encode(const std::vector<std::string> &values,
+      std::vector<std::string> &buf);
+
+  /**
+   * @brief 设置了codec时原地解压value
+   * @return bool
+   **/
+  bool _decode(std::string &value) {
+    return _codec == NULL || _codec->decode(value);
+  }
+
+  bool _decode(const char *data, size_t len, std::vector<unsigned char> &vec);
+
+  /**
+   * @brief 解压values中从下标begin开始的value，解压失败的设置为""
+   * @return int，解压失败的个数
+   **/
+  int _decode(std::vector<std::string> &values, size_t begin = 0);
+
+  RedisCodec *_codec;
+
 private:
 
   /**
@@ -125,7 +417,7 @@ class RedisNonClusterClient : public RedisClient {
 
 public:
 
-  RedisNonClusterClient() : _redis_context(NULL) {}
+  RedisNonClusterClient() : _redis_context(NULL), _timeout(0), _breaker(NULL) {}
 
   virtual ~RedisNonClusterClient() {
     if (_redis_context != NULL) {
@@ -144,18 +436,64 @@ public:
   bool init(const std::string &server_info, const std::string &password = "", long timeout = 0);
 
   /**
-   * @brief 实现父类虚函数
+   * @brief 实现父类虚函数，参数超过MAX_ARGV_SIZE时拆分为多条MSET pipeline发送，
+   *        此时整体不再是原子操作
    **/
-  int mset(const std::vector<std::string> &keys, const std::vector<std::string> &values);
+  int mset(const std::vector<std::string> &keys, const std::vector<std::string> &values,
+      long ttl = 0);
 
   /**
-   * @brief 实现父类虚函数
+   * @brief 实现父类虚函数，参数超过MAX_ARGV_SIZE时拆分为多条MGET pipeline发送
    **/
   int mget(const std::vector<std::string> &keys, std::vector<std::string> &values);
 
+  /**
+   * @brief key-value批量读取方法，value不拷贝，通过handle.data(i)/handle.size(i)访问
+   * @return int
+   *  0：命令执行成功
+   *  -1：redis-server执行命令失败
+   *  -2：输入的key问题
+   **/
+  int mget(const std::vector<std::string> &keys, RedisReplyHandle &handle);
+
   int hset(const std::string &key, const std::string &h_key, const std::string &h_value);
   
   int hget(const std::string &key, const std::string &h_key, std::string &h_value); 
+
+  /**
+   * @brief 实现父类虚函数，fields超过MAX_ARGV_SIZE时拆分为多条HMGET pipeline发送
+   **/
+  int hmget(const std::string &key, const std::vector<std::string> &fields,
+      std::vector<std::string> &values);
+
+  /**
+   * @brief 实现父类虚函数
+   **/
+  int hmget(const std::vector<std::string> &keys, const std::vector<std::string> &fields,
+      std::vector<std::vector<std::string> > &values);
+
+  /**
+   * @brief 实现父类虚函数
+   **/
+  int hgetall(const std::string &key, std::vector<std::string> &fields,
+      std::vector<std::string> &values);
+
+  /**
+   * @brief 实现父类虚函数
+   **/
+  int eval(const RedisScript &script, const std::vector<std::string> &keys,
+      const std::vector<std::string> &args, RedisReplyHandle &result);
+
+  /**
+   * @brief 实现父类虚函数
+   **/
+  int eval(const RedisScript &script, const std::vector<RedisScriptCall> &calls,
+      RedisReplyList &results);
+
+  /**
+   * @brief 实现父类虚函数
+   **/
+  int load_script(const RedisScript &script);
   
   int hmset(
     const std::string &key,
@@ -163,9 +501,21 @@ public:
     const std::vector<std::string> &values
   );
 
+  using RedisClient::get;
+
   int get(const std::string &key, std::vector<unsigned char> &vec);
   
   int del(const std::vector<std::string> &keys);
+  /**
+   * @brief 设置熔断器，多个client可以共享一个熔断器；
+   *        设置后请求失败不再每次在请求线程中重连，熔断期间直接返回-1
+   * @param [in]  breaker，生命周期长于client，需要调用init启动探测线程，否则不会熔断；
+   *               NULL：不使用熔断器
+   **/
+  void set_circuit_breaker(RedisCircuitBreaker *breaker) {
+    _breaker = breaker;
+  }
+
   /**
    * @brief 返回redis db中key的数量
    * @return int
@@ -210,21 +560,86 @@ public:
     return NULL;
   }
 
+  /**
+   * @brief 实现父类虚函数，发送PING检查连接
+   **/
+  virtual bool ping() {
+    if (_redis_context == NULL) {
+      return false;
+    }
+    redisReply *reply = (redisReply *)redisCommand(_redis_context, "PING");
+    bool ret = false;
+    if (reply != NULL && reply->type == REDIS_REPLY_STATUS && strcmp(reply->str, "PONG") == 0) {
+      ret = true;
+    }
+    freeReplyObject(reply);
+    return ret;
+  }
+
 private:
 
+  /**
+   * @brief 请求失败后重新建立连接，设置了熔断器时熔断期间不重连
+   **/
+  bool _reconnect();
+
+  /**
+   * @brief 发送命令前的检查：熔断期间返回false，连接不可用时先重连
+   **/
+  bool _available();
+
   int _hmset(
     const std::string &key,
     const std::vector<std::string> &fields,
     const std::vector<std::string> &values
   );
 
+  /**
+   * @brief 把items（和values）拆分为参数个数不超过MAX_ARGV_SIZE的多条cmd命令，
+   *        pipeline一次发出后依次读取reply
+   * @param [in]  cmd，MSET/MGET/DEL/HMSET
+   * @param [in]  key，HMSET的key，其他命令为NULL
+   * @param [in]  items，keys或者fields
+   * @param [in]  values，MSET/HMSET的values，其他命令为NULL
+   * @param [out] replies，每条命令的reply，读取失败为NULL，由调用方释放
+   * @param [in]  arena，不为NULL时reply构造在arena中，调用方用完后reset arena，不能freeReplyObject
+   * @return int
+   *  0：所有命令都读到了reply
+   *  -1：与redis-server的连接失败
+   **/
+  int _pipeline_chunks(const char *cmd, const std::string *key,
+      const std::vector<std::string> &items, const std::vector<std::string> *values,
+      std::vector<redisReply *> &replies, RedisReplyArena *arena = NULL);
+
+  /**
+   * @brief 每个key pipeline一条SET key value EX ttl，返回值与_pipeline_chunks一致
+   **/
+  int _pipeline_setex(const std::vector<std::string> &keys,
+      const std::vector<std::string> &values, long ttl, std::vector<redisReply *> &replies);
+
   void* _real_set_one(const std::string &key, const std::string &value) {
-    return redisCommand(_redis_context, "SET %b %b",
+    if (!_available()) {
+      return NULL;
+    }
+    void *reply = redisCommand(_redis_context, "SET %b %b",
         key.c_str(), key.length(), value.c_str(), value.length());
+    if (reply == NULL) {
+      //连接出错，重建连接供下一次请求使用
+      _reconnect();
+    }
+    return reply;
   }
 
   void* _real_get_one(const std::string &key) {
-    return redisCommand(_redis_context, "GET %b", key.c_str(), key.length());
+    if (!_available()) {
+      return NULL;
+    }
+    void *reply = redisCommand(_redis_context, "GET %b", key.c_str(), key.length());
+    if (reply == NULL) {
+      //连接出错，重建连接供下一次请求使用
+      _reconnect();
+    }
+    return reply;
   }
 
   //不允许拷贝和赋值操作
@@ -236,19 +651,30 @@ private:
   redisContext *_redis_context;
   std::string _server_info;
   std::string _password;
+  long _timeout;
+  RedisCircuitBreaker *_breaker;
+
+  //命令参数的缓冲区，在多次调用之间复用
+  std::vector<const char *> _argv;
+  std::vector<size_t> _argv_len;
+
+  //批量读取的reply构造在arena中
+  RedisReplyArena _arena;
 };
 
 class RedisClusterClient : public RedisClient {
 
 public:
 
-  RedisClusterClient() : _redis_context(NULL) {}
+  RedisClusterClient()
+    : _redis_context(NULL), _timeout(0), _breaker(NULL), _replica_reader(NULL) {}
 
   virtual ~RedisClusterClient() {
     if (_redis_context != NULL) {
       redisClusterFree(_redis_context);
       _redis_context = NULL;
     }
+    delete _replica_reader;
   }
 
   /**
@@ -263,7 +689,8 @@ public:
   /**
    * @brief 实现父类虚函数
    **/
-  int mset(const std::vector<std::string> &keys, const std::vector<std::string> &values);
+  int mset(const std::vector<std::string> &keys, const std::vector<std::string> &values,
+      long ttl = 0);
 
   /**
    * @brief 实现父类虚函数
@@ -271,8 +698,76 @@ public:
   int mget(const std::vector<std::string> &keys, std::vector<std::string> &values);
 
   int hset(const std::string &key, const std::string &h_key, const std::string &h_value);
+
+  /**
+   * @brief 实现父类虚函数
+   **/
+  int hmget(const std::string &key, const std::vector<std::string> &fields,
+      std::vector<std::string> &values);
+
+  /**
+   * @brief 实现父类虚函数，按hash slot分组pipeline，各节点并行执行，失败的key重试
+   **/
+  int hmget(const std::vector<std::string> &keys, const std::vector<std::string> &fields,
+      std::vector<std::vector<std::string> > &values);
+
+  /**
+   * @brief 实现父类虚函数
+   **/
+  int hgetall(const std::string &key, std::vector<std::string> &fields,
+      std::vector<std::string> &values);
+
+  /**
+   * @brief 实现父类虚函数
+   **/
+  int eval(const RedisScript &script, const std::vector<std::string> &keys,
+      const std::vector<std::string> &args, RedisReplyHandle &result);
+
+  /**
+   * @brief 实现父类虚函数，按第一个key的slot路由，各节点并行执行
+   **/
+  int eval(const RedisScript &script, const std::vector<RedisScriptCall> &calls,
+      RedisReplyList &results);
+
+  /**
+   * @brief 实现父类虚函数，加载到当前slot表中的所有master，没有连接的节点先建立连接；
+   *        之后新加入或者故障切换产生的master依赖eval的NOSCRIPT回退加载
+   * @return int，0：全部加载成功，-1：个别节点失败或者没有节点加载成功
+   **/
+  int load_script(const RedisScript &script);
   
+  using RedisClient::get;
+
   int get(const std::string &key, std::vector<unsigned char> &vec);
+
+  /**
+   * @brief 设置熔断器，多个client可以共享一个熔断器；
+   *        设置后请求失败不再每次在请求线程中重连，熔断期间直接返回-1
+   * @param [in]  breaker，生命周期长于client，需要调用init启动探测线程，否则不会熔断；
+   *               NULL：不使用熔断器
+   **/
+  void set_circuit_breaker(RedisCircuitBreaker *breaker) {
+    _breaker = breaker;
+  }
+
+  /**
+   * @brief 开启从节点读取，在init之后调用：单key的get优先读取EWMA最小的从节点，
+   *        从节点不可用、超时或者返回错误时回退到master；其他命令仍然只访问master
+   * @param [in]  hedge，超过hedge延迟（GET耗时的p95）没有返回时向另一个节点再发送一次
+   * @param [in]  min_hedge_delay，hedge延迟的下限（单位us）
+   * @param [in]  max_hedge_delay，hedge延迟的上限（单位us）
+   * @return bool，false：读取集群拓扑失败，不开启
+   **/
+  bool enable_replica_reads(bool hedge = true, long min_hedge_delay = 500,
+      long max_hedge_delay = 20000);
+
+  /**
+   * @brief 从节点读取的统计，没有开启时为NULL
+   **/
+  const RedisReplicaReader* replica_reader() const {
+    return _replica_reader;
+  }
+
   /**
    * @brief 实现父类虚函数
    **/
@@ -283,17 +778,79 @@ public:
     return NULL;
   }
 
+  /**
+   * @brief 实现父类虚函数，集群路由表由hiredis-vip维护，只检查context状态
+   **/
+  virtual bool ping() {
+    return _redis_context != NULL && !_redis_context->err;
+  }
+
 private:
 
   void* _real_set_one(const std::string &key, const std::string &value) {
+    if (!_available()) {
+      return NULL;
+    }
     return redisClusterCommand(_redis_context, "set %b %b",
       key.c_str(), key.length(), value.c_str(), value.length());
   }
 
   void* _real_get_one(const std::string &key) {
+    if (!_available()) {
+      return NULL;
+    }
+    if (_replica_reader != NULL) {
+      //从节点读取失败时回退到master
+      redisReply *reply = _replica_reader->get(key);
+      if (reply != NULL) {
+        return reply;
+      }
+    }
     return redisClusterCommand(_redis_context, "get %b", key.c_str(), key.length());
   }
 
+  /**
+   * @brief 请求失败后重新发现集群，设置了熔断器时熔断期间不重连
+   **/
+  bool _reconnect();
+
+  /**
+   * @brief 发送命令前的检查：熔断期间返回false，连接不可用时先重连
+   **/
+  bool _available();
+
+  /**
+   * @brief 对keys中下标为indexes的key按hash slot分组，每组pipeline一条MGET/MSET
+   * @param [out] failed_keys，执行失败的key的下标
+   **/
+  void _mget_by_slot(const std::vector<std::string> &keys, const std::vector<int> &indexes,
+      std::string *values, std::vector<int> &failed_keys);
+
+  /**
+   * @brief ttl>0时每个key一条SET key value EX ttl
+   **/
+  void _mset_by_slot(const std::vector<std::string> &keys, const std::vector<std::string> &values,
+      const std::vector<int> &indexes, long ttl, std::vector<int> &failed_keys);
+
+  void _setex_by_slot(const std::vector<std::string> &keys,
+      const std::vector<std::string> &values,
+      const std::vector<std::pair<unsigned int, int> > &groups,
+      const std::vector<size_t> &starts, long ttl, std::vector<int> &failed_keys);
+
+  /**
+   * @brief 对keys中下标为indexes的key按hash slot分组，每个key pipeline一条HMGET
+   * @param [out] bytes，累加读到的value字节数
+   **/
+  void _hmget_by_slot(const std::vector<std::string> &keys, const std::vector<std::string> &fields,
+      const std::vector<int> &indexes, std::vector<std::vector<std::string> > &values,
+      std::vector<int> &failed_keys, size_t &bytes);
+
+  /**
+   * @brief 把groups涉及的各节点已经pipeline的命令一次写出，使各节点并行执行
+   **/
+  void _flush_nodes(const std::vector<std::pair<unsigned int, int> > &groups,
+      const std::vector<size_t> &starts);
+
   //不允许拷贝和赋值操作
   RedisClusterClient(const RedisClusterClient &other);
   RedisClusterClient& operator= (const RedisClusterClient &other);
@@ -302,6 +859,10 @@ private:
 
   redisClusterContext *_redis_context;
   std::string _server_info;
+  std::string _password;
+  long _timeout;
+  RedisCircuitBreaker *_breaker;
+  RedisReplicaReader *_replica_reader;
 };
 
 #endif
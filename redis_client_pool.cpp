@@ -0,0 +1,257 @@
+
+#include "Logger.h"
+#include "redis_client_pool.h"
+#include <sys/time.h>
+#include <unistd.h>
+#include <errno.h>
+
+RedisClientPool::RedisClientPool(bool cluster, int max_size,
+    int idle_timeout, int validate_interval)
+  : _cluster(cluster), _max_size(max_size > 0 ? max_size : 1),
+    _idle_timeout(idle_timeout), _validate_interval(validate_interval),
+    _timeout(0), _size(0), _waiters(0), _running(false) {
+  Slot slot;
+  slot.client = NULL;
+  slot.busy = 0;
+  slot.last_used = 0;
+  _slots.resize(_max_size, slot);
+  pthread_key_create(&_affinity, NULL);
+  pthread_mutex_init(&_mutex, NULL);
+  pthread_cond_init(&_cond, NULL);
+}
+
+RedisClientPool::~RedisClientPool() {
+  if (_running) {
+    _running = false;
+    pthread_join(_evict_thread, NULL);
+  }
+  for (size_t i = 0; i < _slots.size(); ++i) {
+    delete _slots[i].client;
+    _slots[i].client = NULL;
+  }
+  pthread_key_delete(_affinity);
+  pthread_mutex_destroy(&_mutex);
+  pthread_cond_destroy(&_cond);
+}
+
+bool RedisClientPool::init(const std::string &server_info, const std::string &password,
+    long timeout, int min_size) {
+  _server_info = server_info;
+  _password = password;
+  _timeout = timeout;
+
+  if (min_size > _max_size) {
+    min_size = _max_size;
+  }
+  for (int i = 0; i < min_size; ++i) {
+    if (_slots[i].client != NULL) {
+      continue;
+    }
+    RedisClient *client = _create();
+    if (client == NULL) {
+      return false;
+    }
+    _slots[i].client = client;
+    _slots[i].last_used = _now_sec();
+    __sync_fetch_and_add(&_size, 1);
+  }
+
+  if (!_running && _idle_timeout > 0) {
+    _running = true;
+    if (pthread_create(&_evict_thread, NULL, RedisClientPool::_evict, this) != 0) {
+      _running = false;
+    }
+  }
+  return true;
+}
+
+RedisClient* RedisClientPool::borrow(long wait_timeout) {
+  //优先使用当前线程上一次使用的连接
+  long last = (long)pthread_getspecific(_affinity);
+  if (last > 0 && _try_take(last - 1)) {
+    RedisClient *client = _take(last - 1);
+    if (client != NULL) {
+      return client;
+    }
+  }
+
+  struct timespec deadline;
+  if (wait_timeout > 0) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    long nsec = now.tv_usec * 1000 + (wait_timeout % 1000) * 1000000;
+    deadline.tv_sec = now.tv_sec + wait_timeout / 1000 + nsec / 1000000000;
+    deadline.tv_nsec = nsec % 1000000000;
+  }
+
+  for (;;) {
+    //已经建立的空闲连接
+    for (int i = 0; i < _max_size; ++i) {
+      if (_slots[i].client != NULL && _try_take(i)) {
+        if (_slots[i].client == NULL) {
+          //被淘汰线程抢先销毁
+          __sync_lock_release(&_slots[i].busy);
+          continue;
+        }
+        RedisClient *client = _take(i);
+        if (client != NULL) {
+          return client;
+        }
+      }
+    }
+
+    //空的slot，新建连接
+    for (int i = 0; i < _max_size; ++i) {
+      if (_slots[i].client == NULL && _try_take(i)) {
+        if (_slots[i].client != NULL) {
+          //其他线程刚刚在这个slot上建立了连接
+          RedisClient *client = _take(i);
+          if (client != NULL) {
+            return client;
+          }
+          continue;
+        }
+        RedisClient *client = _create();
+        if (client == NULL) {
+          __sync_lock_release(&_slots[i].busy);
+          LOG_ERROR(debug_log, "redis pool: connect %s failed", _server_info.c_str());
+          return NULL;
+        }
+        _slots[i].client = client;
+        _slots[i].last_used = _now_sec();
+        __sync_fetch_and_add(&_size, 1);
+        pthread_setspecific(_affinity, (void *)(long)(i + 1));
+        return client;
+      }
+    }
+
+    //连接池已满，等待归还
+    pthread_mutex_lock(&_mutex);
+    __sync_fetch_and_add(&_waiters, 1);
+    //登记等待后再检查一次，避免错过在扫描之后归还的连接
+    bool available = false;
+    for (int i = 0; i < _max_size && !available; ++i) {
+      available = (_slots[i].busy == 0);
+    }
+    int ret = 0;
+    if (available) {
+      ret = 0;
+    } else if (wait_timeout > 0) {
+      ret = pthread_cond_timedwait(&_cond, &_mutex, &deadline);
+    } else {
+      pthread_cond_wait(&_cond, &_mutex);
+    }
+    __sync_fetch_and_sub(&_waiters, 1);
+    pthread_mutex_unlock(&_mutex);
+    if (ret == ETIMEDOUT) {
+      return NULL;
+    }
+  }
+}
+
+void RedisClientPool::give_back(RedisClient *client, bool broken) {
+  if (client == NULL) {
+    return;
+  }
+  for (int i = 0; i < _max_size; ++i) {
+    if (_slots[i].client != client) {
+      continue;
+    }
+    if (broken) {
+      _slots[i].client = NULL;
+      __sync_fetch_and_sub(&_size, 1);
+      delete client;
+    } else {
+      _slots[i].last_used = _now_sec();
+    }
+    __sync_lock_release(&_slots[i].busy);
+    __sync_synchronize();
+    if (_waiters > 0) {
+      pthread_mutex_lock(&_mutex);
+      pthread_cond_signal(&_cond);
+      pthread_mutex_unlock(&_mutex);
+    }
+    return;
+  }
+  //不属于该连接池
+  delete client;
+}
+
+RedisClient* RedisClientPool::_create() {
+  RedisClient *client = NULL;
+  if (_cluster) {
+    client = new RedisClusterClient();
+  } else {
+    client = new RedisNonClusterClient();
+  }
+  if (!client->init(_server_info, _password, _timeout)) {
+    delete client;
+    return NULL;
+  }
+  return client;
+}
+
+bool RedisClientPool::_try_take(int index) {
+  if (index < 0 || index >= _max_size || _slots[index].busy) {
+    return false;
+  }
+  return __sync_bool_compare_and_swap(&_slots[index].busy, 0, 1);
+}
+
+RedisClient* RedisClientPool::_take(int index) {
+  Slot &slot = _slots[index];
+  RedisClient *client = slot.client;
+  if (client == NULL) {
+    __sync_lock_release(&slot.busy);
+    return NULL;
+  }
+
+  //空闲较久的连接先检查是否可用，不可用则重新建立
+  if (_validate_interval > 0 && _now_sec() - slot.last_used > _validate_interval
+      && !client->ping()) {
+    LOG_ERROR(debug_log, "redis pool: connection %s is broken, then reconnect", _server_info.c_str());
+    if (!client->init(_server_info, _password, _timeout)) {
+      slot.client = NULL;
+      __sync_fetch_and_sub(&_size, 1);
+      delete client;
+      __sync_lock_release(&slot.busy);
+      return NULL;
+    }
+  }
+  pthread_setspecific(_affinity, (void *)(long)(index + 1));
+  return client;
+}
+
+void RedisClientPool::_evict_idle() {
+  long now = _now_sec();
+  for (int i = 0; i < _max_size; ++i) {
+    if (_slots[i].client == NULL || now - _slots[i].last_used <= _idle_timeout) {
+      continue;
+    }
+    if (!_try_take(i)) {
+      continue;
+    }
+    RedisClient *client = _slots[i].client;
+    if (client != NULL && now - _slots[i].last_used > _idle_timeout) {
+      _slots[i].client = NULL;
+      __sync_fetch_and_sub(&_size, 1);
+      delete client;
+    }
+    __sync_lock_release(&_slots[i].busy);
+  }
+}
+
+void* RedisClientPool::_evict(void *param) {
+  RedisClientPool *pool = (RedisClientPool *)param;
+  while (pool->_running) {
+    pool->_evict_idle();
+    sleep(1);
+  }
+  return NULL;
+}
+
+long RedisClientPool::_now_sec() {
+  struct timeval t;
+  gettimeofday(&t, NULL);
+  return t.tv_sec;
+}
@@ -0,0 +1,156 @@
+
+#ifndef AFANTI_REDIS_CLIENT_POOL_H_
+#define AFANTI_REDIS_CLIENT_POOL_H_
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "redis_client.h"
+
+/**
+ * RedisClientPool
+ * RedisClient的连接池，连接数随并发数而不是线程数增长。
+ * 每个线程优先复用上一次使用的连接（无锁），否则无锁扫描空闲连接，
+ * 都没有时创建新连接，达到上限后等待其他线程归还。
+ * 后台线程定期淘汰长时间空闲的连接。
+ * @note 线程安全；取出的RedisClient同一时刻只被一个线程使用
+ **/
+class RedisClientPool {
+
+public:
+
+  /**
+   * @param [in]  cluster，true：RedisClusterClient，false：RedisNonClusterClient
+   * @param [in]  max_size，最大连接数
+   * @param [in]  idle_timeout，空闲超过该时间（单位s）的连接被淘汰：<=0，不淘汰
+   * @param [in]  validate_interval，空闲超过该时间（单位s）的连接取出前先检查是否可用：<=0，不检查
+   **/
+  RedisClientPool(bool cluster, int max_size,
+      int idle_timeout = 300, int validate_interval = 30);
+
+  ~RedisClientPool();
+
+  /**
+   * @brief 初始化方法，参数与RedisClient::init一致，预先建立min_size个连接
+   * @return bool
+   **/
+  bool init(const std::string &server_info, const std::string &password = "",
+      long timeout = 0, int min_size = 1);
+
+  /**
+   * @brief 取出一个连接
+   * @param [in]  wait_timeout，连接池已满时的等待时间（单位ms）：<=0，一直等待
+   * @return RedisClient*，NULL：等待超时或者无法建立连接
+   **/
+  RedisClient* borrow(long wait_timeout = 0);
+
+  /**
+   * @brief 归还连接
+   * @param [in]  client
+   * @param [in]  broken，true：连接已经不可用，直接销毁
+   **/
+  void give_back(RedisClient *client, bool broken = false);
+
+  /**
+   * @brief 当前已经建立的连接数
+   **/
+  int size() {
+    return _size;
+  }
+
+private:
+
+  struct Slot {
+    RedisClient *client;
+    //0：空闲，1：被占用（包括正在创建、淘汰）
+    volatile int busy;
+    volatile long last_used;
+  };
+
+  RedisClient* _create();
+
+  bool _try_take(int index);
+
+  RedisClient* _take(int index);
+
+  void _evict_idle();
+
+  static void* _evict(void *param);
+
+  static long _now_sec();
+
+  //不允许拷贝和赋值操作
+  RedisClientPool(const RedisClientPool &other);
+  RedisClientPool& operator= (const RedisClientPool &other);
+
+private:
+
+  bool _cluster;
+  int _max_size;
+  int _idle_timeout;
+  int _validate_interval;
+  std::string _server_info;
+  std::string _password;
+  long _timeout;
+
+  std::vector<Slot> _slots;
+  volatile int _size;
+
+  //记录每个线程上一次使用的slot下标+1
+  pthread_key_t _affinity;
+
+  //连接池已满时等待归还
+  pthread_mutex_t _mutex;
+  pthread_cond_t _cond;
+  volatile int _waiters;
+
+  pthread_t _evict_thread;
+  volatile bool _running;
+};
+
+/**
+ * RedisClientGuard
+ * 作用域内持有连接池中的一个连接，析构时归还
+ **/
+class RedisClientGuard {
+
+public:
+
+  RedisClientGuard(RedisClientPool *pool, long wait_timeout = 0)
+    : _pool(pool), _broken(false) {
+    _client = _pool->borrow(wait_timeout);
+  }
+
+  ~RedisClientGuard() {
+    if (_client != NULL) {
+      _pool->give_back(_client, _broken);
+    }
+  }
+
+  RedisClient* get() {
+    return _client;
+  }
+
+  RedisClient* operator-> () {
+    return _client;
+  }
+
+  /**
+   * @brief 标记连接不可用，归还时销毁
+   **/
+  void set_broken() {
+    _broken = true;
+  }
+
+private:
+
+  RedisClientPool *_pool;
+  RedisClient *_client;
+  bool _broken;
+
+  //不允许拷贝和赋值操作
+  RedisClientGuard(const RedisClientGuard &other);
+  RedisClientGuard& operator= (const RedisClientGuard &other);
+};
+
+#endif
@@ -0,0 +1,230 @@
+
+#include "Logger.h"
+#include "redis_codec.h"
+#include <cstring>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zdict.h>
+#endif
+
+//压缩头的magic，原始value恰好以此开头的概率很低
+static const char CODEC_MAGIC_0 = (char)0xFE;
+static const char CODEC_MAGIC_1 = 'Z';
+//redis单个value的上限，避免损坏的头导致分配过大的内存
+static const size_t MAX_RAW_SIZE = 512 * 1024 * 1024;
+
+static bool has_magic(const char *data, size_t len) {
+  return len >= 2 && data[0] == CODEC_MAGIC_0 && data[1] == CODEC_MAGIC_1;
+}
+
+RedisCodecDict::RedisCodecDict() {
+#ifdef HAVE_ZSTD
+  _cdict = NULL;
+  _ddict = NULL;
+#endif
+}
+
+RedisCodecDict::~RedisCodecDict() {
+#ifdef HAVE_ZSTD
+  ZSTD_freeCDict(_cdict);
+  ZSTD_freeDDict(_ddict);
+#endif
+}
+
+bool RedisCodecDict::load(const std::string &dict, int level) {
+#ifdef HAVE_ZSTD
+  ZSTD_freeCDict(_cdict);
+  ZSTD_freeDDict(_ddict);
+  _cdict = ZSTD_createCDict(dict.data(), dict.size(), level);
+  _ddict = ZSTD_createDDict(dict.data(), dict.size());
+  return _cdict != NULL && _ddict != NULL;
+#else
+  LOG_ERROR(debug_log, "redis codec: zstd is not supported, compile with HAVE_ZSTD");
+  return false;
+#endif
+}
+
+bool RedisCodecDict::train(const std::vector<std::string> &samples, size_t dict_size,
+    std::string &dict) {
+#ifdef HAVE_ZSTD
+  std::string buffer;
+  std::vector<size_t> sizes;
+  for (size_t i = 0; i < samples.size(); ++i) {
+    buffer.append(samples[i]);
+    sizes.push_back(samples[i].size());
+  }
+  if (sizes.empty() || dict_size == 0) {
+    return false;
+  }
+  dict.resize(dict_size);
+  size_t ret = ZDICT_trainFromBuffer(&dict[0], dict_size, buffer.data(), &sizes[0], sizes.size());
+  if (ZDICT_isError(ret)) {
+    LOG_ERROR(debug_log, "redis codec: train dictionary failed, samples=%d", (int)sizes.size());
+    dict.clear();
+    return false;
+  }
+  dict.resize(ret);
+  return true;
+#else
+  LOG_ERROR(debug_log, "redis codec: zstd is not supported, compile with HAVE_ZSTD");
+  return false;
+#endif
+}
+
+RedisCodec::RedisCodec(RedisCodecType type, size_t threshold, int level,
+    const RedisCodecDict *dict)
+  : _type(type), _threshold(threshold), _level(level), _dict(dict) {
+#ifdef HAVE_ZSTD
+  _cctx = ZSTD_createCCtx();
+  _dctx = ZSTD_createDCtx();
+#endif
+  if (_type == REDIS_CODEC_ZSTD_DICT && _dict == NULL) {
+    LOG_ERROR(debug_log, "redis codec: zstd dictionary is not set, values are not compressed");
+    _type = REDIS_CODEC_NONE;
+  }
+}
+
+RedisCodec::~RedisCodec() {
+#ifdef HAVE_ZSTD
+  ZSTD_freeCCtx(_cctx);
+  ZSTD_freeDCtx(_dctx);
+#endif
+}
+
+void RedisCodec::_write_header(std::string &out, RedisCodecType type, size_t raw_len) {
+  out.resize(HEADER_SIZE);
+  out[0] = CODEC_MAGIC_0;
+  out[1] = CODEC_MAGIC_1;
+  out[2] = (char)type;
+  for (int i = 0; i < 4; ++i) {
+    out[3 + i] = (char)((raw_len >> (8 * i)) & 0xFF);
+  }
+}
+
+bool RedisCodec::_compress(const std::string &value, std::string &out) {
+  if (value.size() > MAX_RAW_SIZE) {
+    return false;
+  }
+  _write_header(out, _type, value.size());
+  size_t len = 0;
+  switch (_type) {
+#ifdef HAVE_LZ4
+    case REDIS_CODEC_LZ4: {
+      int bound = LZ4_compressBound(value.size());
+      out.resize(HEADER_SIZE + bound);
+      int ret = LZ4_compress_default(value.data(), &out[HEADER_SIZE], value.size(), bound);
+      if (ret <= 0) {
+        return false;
+      }
+      len = ret;
+      break;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case REDIS_CODEC_ZSTD:
+    case REDIS_CODEC_ZSTD_DICT: {
+      size_t bound = ZSTD_compressBound(value.size());
+      out.resize(HEADER_SIZE + bound);
+      size_t ret = 0;
+      if (_type == REDIS_CODEC_ZSTD_DICT) {
+        ret = ZSTD_compress_usingCDict(_cctx, &out[HEADER_SIZE], bound,
+            value.data(), value.size(), _dict->_cdict);
+      } else {
+        ret = ZSTD_compressCCtx(_cctx, &out[HEADER_SIZE], bound,
+            value.data(), value.size(), _level);
+      }
+      if (ZSTD_isError(ret)) {
+        return false;
+      }
+      len = ret;
+      break;
+    }
+#endif
+    default:
+      //没有编译对应的压缩库
+      return false;
+  }
+
+  //压缩后没有变小时不压缩，读取时少一次解压
+  if (HEADER_SIZE + len >= value.size()) {
+    return false;
+  }
+  out.resize(HEADER_SIZE + len);
+  return true;
+}
+
+void RedisCodec::encode(const std::string &value, std::string &out) {
+  if (_type != REDIS_CODEC_NONE && value.size() > _threshold && _compress(value, out)) {
+    return;
+  }
+  if (has_magic(value.data(), value.size())) {
+    //原始value以magic开头，加上头避免读取时被误认为压缩数据
+    _write_header(out, REDIS_CODEC_NONE, value.size());
+    out.append(value);
+    return;
+  }
+  out.assign(value);
+}
+
+bool RedisCodec::decode(const char *data, size_t len, std::string &out) {
+  if (!has_magic(data, len)) {
+    out.assign(data, len);
+    return true;
+  }
+  if (len < HEADER_SIZE) {
+    return false;
+  }
+
+  RedisCodecType type = (RedisCodecType)data[2];
+  size_t raw_len = 0;
+  for (int i = 0; i < 4; ++i) {
+    raw_len |= (size_t)(unsigned char)data[3 + i] << (8 * i);
+  }
+  const char *src = data + HEADER_SIZE;
+  size_t src_len = len - HEADER_SIZE;
+  if (type == REDIS_CODEC_NONE) {
+    if (src_len != raw_len) {
+      return false;
+    }
+    out.assign(src, src_len);
+    return true;
+  }
+  if (raw_len == 0 || raw_len > MAX_RAW_SIZE) {
+    return false;
+  }
+
+  out.resize(raw_len);
+  switch (type) {
+#ifdef HAVE_LZ4
+    case REDIS_CODEC_LZ4:
+      return LZ4_decompress_safe(src, &out[0], src_len, raw_len) == (int)raw_len;
+#endif
+#ifdef HAVE_ZSTD
+    case REDIS_CODEC_ZSTD:
+      return ZSTD_decompressDCtx(_dctx, &out[0], raw_len, src, src_len) == raw_len;
+    case REDIS_CODEC_ZSTD_DICT:
+      if (_dict == NULL || _dict->_ddict == NULL) {
+        LOG_ERROR(debug_log, "redis codec: value is compressed with a zstd dictionary, but no dictionary is set");
+        return false;
+      }
+      return ZSTD_decompress_usingDDict(_dctx, &out[0], raw_len, src, src_len, _dict->_ddict) == raw_len;
+#endif
+    default:
+      LOG_ERROR(debug_log, "redis codec: unsupported codec %d", (int)type);
+      return false;
+  }
+}
+
+bool RedisCodec::decode(std::string &value) {
+  if (!has_magic(value.data(), value.size())) {
+    return true;
+  }
+  if (!decode(value.data(), value.size(), _buf)) {
+    return false;
+  }
+  value.swap(_buf);
+  return true;
+}
@@ -0,0 +1,137 @@
+
+#ifndef AFANTI_REDIS_CODEC_H_
+#define AFANTI_REDIS_CODEC_H_
+
+#include <string>
+#include <vector>
+
+//压缩库是可选依赖，编译时定义HAVE_LZ4/HAVE_ZSTD并链接-llz4/-lzstd后才可用
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+enum RedisCodecType {
+  REDIS_CODEC_NONE = 0,
+  REDIS_CODEC_LZ4 = 1,
+  REDIS_CODEC_ZSTD = 2,
+  //使用字典的zstd，适合大量相似的小value
+  REDIS_CODEC_ZSTD_DICT = 3
+};
+
+/**
+ * RedisCodecDict
+ * zstd字典，由样本训练得到或者从外部加载，加载后只读，可以被多个RedisCodec共享。
+ * 读写同一批key的所有进程必须使用相同的字典
+ * @note 线程安全（加载后）
+ **/
+class RedisCodecDict {
+
+public:
+
+  RedisCodecDict();
+
+  ~RedisCodecDict();
+
+  /**
+   * @brief 加载字典
+   * @param [in]  dict，字典内容
+   * @param [in]  level，压缩级别
+   * @return bool，没有编译zstd支持时返回false
+   **/
+  bool load(const std::string &dict, int level = 3);
+
+  /**
+   * @brief 用样本训练字典，样本应该是有代表性的value，总大小一般为字典大小的100倍左右
+   * @param [in]  samples
+   * @param [in]  dict_size，字典的最大字节数
+   * @param [out] dict
+   * @return bool
+   **/
+  static bool train(const std::vector<std::string> &samples, size_t dict_size, std::string &dict);
+
+private:
+
+  friend class RedisCodec;
+
+#ifdef HAVE_ZSTD
+  ZSTD_CDict *_cdict;
+  ZSTD_DDict *_ddict;
+#endif
+
+  //不允许拷贝和赋值操作
+  RedisCodecDict(const RedisCodecDict &other);
+  RedisCodecDict& operator= (const RedisCodecDict &other);
+};
+
+/**
+ * RedisCodec
+ * value的压缩层，设置到RedisClient后写入时压缩超过阈值的value，读取时自动解压。
+ * 压缩后的value以7字节的头开头：2字节magic（0xFE 'Z'）、1字节codec、4字节原始长度（小端）；
+ * 没有压缩的value原样保存，只有恰好以magic开头时才加上REDIS_CODEC_NONE的头，
+ * 因此可以读取设置codec之前写入的数据。
+ * @note 线程不安全，每个RedisClient使用自己的RedisCodec
+ **/
+class RedisCodec {
+
+public:
+
+  /**
+   * @param [in]  type，写入时使用的压缩算法，读取时根据头自动选择
+   * @param [in]  threshold，value超过该字节数才压缩
+   * @param [in]  level，zstd的压缩级别
+   * @param [in]  dict，REDIS_CODEC_ZSTD_DICT使用的字典，生命周期长于codec
+   **/
+  RedisCodec(RedisCodecType type, size_t threshold = 1024, int level = 3,
+      const RedisCodecDict *dict = NULL);
+
+  ~RedisCodec();
+
+  /**
+   * @brief 压缩value，不需要压缩或者压缩后没有变小时按原样（或者加NONE头）输出
+   * @param [in]  value
+   * @param [out] out
+   **/
+  void encode(const std::string &value, std::string &out);
+
+  /**
+   * @brief 解压value，没有头的value原样输出
+   * @param [in]  data
+   * @param [in]  len
+   * @param [out] out
+   * @return bool，头损坏、不支持的codec或者解压失败时返回false
+   **/
+  bool decode(const char *data, size_t len, std::string &out);
+
+  /**
+   * @brief 原地解压
+   **/
+  bool decode(std::string &value);
+
+private:
+
+  static const size_t HEADER_SIZE = 7;
+
+  static void _write_header(std::string &out, RedisCodecType type, size_t raw_len);
+
+  bool _compress(const std::string &value, std::string &out);
+
+  //不允许拷贝和赋值操作
+  RedisCodec(const RedisCodec &other);
+  RedisCodec& operator= (const RedisCodec &other);
+
+private:
+
+  RedisCodecType _type;
+  size_t _threshold;
+  int _level;
+  const RedisCodecDict *_dict;
+  //解压的临时缓冲区，在多次调用之间复用
+  std::string _buf;
+
+#ifdef HAVE_ZSTD
+  ZSTD_CCtx *_cctx;
+  ZSTD_DCtx *_dctx;
+#endif
+};
+
+#endif
@@ -0,0 +1,182 @@
+
+#include "Logger.h"
+#include "redis_get_batcher.h"
+#include <time.h>
+#include <map>
+
+RedisGetBatcher::RedisGetBatcher(RedisClient *client, long window, int max_keys)
+  : _client(client), _window(window), _max_keys(max_keys > 0 ? max_keys : 1),
+    _running(false) {
+  pthread_mutex_init(&_mutex, NULL);
+  pthread_cond_init(&_cond, NULL);
+  _first_arrival.tv_sec = 0;
+  _first_arrival.tv_nsec = 0;
+}
+
+RedisGetBatcher::~RedisGetBatcher() {
+  stop();
+  pthread_mutex_destroy(&_mutex);
+  pthread_cond_destroy(&_cond);
+}
+
+bool RedisGetBatcher::start() {
+  pthread_mutex_lock(&_mutex);
+  if (_running) {
+    pthread_mutex_unlock(&_mutex);
+    return true;
+  }
+  _running = true;
+  pthread_mutex_unlock(&_mutex);
+
+  if (pthread_create(&_thread, NULL, RedisGetBatcher::_loop, this) != 0) {
+    pthread_mutex_lock(&_mutex);
+    _running = false;
+    pthread_mutex_unlock(&_mutex);
+    return false;
+  }
+  return true;
+}
+
+void RedisGetBatcher::stop() {
+  pthread_mutex_lock(&_mutex);
+  if (!_running) {
+    pthread_mutex_unlock(&_mutex);
+    return;
+  }
+  _running = false;
+  pthread_cond_signal(&_cond);
+  pthread_mutex_unlock(&_mutex);
+  pthread_join(_thread, NULL);
+
+  pthread_mutex_lock(&_mutex);
+  for (size_t i = 0; i < _queue.size(); ++i) {
+    _queue[i]->ret = -1;
+    _queue[i]->done = true;
+    pthread_cond_signal(&_queue[i]->cond);
+  }
+  _queue.clear();
+  pthread_mutex_unlock(&_mutex);
+}
+
+int RedisGetBatcher::get(const std::string &key, std::string &value) {
+  if (key.empty()) {
+    return -2;
+  }
+
+  Request req;
+  req.key = &key;
+  req.value = &value;
+  req.ret = -1;
+  req.done = false;
+  pthread_cond_init(&req.cond, NULL);
+
+  pthread_mutex_lock(&_mutex);
+  if (!_running) {
+    pthread_mutex_unlock(&_mutex);
+    pthread_cond_destroy(&req.cond);
+    return -1;
+  }
+  if (_queue.empty()) {
+    clock_gettime(CLOCK_REALTIME, &_first_arrival);
+  }
+  _queue.push_back(&req);
+  //第一个请求开始计时，攒够max_keys个请求立即执行
+  if (_queue.size() == 1 || _queue.size() >= _max_keys) {
+    pthread_cond_signal(&_cond);
+  }
+  while (!req.done) {
+    pthread_cond_wait(&req.cond, &_mutex);
+  }
+  pthread_mutex_unlock(&_mutex);
+
+  pthread_cond_destroy(&req.cond);
+  return req.ret;
+}
+
+void* RedisGetBatcher::_loop(void *param) {
+  RedisGetBatcher *batcher = (RedisGetBatcher *)param;
+  batcher->_run();
+  return NULL;
+}
+
+void RedisGetBatcher::_run() {
+  std::vector<Request *> batch;
+  pthread_mutex_lock(&_mutex);
+  while (_running) {
+    while (_running && _queue.empty()) {
+      pthread_cond_wait(&_cond, &_mutex);
+    }
+    if (!_running) {
+      break;
+    }
+
+    //等待合并窗口结束或者攒够max_keys个请求
+    struct timespec deadline = _first_arrival;
+    long nsec = deadline.tv_nsec + _window * 1000;
+    deadline.tv_sec += nsec / 1000000000;
+    deadline.tv_nsec = nsec % 1000000000;
+    while (_running && _queue.size() < _max_keys) {
+      if (pthread_cond_timedwait(&_cond, &_mutex, &deadline) != 0) {
+        break;
+      }
+    }
+
+    if (_queue.size() <= _max_keys) {
+      batch.swap(_queue);
+    } else {
+      batch.assign(_queue.begin(), _queue.begin() + _max_keys);
+      _queue.erase(_queue.begin(), _queue.begin() + _max_keys);
+      //剩余请求的窗口已经开始，下一轮立即执行
+      clock_gettime(CLOCK_REALTIME, &_first_arrival);
+      _first_arrival.tv_sec -= 1;
+    }
+    pthread_mutex_unlock(&_mutex);
+
+    _execute(batch);
+
+    pthread_mutex_lock(&_mutex);
+    for (size_t i = 0; i < batch.size(); ++i) {
+      batch[i]->done = true;
+      pthread_cond_signal(&batch[i]->cond);
+    }
+    batch.clear();
+  }
+  pthread_mutex_unlock(&_mutex);
+}
+
+void RedisGetBatcher::_execute(std::vector<Request *> &batch) {
+  //同一个key只读取一次
+  std::map<std::string, int> index;
+  std::vector<std::string> keys;
+  std::vector<int> positions(batch.size());
+  for (size_t i = 0; i < batch.size(); ++i) {
+    std::map<std::string, int>::iterator it = index.find(*batch[i]->key);
+    if (it == index.end()) {
+      it = index.insert(std::make_pair(*batch[i]->key, (int)keys.size())).first;
+      keys.push_back(*batch[i]->key);
+    }
+    positions[i] = it->second;
+  }
+
+  std::vector<std::string> values;
+  int ret = _client->mget(keys, values);
+  if (ret != 0 && ret != -3) {
+    LOG_ERROR(debug_log, "redis batcher: mget %d keys failed, ret=%d", (int)keys.size(), ret);
+  }
+  for (size_t i = 0; i < batch.size(); ++i) {
+    Request *req = batch[i];
+    if ((ret != 0 && ret != -3) || (size_t)positions[i] >= values.size()) {
+      req->ret = -1;
+      continue;
+    }
+    const std::string &value = values[positions[i]];
+    if (!value.empty()) {
+      req->value->assign(value);
+      req->ret = 0;
+    } else {
+      //mget中不存在的key为""（set不允许写入空value）；
+      //部分失败（-3）时无法区分不存在和失败，按失败处理
+      req->ret = ret == 0 ? 1 : -1;
+    }
+  }
+}
@@ -0,0 +1,88 @@
+
+#ifndef AFANTI_REDIS_GET_BATCHER_H_
+#define AFANTI_REDIS_GET_BATCHER_H_
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "redis_client.h"
+
+/**
+ * RedisGetBatcher
+ * 把多个线程并发的单key get合并为一次mget：第一个请求到达后最多等待window微秒，
+ * 或者攒够max_keys个key，由批处理线程通过client->mget读取后分发给各个调用线程。
+ * RedisClusterClient的mget会再按hash slot分组。
+ * 用有上限的延迟换取更少的往返和系统调用。
+ * @note 线程安全；client只在批处理线程中使用，不能再被其他线程使用
+ **/
+class RedisGetBatcher {
+
+public:
+
+  /**
+   * @param [in]  client，由调用方创建并init，生命周期长于RedisGetBatcher
+   * @param [in]  window，合并窗口（单位us）
+   * @param [in]  max_keys，一次mget的最大key数
+   **/
+  RedisGetBatcher(RedisClient *client, long window = 200, int max_keys = 128);
+
+  ~RedisGetBatcher();
+
+  /**
+   * @brief 启动批处理线程
+   * @return bool
+   **/
+  bool start();
+
+  /**
+   * @brief 停止批处理线程，尚未执行的请求返回-1
+   **/
+  void stop();
+
+  /**
+   * @brief key-value单条读取方法，参数和返回值与RedisClient::get一致
+   *  0：命令执行成功
+   *  1：该key不存在
+   *  -1：redis-server执行命令失败或者批处理线程未启动
+   *  -2：输入的key问题
+   **/
+  int get(const std::string &key, std::string &value);
+
+private:
+
+  struct Request {
+    const std::string *key;
+    std::string *value;
+    int ret;
+    bool done;
+    pthread_cond_t cond;
+  };
+
+  static void* _loop(void *param);
+
+  void _run();
+
+  void _execute(std::vector<Request *> &batch);
+
+  //不允许拷贝和赋值操作
+  RedisGetBatcher(const RedisGetBatcher &other);
+  RedisGetBatcher& operator= (const RedisGetBatcher &other);
+
+private:
+
+  RedisClient *_client;
+  long _window;
+  size_t _max_keys;
+
+  pthread_mutex_t _mutex;
+  //通知批处理线程有新的请求
+  pthread_cond_t _cond;
+  std::vector<Request *> _queue;
+  //队列中第一个请求到达的时间
+  struct timespec _first_arrival;
+
+  pthread_t _thread;
+  bool _running;
+};
+
+#endif
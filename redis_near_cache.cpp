@@ -0,0 +1,429 @@
+
+#include "Logger.h"
+#include "AutoLock.h"
+#include "redis_near_cache.h"
+#include <sys/time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+
+void RedisNearCache::FrequencySketch::init(size_t width) {
+  size_t w = 64;
+  while (w < width) {
+    w <<= 1;
+  }
+  table.assign(w * 4, 0);
+  mask = w - 1;
+  additions = 0;
+  sample_size = w * 10;
+}
+
+void RedisNearCache::FrequencySketch::increment(unsigned long long hash) {
+  unsigned long long h1 = hash;
+  unsigned long long h2 = hash >> 32;
+  for (size_t i = 0; i < 4; ++i) {
+    unsigned char &counter = table[i * (mask + 1) + ((h1 + i * h2) & mask)];
+    if (counter < 15) {
+      ++counter;
+    }
+  }
+  if (++additions >= sample_size) {
+    //衰减，使频率反映近期的访问
+    for (size_t i = 0; i < table.size(); ++i) {
+      table[i] >>= 1;
+    }
+    additions /= 2;
+  }
+}
+
+int RedisNearCache::FrequencySketch::frequency(unsigned long long hash) {
+  unsigned long long h1 = hash;
+  unsigned long long h2 = hash >> 32;
+  int freq = 15;
+  for (size_t i = 0; i < 4; ++i) {
+    int counter = table[i * (mask + 1) + ((h1 + i * h2) & mask)];
+    if (counter < freq) {
+      freq = counter;
+    }
+  }
+  return freq;
+}
+
+RedisNearCache::RedisNearCache(size_t max_bytes, long ttl)
+  : _max_bytes(max_bytes), _ttl(ttl), _port(0), _redis_context(NULL),
+    _tracking(false), _running(false), _hits(0), _misses(0), _invalidations(0) {
+  for (int i = 0; i < SHARD_NUM; ++i) {
+    _shards[i].bytes = 0;
+    _shards[i].version = 0;
+    //按平均每个key 256字节估计key的个数
+    _shards[i].sketch.init(max_bytes / SHARD_NUM / 256);
+  }
+}
+
+RedisNearCache::~RedisNearCache() {
+  if (_running) {
+    _running = false;
+    pthread_join(_thread, NULL);
+  }
+  if (_redis_context != NULL) {
+    redisFree(_redis_context);
+    _redis_context = NULL;
+  }
+}
+
+bool RedisNearCache::init(const std::string &server_info_bak, const std::string &password,
+    const std::vector<std::string> &prefixes) {
+  //ip:port:db 或者 ip:port，BCAST模式跟踪所有db，这里不需要db
+  std::string server_info(server_info_bak);
+  size_t idx1 = server_info.find(':');
+  if (idx1 == std::string::npos) {
+    return false;
+  }
+  size_t idx2 = server_info.find(':', idx1 + 1);
+  if (idx2 != std::string::npos) {
+    server_info[idx2] = '\0';
+  }
+  server_info[idx1] = '\0';
+  _port = atoi(server_info.c_str() + idx1 + 1);
+  _host = std::string(server_info.c_str());
+  _password = password;
+  _prefixes = prefixes;
+
+  if (!_connect()) {
+    return false;
+  }
+  _tracking = true;
+
+  _running = true;
+  if (pthread_create(&_thread, NULL, RedisNearCache::_listen, this) != 0) {
+    _running = false;
+    _tracking = false;
+    return false;
+  }
+  return true;
+}
+
+int RedisNearCache::get(RedisClient *client, const std::string &key, std::string &value) {
+  if (key.empty()) {
+    return -2;
+  }
+  if (!_tracking) {
+    __sync_fetch_and_add(&_misses, 1);
+    return client->get(key, value);
+  }
+
+  unsigned long long hash = _hash(key);
+  if (_lookup(key, hash, value)) {
+    __sync_fetch_and_add(&_hits, 1);
+    return 0;
+  }
+  __sync_fetch_and_add(&_misses, 1);
+
+  unsigned long version = 0;
+  {
+    Shard &shard = _shard(hash);
+    AutoLock<Mutex> lock(&shard.mutex);
+    version = shard.version;
+  }
+  int ret = client->get(key, value);
+  if (ret == 0) {
+    _insert(key, hash, value, version);
+  }
+  return ret;
+}
+
+int RedisNearCache::mget(RedisClient *client, const std::vector<std::string> &keys,
+    std::vector<std::string> &values) {
+  if (keys.empty()) {
+    return -2;
+  }
+
+  size_t offset = values.size();
+  values.resize(offset + keys.size());
+
+  //未命中的key在keys中的下标
+  std::vector<int> missed;
+  std::vector<std::string> missed_keys;
+  std::vector<unsigned long long> hashes;
+  std::vector<unsigned long> versions;
+  for (int i = 0, j = keys.size(); i < j; ++i) {
+    unsigned long long hash = _hash(keys[i]);
+    if (_tracking && _lookup(keys[i], hash, values[offset + i])) {
+      continue;
+    }
+    Shard &shard = _shard(hash);
+    {
+      AutoLock<Mutex> lock(&shard.mutex);
+      versions.push_back(shard.version);
+    }
+    missed.push_back(i);
+    missed_keys.push_back(keys[i]);
+    hashes.push_back(hash);
+  }
+  __sync_fetch_and_add(&_hits, keys.size() - missed.size());
+  __sync_fetch_and_add(&_misses, missed.size());
+  if (missed.empty()) {
+    return 0;
+  }
+
+  std::vector<std::string> missed_values;
+  int ret = client->mget(missed_keys, missed_values);
+  for (size_t i = 0; i < missed.size() && i < missed_values.size(); ++i) {
+    values[offset + missed[i]].swap(missed_values[i]);
+    //mget无法区分key不存在和读取失败，空value不写入缓存
+    if (_tracking && ret == 0 && !values[offset + missed[i]].empty()) {
+      _insert(missed_keys[i], hashes[i], values[offset + missed[i]], versions[i]);
+    }
+  }
+  return ret;
+}
+
+void RedisNearCache::invalidate(const std::string &key) {
+  unsigned long long hash = _hash(key);
+  Shard &shard = _shard(hash);
+  AutoLock<Mutex> lock(&shard.mutex);
+  ++shard.version;
+  std::map<std::string, Entry>::iterator it = shard.entries.find(key);
+  if (it != shard.entries.end()) {
+    _erase(shard, it);
+  }
+}
+
+void RedisNearCache::clear() {
+  for (int i = 0; i < SHARD_NUM; ++i) {
+    Shard &shard = _shards[i];
+    AutoLock<Mutex> lock(&shard.mutex);
+    ++shard.version;
+    shard.entries.clear();
+    shard.lru.clear();
+    shard.bytes = 0;
+  }
+}
+
+size_t RedisNearCache::bytes() {
+  size_t total = 0;
+  for (int i = 0; i < SHARD_NUM; ++i) {
+    AutoLock<Mutex> lock(&_shards[i].mutex);
+    total += _shards[i].bytes;
+  }
+  return total;
+}
+
+bool RedisNearCache::_lookup(const std::string &key, unsigned long long hash, std::string &value) {
+  Shard &shard = _shard(hash);
+  AutoLock<Mutex> lock(&shard.mutex);
+  shard.sketch.increment(hash);
+  std::map<std::string, Entry>::iterator it = shard.entries.find(key);
+  if (it == shard.entries.end()) {
+    return false;
+  }
+  if (it->second.expire > 0 && it->second.expire < _now_ms()) {
+    //已经过期
+    _erase(shard, it);
+    return false;
+  }
+  shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru);
+  value = it->second.value;
+  return true;
+}
+
+void RedisNearCache::_insert(const std::string &key, unsigned long long hash,
+    const std::string &value, unsigned long version) {
+  size_t size = _entry_bytes(key, value);
+  size_t capacity = _max_bytes / SHARD_NUM;
+  if (size > capacity) {
+    return;
+  }
+
+  Shard &shard = _shard(hash);
+  AutoLock<Mutex> lock(&shard.mutex);
+  if (shard.version != version) {
+    //读取redis期间收到了失效通知，value可能已经过期
+    return;
+  }
+
+  std::map<std::string, Entry>::iterator it = shard.entries.find(key);
+  if (it != shard.entries.end()) {
+    _erase(shard, it);
+  }
+
+  //空间不足时，新key的访问频率比LRU尾部的key高才淘汰后者，否则不进入缓存
+  int freq = shard.sketch.frequency(hash);
+  while (shard.bytes + size > capacity && !shard.lru.empty()) {
+    std::map<std::string, Entry>::iterator victim = shard.entries.find(shard.lru.back());
+    if (freq <= shard.sketch.frequency(_hash(victim->first))) {
+      return;
+    }
+    _erase(shard, victim);
+  }
+
+  Entry &entry = shard.entries[key];
+  entry.value = value;
+  entry.expire = _ttl > 0 ? _now_ms() + _ttl : 0;
+  shard.lru.push_front(key);
+  entry.lru = shard.lru.begin();
+  shard.bytes += size;
+}
+
+void RedisNearCache::_erase(Shard &shard, std::map<std::string, Entry>::iterator it) {
+  shard.bytes -= _entry_bytes(it->first, it->second.value);
+  shard.lru.erase(it->second.lru);
+  shard.entries.erase(it);
+}
+
+bool RedisNearCache::_connect() {
+  if (_redis_context != NULL) {
+    redisFree(_redis_context);
+    _redis_context = NULL;
+  }
+
+  struct timeval tv;
+  tv.tv_sec = 1;
+  tv.tv_usec = 0;
+  _redis_context = redisConnectWithTimeout(_host.c_str(), _port, tv);
+  if (_redis_context == NULL || _redis_context->err) {
+    return false;
+  }
+  redisEnableKeepAlive(_redis_context);
+
+  redisReply *reply = NULL;
+  if (!_password.empty()) {
+    //需要密码验证
+    reply = (redisReply *)redisCommand(_redis_context, "AUTH %s", _password.c_str());
+    bool bval = reply != NULL && reply->type == REDIS_REPLY_STATUS && strcmp(reply->str, "OK") == 0;
+    freeReplyObject(reply);
+    if (!bval) {
+      return false;
+    }
+  }
+
+  //失效通知重定向到本连接自己
+  reply = (redisReply *)redisCommand(_redis_context, "CLIENT ID");
+  if (reply == NULL || reply->type != REDIS_REPLY_INTEGER) {
+    freeReplyObject(reply);
+    return false;
+  }
+  char id[32];
+  snprintf(id, sizeof(id), "%lld", reply->integer);
+  freeReplyObject(reply);
+
+  std::vector<const char *> argv;
+  std::vector<size_t> argv_len;
+  const char *tracking[] = {"CLIENT", "TRACKING", "on", "REDIRECT", id, "BCAST"};
+  for (int i = 0; i < 6; ++i) {
+    argv.push_back(tracking[i]);
+    argv_len.push_back(strlen(tracking[i]));
+  }
+  for (size_t i = 0; i < _prefixes.size(); ++i) {
+    argv.push_back("PREFIX");
+    argv_len.push_back(6);
+    argv.push_back(_prefixes[i].c_str());
+    argv_len.push_back(_prefixes[i].length());
+  }
+  reply = (redisReply *)redisCommandArgv(_redis_context, argv.size(), &argv[0], &argv_len[0]);
+  bool bval = reply != NULL && reply->type == REDIS_REPLY_STATUS && strcmp(reply->str, "OK") == 0;
+  if (!bval) {
+    LOG_ERROR(debug_log, "redis near cache: CLIENT TRACKING failed, %s",
+        (reply != NULL && reply->type == REDIS_REPLY_ERROR) ? reply->str : "no reply");
+  }
+  freeReplyObject(reply);
+  if (!bval) {
+    return false;
+  }
+
+  reply = (redisReply *)redisCommand(_redis_context, "SUBSCRIBE __redis__:invalidate");
+  bval = reply != NULL && reply->type == REDIS_REPLY_ARRAY;
+  freeReplyObject(reply);
+  return bval;
+}
+
+void RedisNearCache::_handle_reply(redisReply *reply) {
+  //["message", "__redis__:invalidate", [key, ...] 或 nil（FLUSHALL等）]
+  if (reply->type != REDIS_REPLY_ARRAY || reply->elements != 3
+      || reply->element[0]->type != REDIS_REPLY_STRING
+      || strcmp(reply->element[0]->str, "message") != 0) {
+    return;
+  }
+  redisReply *keys = reply->element[2];
+  if (keys->type == REDIS_REPLY_NIL) {
+    clear();
+    __sync_fetch_and_add(&_invalidations, 1);
+    return;
+  }
+  if (keys->type == REDIS_REPLY_ARRAY) {
+    for (size_t i = 0; i < keys->elements; ++i) {
+      if (keys->element[i]->type == REDIS_REPLY_STRING) {
+        invalidate(std::string(keys->element[i]->str, keys->element[i]->len));
+      }
+    }
+    __sync_fetch_and_add(&_invalidations, keys->elements);
+  } else if (keys->type == REDIS_REPLY_STRING) {
+    invalidate(std::string(keys->str, keys->len));
+    __sync_fetch_and_add(&_invalidations, 1);
+  }
+}
+
+void* RedisNearCache::_listen(void *param) {
+  RedisNearCache *cache = (RedisNearCache *)param;
+  while (cache->_running) {
+    if (!cache->_tracking) {
+      //连接断开期间的修改收不到通知，重连成功后清空缓存再启用
+      if (!cache->_connect()) {
+        sleep(1);
+        continue;
+      }
+      cache->clear();
+      cache->_tracking = true;
+      LOG_INFO("redis near cache: tracking connection rebuilt");
+    }
+
+    struct pollfd pfd;
+    pfd.fd = cache->_redis_context->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 500) <= 0) {
+      continue;
+    }
+
+    bool broken = redisBufferRead(cache->_redis_context) != REDIS_OK;
+    redisReply *reply = NULL;
+    while (!broken) {
+      reply = NULL;
+      if (redisGetReplyFromReader(cache->_redis_context, (void **)&reply) != REDIS_OK) {
+        broken = true;
+        break;
+      }
+      if (reply == NULL) {
+        break;
+      }
+      cache->_handle_reply(reply);
+      freeReplyObject(reply);
+    }
+
+    if (broken) {
+      LOG_ERROR(debug_log, "redis near cache: tracking connection broken, %s",
+          cache->_redis_context->errstr);
+      cache->_tracking = false;
+      cache->clear();
+    }
+  }
+  return NULL;
+}
+
+unsigned long long RedisNearCache::_hash(const std::string &key) {
+  //FNV-1a
+  unsigned long long hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < key.size(); ++i) {
+    hash ^= (unsigned char)key[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+long RedisNearCache::_now_ms() {
+  struct timeval t;
+  gettimeofday(&t, NULL);
+  return t.tv_sec * 1000 + t.tv_usec / 1000;
+}
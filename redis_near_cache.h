@@ -0,0 +1,162 @@
+
+#ifndef AFANTI_REDIS_NEAR_CACHE_H_
+#define AFANTI_REDIS_NEAR_CACHE_H_
+
+#include <hircluster.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include "Mutex.h"
+#include "redis_client.h"
+
+/**
+ * RedisNearCache
+ * RedisClient读操作前的进程内缓存，按字节数限制大小，LRU淘汰，
+ * 新key需要比被淘汰的key访问频率更高才会进入缓存（TinyLFU），每个key有过期时间。
+ * 通过一条专用连接开启CLIENT TRACKING（BCAST模式），key被修改时收到失效通知，
+ * 该连接断开期间不使用缓存，重连后清空缓存。
+ * @note 线程安全；要求redis-server >= 6.0，只支持非集群（ip:port:db）
+ **/
+class RedisNearCache {
+
+public:
+
+  /**
+   * @param [in]  max_bytes，缓存的最大字节数（key+value+固定开销）
+   * @param [in]  ttl，每个key的过期时间（单位ms）：<=0，不过期，只依赖失效通知
+   **/
+  RedisNearCache(size_t max_bytes, long ttl = 0);
+
+  ~RedisNearCache();
+
+  /**
+   * @brief 初始化方法，建立接收失效通知的连接并启动通知线程
+   * @param [in]  server_info，字符串格式 ip:port:db or ip:port
+   * @param [in]  password
+   * @param [in]  prefixes，只跟踪这些前缀的key：为空，跟踪所有key
+   * @return bool
+   **/
+  bool init(const std::string &server_info, const std::string &password = "",
+      const std::vector<std::string> &prefixes = std::vector<std::string>());
+
+  /**
+   * @brief 优先从缓存读取，未命中时通过client读取并写入缓存，参数和返回值与RedisClient::get一致
+   **/
+  int get(RedisClient *client, const std::string &key, std::string &value);
+
+  /**
+   * @brief 优先从缓存读取，未命中的key通过client->mget批量读取，参数和返回值与RedisClient::mget一致
+   **/
+  int mget(RedisClient *client, const std::vector<std::string> &keys,
+      std::vector<std::string> &values);
+
+  /**
+   * @brief 主动使某个key失效，例如本进程通过client修改了该key
+   **/
+  void invalidate(const std::string &key);
+
+  /**
+   * @brief 清空缓存
+   **/
+  void clear();
+
+  /**
+   * @brief 统计信息
+   **/
+  long hits() { return _hits; }
+  long misses() { return _misses; }
+  long invalidations() { return _invalidations; }
+  size_t bytes();
+
+private:
+
+  struct Entry {
+    std::string value;
+    long expire;
+    std::list<std::string>::iterator lru;
+  };
+
+  /**
+   * 4行4bit计数器的Count-Min Sketch，记录key的近期访问频率，
+   * 累计次数达到采样数后全部减半，使频率随时间衰减
+   **/
+  struct FrequencySketch {
+    std::vector<unsigned char> table;
+    size_t mask;
+    size_t additions;
+    size_t sample_size;
+
+    void init(size_t width);
+    void increment(unsigned long long hash);
+    int frequency(unsigned long long hash);
+  };
+
+  struct Shard {
+    Mutex mutex;
+    std::map<std::string, Entry> entries;
+    //表头为最近访问的key
+    std::list<std::string> lru;
+    size_t bytes;
+    //每次失效加1，读取redis前后不一致时不写入缓存，避免写入已经失效的value
+    unsigned long version;
+    FrequencySketch sketch;
+  };
+
+  Shard& _shard(unsigned long long hash) {
+    //低位留给FrequencySketch使用，分片使用高位
+    return _shards[(hash >> 56) % SHARD_NUM];
+  }
+
+  bool _lookup(const std::string &key, unsigned long long hash, std::string &value);
+
+  void _insert(const std::string &key, unsigned long long hash,
+      const std::string &value, unsigned long version);
+
+  void _erase(Shard &shard, std::map<std::string, Entry>::iterator it);
+
+  bool _connect();
+
+  void _handle_reply(redisReply *reply);
+
+  static void* _listen(void *param);
+
+  static unsigned long long _hash(const std::string &key);
+
+  static long _now_ms();
+
+  static size_t _entry_bytes(const std::string &key, const std::string &value) {
+    return key.size() + value.size() + 64;
+  }
+
+  //不允许拷贝和赋值操作
+  RedisNearCache(const RedisNearCache &other);
+  RedisNearCache& operator= (const RedisNearCache &other);
+
+private:
+
+  static const int SHARD_NUM = 16;
+
+  size_t _max_bytes;
+  long _ttl;
+  Shard _shards[SHARD_NUM];
+
+  std::string _host;
+  int _port;
+  std::string _password;
+  std::vector<std::string> _prefixes;
+
+  //失效通知连接，只在通知线程中访问
+  redisContext *_redis_context;
+  //失效通知连接可用时才使用缓存
+  volatile bool _tracking;
+  volatile bool _running;
+  pthread_t _thread;
+
+  volatile long _hits;
+  volatile long _misses;
+  volatile long _invalidations;
+};
+
+#endif
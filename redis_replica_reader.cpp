@@ -0,0 +1,418 @@
+
+#include "Logger.h"
+#include "redis_replica_reader.h"
+#include "redis_slot.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <poll.h>
+#include <sstream>
+
+//拓扑刷新间隔（单位s）
+static const int REFRESH_INTERVAL = 60;
+//连接失败后的重试间隔（单位us）
+static const long long RETRY_INTERVAL = 1000000;
+static const double EWMA_ALPHA = 0.2;
+//保留最近SAMPLE_SIZE个耗时样本，每RECOMPUTE_EVERY个样本重新计算一次p95
+static const size_t SAMPLE_SIZE = 1024;
+static const size_t RECOMPUTE_EVERY = 128;
+
+RedisReplicaReader::RedisReplicaReader(bool hedge, long min_hedge_delay, long max_hedge_delay)
+  : _hedge(hedge), _min_hedge_delay(min_hedge_delay),
+    _max_hedge_delay(max_hedge_delay > min_hedge_delay ? max_hedge_delay : min_hedge_delay),
+    _timeout(1000), _slot_shard(REDIS_CLUSTER_SLOT_NUM, -1), _stale(true), _loaded_at(0),
+    _sample_count(0), _hedge_delay(_max_hedge_delay), _hedged(0), _hedge_wins(0) {
+}
+
+RedisReplicaReader::~RedisReplicaReader() {
+  for (std::map<std::string, Node *>::iterator it = _nodes.begin(); it != _nodes.end(); ++it) {
+    if (it->second->context != NULL) {
+      redisFree(it->second->context);
+    }
+    delete it->second;
+  }
+}
+
+bool RedisReplicaReader::init(const std::string &server_info, const std::string &password,
+    long timeout) {
+  _server_info = server_info;
+  _password = password;
+  _timeout = timeout > 0 ? timeout : 1000;
+  return _load_slots();
+}
+
+long long RedisReplicaReader::_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+RedisReplicaReader::Node* RedisReplicaReader::_node(const std::string &host, int port) {
+  std::stringstream addr;
+  addr << host << ":" << port;
+  std::map<std::string, Node *>::iterator it = _nodes.find(addr.str());
+  if (it != _nodes.end()) {
+    return it->second;
+  }
+  Node *node = new Node;
+  node->host = host;
+  node->port = port;
+  node->master = false;
+  node->context = NULL;
+  node->ewma = 0;
+  node->pending = false;
+  node->sent_at = 0;
+  node->retry_at = 0;
+  _nodes[addr.str()] = node;
+  return node;
+}
+
+bool RedisReplicaReader::_load_slots() {
+  _loaded_at = time(NULL);
+
+  //依次尝试每个种子节点，直到读到CLUSTER SLOTS
+  std::stringstream seeds(_server_info);
+  std::string seed;
+  while (std::getline(seeds, seed, ',')) {
+    size_t idx = seed.rfind(':');
+    if (idx == std::string::npos) {
+      continue;
+    }
+    Node *seed_node = _node(seed.substr(0, idx), atoi(seed.c_str() + idx + 1));
+    if (seed_node->context == NULL && !_connect(seed_node)) {
+      continue;
+    }
+    if (seed_node->pending) {
+      //还有hedged GET的reply没有读取，不能同步执行命令
+      continue;
+    }
+    redisReply *reply = (redisReply *)redisCommand(seed_node->context, "CLUSTER SLOTS");
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY) {
+      if (reply == NULL) {
+        _close(seed_node, _now());
+      }
+      freeReplyObject(reply);
+      continue;
+    }
+
+    //[start, end, [master_ip, master_port, id], [replica_ip, replica_port, id], ...]
+    std::vector<Shard> shards;
+    std::vector<int> slot_shard(REDIS_CLUSTER_SLOT_NUM, -1);
+    for (size_t i = 0; i < reply->elements; ++i) {
+      redisReply *range = reply->element[i];
+      if (range->type != REDIS_REPLY_ARRAY || range->elements < 3) {
+        continue;
+      }
+      Shard shard;
+      shard.master = NULL;
+      for (size_t j = 2; j < range->elements; ++j) {
+        redisReply *addr = range->element[j];
+        if (addr->type != REDIS_REPLY_ARRAY || addr->elements < 2
+            || addr->element[0]->type != REDIS_REPLY_STRING
+            || addr->element[1]->type != REDIS_REPLY_INTEGER) {
+          continue;
+        }
+        Node *node = _node(std::string(addr->element[0]->str, addr->element[0]->len),
+            (int)addr->element[1]->integer);
+        node->master = j == 2;
+        if (node->master) {
+          shard.master = node;
+        } else {
+          shard.replicas.push_back(node);
+        }
+      }
+      long long first = range->element[0]->integer;
+      long long last = range->element[1]->integer;
+      for (long long slot = first; slot <= last && slot < REDIS_CLUSTER_SLOT_NUM; ++slot) {
+        slot_shard[slot] = shards.size();
+      }
+      shards.push_back(shard);
+    }
+    freeReplyObject(reply);
+
+    _shards.swap(shards);
+    _slot_shard.swap(slot_shard);
+    _stale = false;
+    return true;
+  }
+  LOG_ERROR(debug_log, "redis replica reader: load cluster slots from %s failed",
+      _server_info.c_str());
+  return false;
+}
+
+bool RedisReplicaReader::_connect(Node *node) {
+  struct timeval tv;
+  tv.tv_sec = _timeout / 1000;
+  tv.tv_usec = (_timeout % 1000) * 1000;
+  redisContext *context = redisConnectWithTimeout(node->host.c_str(), node->port, tv);
+  if (context == NULL || context->err) {
+    if (context != NULL) {
+      redisFree(context);
+    }
+    node->retry_at = _now() + RETRY_INTERVAL;
+    return false;
+  }
+  redisSetTimeout(context, tv);
+  redisEnableKeepAlive(context);
+
+  redisReply *reply = NULL;
+  bool bval = true;
+  if (!_password.empty()) {
+    //需要密码验证
+    reply = (redisReply *)redisCommand(context, "AUTH %s", _password.c_str());
+    bval = reply != NULL && reply->type == REDIS_REPLY_STATUS && strcmp(reply->str, "OK") == 0;
+    freeReplyObject(reply);
+  }
+  if (bval) {
+    //允许在从节点上读取，master上没有影响
+    reply = (redisReply *)redisCommand(context, "READONLY");
+    bval = reply != NULL && reply->type == REDIS_REPLY_STATUS && strcmp(reply->str, "OK") == 0;
+    freeReplyObject(reply);
+  }
+  if (!bval) {
+    redisFree(context);
+    node->retry_at = _now() + RETRY_INTERVAL;
+    return false;
+  }
+  node->context = context;
+  node->pending = false;
+  return true;
+}
+
+void RedisReplicaReader::_close(Node *node, long long now) {
+  if (node->context != NULL) {
+    redisFree(node->context);
+    node->context = NULL;
+  }
+  node->pending = false;
+  node->retry_at = now + RETRY_INTERVAL;
+  //失败的节点按超时计入EWMA，恢复后逐渐重新被选中
+  node->ewma = (double)_timeout * 1000;
+}
+
+bool RedisReplicaReader::_ready(Node *node, long long now) {
+  if (node->context == NULL) {
+    return now >= node->retry_at && _connect(node);
+  }
+  if (!node->pending) {
+    return true;
+  }
+
+  //上一次请求的reply没有读取（hedge的另一方或者超时），非阻塞地读取并丢弃
+  struct pollfd pfd;
+  pfd.fd = node->context->fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  if (poll(&pfd, 1, 0) > 0) {
+    redisReply *reply = NULL;
+    if (_read(node, reply, true) == 1) {
+      freeReplyObject(reply);
+      return true;
+    }
+  } else if (now - node->sent_at > (long long)_timeout * 1000) {
+    //超时仍未返回，重建连接
+    _close(node, now);
+  }
+  return false;
+}
+
+void RedisReplicaReader::_pick(const Shard &shard, long long now, Node *&first, Node *&second) {
+  first = NULL;
+  second = NULL;
+  for (size_t i = 0; i < shard.replicas.size(); ++i) {
+    Node *node = shard.replicas[i];
+    if (!_ready(node, now)) {
+      continue;
+    }
+    if (first == NULL || node->ewma < first->ewma) {
+      second = first;
+      first = node;
+    } else if (second == NULL || node->ewma < second->ewma) {
+      second = node;
+    }
+  }
+  //只有一个可用的从节点时，hedged GET发给master
+  if (_hedge && first != NULL && second == NULL && shard.master != NULL
+      && _ready(shard.master, now)) {
+    second = shard.master;
+  }
+}
+
+bool RedisReplicaReader::_send(Node *node, const std::string &key, long long now) {
+  if (redisAppendCommand(node->context, "GET %b", key.c_str(), key.length()) != REDIS_OK) {
+    _close(node, now);
+    return false;
+  }
+  int done = 0;
+  while (!done) {
+    if (redisBufferWrite(node->context, &done) == REDIS_ERR) {
+      _close(node, now);
+      return false;
+    }
+  }
+  node->pending = true;
+  node->sent_at = now;
+  return true;
+}
+
+int RedisReplicaReader::_read(Node *node, redisReply *&reply, bool drain) {
+  void *r = NULL;
+  if (redisBufferRead(node->context) != REDIS_OK
+      || redisGetReplyFromReader(node->context, &r) != REDIS_OK) {
+    _close(node, _now());
+    return -1;
+  }
+  if (r == NULL) {
+    //reply还没有完整到达
+    return 0;
+  }
+  node->pending = false;
+  if (!drain) {
+    _record(node, _now());
+  }
+  reply = (redisReply *)r;
+  return 1;
+}
+
+redisReply* RedisReplicaReader::_wait(Node **nodes, int n, long timeout, int &winner) {
+  long long deadline = _now() + timeout;
+  struct pollfd fds[2];
+  for (;;) {
+    int live = 0;
+    for (int i = 0; i < n; ++i) {
+      fds[i].fd = -1;
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+      if (nodes[i] != NULL && nodes[i]->pending) {
+        fds[i].fd = nodes[i]->context->fd;
+        ++live;
+      }
+    }
+    if (live == 0) {
+      return NULL;
+    }
+
+    long long left = deadline - _now();
+    if (left < 0) {
+      left = 0;
+    }
+    //hedge延迟为微秒级，poll的毫秒精度不够
+    struct timespec ts;
+    ts.tv_sec = left / 1000000;
+    ts.tv_nsec = (left % 1000000) * 1000;
+    int ret = ppoll(fds, n, &ts, NULL);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      return NULL;
+    }
+    for (int i = 0; i < n; ++i) {
+      if (fds[i].fd < 0 || fds[i].revents == 0) {
+        continue;
+      }
+      redisReply *reply = NULL;
+      if (_read(nodes[i], reply) == 1) {
+        winner = i;
+        return reply;
+      }
+    }
+  }
+}
+
+void RedisReplicaReader::_update_ewma(Node *node, long us) {
+  if (us <= 0) {
+    us = 1;
+  }
+  node->ewma = node->ewma == 0 ? us : node->ewma * (1 - EWMA_ALPHA) + us * EWMA_ALPHA;
+}
+
+void RedisReplicaReader::_record(Node *node, long long now) {
+  long us = now - node->sent_at;
+  if (us <= 0) {
+    us = 1;
+  }
+  _update_ewma(node, us);
+
+  if (_samples.size() < SAMPLE_SIZE) {
+    _samples.push_back(us);
+  } else {
+    _samples[_sample_count % SAMPLE_SIZE] = us;
+  }
+  ++_sample_count;
+  if (_sample_count % RECOMPUTE_EVERY == 0) {
+    std::vector<long> sorted(_samples);
+    std::vector<long>::iterator p95 = sorted.begin() + sorted.size() * 95 / 100;
+    std::nth_element(sorted.begin(), p95, sorted.end());
+    _hedge_delay = std::min(std::max(*p95, _min_hedge_delay), _max_hedge_delay);
+  }
+}
+
+redisReply* RedisReplicaReader::get(const std::string &key) {
+  time_t now_sec = time(NULL);
+  if ((_stale && now_sec != _loaded_at) || now_sec - _loaded_at >= REFRESH_INTERVAL) {
+    //刷新失败时继续使用旧的拓扑，每秒最多刷新一次
+    _load_slots();
+  }
+  int shard = _slot_shard[redis_key_slot(key)];
+  if (shard < 0) {
+    return NULL;
+  }
+
+  long long now = _now();
+  Node *first = NULL;
+  Node *second = NULL;
+  _pick(_shards[shard], now, first, second);
+  if (first == NULL) {
+    return NULL;
+  }
+  if (!_send(first, key, now)) {
+    first = second;
+    second = NULL;
+    if (first == NULL || !_send(first, key, now)) {
+      return NULL;
+    }
+  }
+
+  Node *nodes[2] = {first, NULL};
+  long timeout = _timeout * 1000;
+  int winner = 0;
+  redisReply *reply = NULL;
+  if (_hedge && second != NULL && _hedge_delay < timeout) {
+    reply = _wait(nodes, 1, _hedge_delay, winner);
+    if (reply == NULL && first->pending) {
+      //超过hedge延迟还没有返回，向第二个节点再发送一次
+      now = _now();
+      if (_send(second, key, now)) {
+        ++_hedged;
+        nodes[1] = second;
+      }
+      reply = _wait(nodes, 2, timeout - (now - first->sent_at), winner);
+      if (reply != NULL && winner == 1) {
+        ++_hedge_wins;
+      }
+      Node *loser = reply != NULL ? nodes[1 - winner] : NULL;
+      if (loser != NULL && loser->pending) {
+        //输的一方的reply在下次选择节点时丢弃，不计入样本；
+        //它的耗时至少为已经等待的时间，按此更新EWMA
+        _update_ewma(loser, _now() - loser->sent_at);
+      }
+    }
+  } else {
+    reply = _wait(nodes, 1, timeout, winner);
+  }
+
+  if (reply == NULL) {
+    return NULL;
+  }
+  if (reply->type == REDIS_REPLY_STRING || reply->type == REDIS_REPLY_NIL) {
+    return reply;
+  }
+  if (reply->type == REDIS_REPLY_ERROR && strncmp(reply->str, "MOVED", 5) == 0) {
+    //slot已经迁移，下次请求前刷新拓扑
+    _stale = true;
+  }
+  freeReplyObject(reply);
+  return NULL;
+}
@@ -0,0 +1,165 @@
+
+#ifndef AFANTI_REDIS_REPLICA_READER_H_
+#define AFANTI_REDIS_REPLICA_READER_H_
+
+#include <hiredis.h>
+#include <time.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * RedisReplicaReader
+ * 集群从节点读取：通过CLUSTER SLOTS获取每个slot的master和从节点，
+ * 对从节点建立独立的连接并发送READONLY。
+ * 每个节点维护GET耗时的EWMA，优先读取EWMA最小的从节点；
+ * 开启hedge时，第一个请求超过延迟（最近GET耗时的p95）还没有返回，
+ * 向EWMA第二小的从节点（只有一个从节点时为master）再发送一次GET，使用先返回的结果。
+ * 慢节点上未读取的reply在下次使用该节点时读取并计入EWMA。
+ * 从节点的数据可能落后于master，只适合能容忍短暂旧数据的读取。
+ * @note 线程不安全，由RedisClusterClient持有
+ **/
+class RedisReplicaReader {
+
+public:
+
+  /**
+   * @param [in]  hedge，是否发送hedged GET
+   * @param [in]  min_hedge_delay，hedge延迟的下限（单位us）
+   * @param [in]  max_hedge_delay，hedge延迟的上限（单位us）
+   **/
+  RedisReplicaReader(bool hedge = true, long min_hedge_delay = 500,
+      long max_hedge_delay = 20000);
+
+  ~RedisReplicaReader();
+
+  /**
+   * @brief 初始化方法，读取集群拓扑，不建立与从节点的连接
+   * @param [in]  server_info，字符串格式 ip0:port0,ip1:port1,...
+   * @param [in]  password
+   * @param [in]  timeout，连接和读取的超时时间（单位ms）：<=0，使用1000ms
+   * @return bool
+   **/
+  bool init(const std::string &server_info, const std::string &password = "", long timeout = 0);
+
+  /**
+   * @brief 从从节点读取key
+   * @return redisReply*，类型为STRING或NIL，由调用方freeReplyObject；
+   *         NULL：没有可用的从节点、超时或者从节点返回错误（如MOVED），调用方应回退到master
+   **/
+  redisReply* get(const std::string &key);
+
+  /**
+   * @brief 当前的hedge延迟（单位us）
+   **/
+  long hedge_delay() const {
+    return _hedge_delay;
+  }
+
+  /**
+   * @brief 统计：发送hedged GET的次数、hedged GET先返回的次数
+   **/
+  long long hedged() const {
+    return _hedged;
+  }
+
+  long long hedge_wins() const {
+    return _hedge_wins;
+  }
+
+private:
+
+  struct Node {
+    std::string host;
+    int port;
+    bool master;
+    redisContext *context;
+    //GET耗时的EWMA（单位us），0：没有样本，优先尝试
+    double ewma;
+    //已经发出但是没有读取的reply
+    bool pending;
+    long long sent_at;
+    //连接失败后在该时间之前不再尝试（单位us）
+    long long retry_at;
+  };
+
+  struct Shard {
+    Node *master;
+    std::vector<Node *> replicas;
+  };
+
+  bool _load_slots();
+
+  Node* _node(const std::string &host, int port);
+
+  bool _connect(Node *node);
+
+  void _close(Node *node, long long now);
+
+  /**
+   * @brief 节点是否可以发送新的请求，有未读取的reply时非阻塞地尝试读取
+   **/
+  bool _ready(Node *node, long long now);
+
+  /**
+   * @brief 选择EWMA最小的两个可用节点，second可能为master或者NULL
+   **/
+  void _pick(const Shard &shard, long long now, Node *&first, Node *&second);
+
+  bool _send(Node *node, const std::string &key, long long now);
+
+  /**
+   * @brief 等待nodes中任意一个节点返回，最多timeout微秒
+   * @return redisReply*，NULL：超时或者全部失败，winner为返回结果的节点下标
+   **/
+  redisReply* _wait(Node **nodes, int n, long timeout, int &winner);
+
+  /**
+   * @brief 读取节点已经到达的reply，非阻塞
+   * @param [in]  drain，true：丢弃的旧reply，到达时间不是GET耗时，不计入统计
+   * @return int，1：读到reply，0：reply还没有到达，-1：连接失败
+   **/
+  int _read(Node *node, redisReply *&reply, bool drain = false);
+
+  /**
+   * @brief 记录一次GET耗时，更新节点的EWMA和p95样本
+   **/
+  void _record(Node *node, long long now);
+
+  void _update_ewma(Node *node, long us);
+
+  static long long _now();
+
+  //不允许拷贝和赋值操作
+  RedisReplicaReader(const RedisReplicaReader &other);
+  RedisReplicaReader& operator= (const RedisReplicaReader &other);
+
+private:
+
+  bool _hedge;
+  long _min_hedge_delay;
+  long _max_hedge_delay;
+
+  std::string _server_info;
+  std::string _password;
+  long _timeout;
+
+  //ip:port -> 节点，拓扑更新后复用连接
+  std::map<std::string, Node *> _nodes;
+  std::vector<Shard> _shards;
+  //slot -> _shards的下标，-1：没有负责的节点
+  std::vector<int> _slot_shard;
+  //拓扑过期（收到MOVED或者超过刷新间隔）
+  bool _stale;
+  time_t _loaded_at;
+
+  //最近的GET耗时样本（单位us），用于计算p95
+  std::vector<long> _samples;
+  size_t _sample_count;
+  long _hedge_delay;
+
+  long long _hedged;
+  long long _hedge_wins;
+};
+
+#endif
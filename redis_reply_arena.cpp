@@ -0,0 +1,137 @@
+
+#include "redis_reply_arena.h"
+#include <cstdlib>
+#include <cstring>
+
+static redisReply* create_reply(const redisReadTask *task, int type) {
+  RedisReplyArena *arena = (RedisReplyArena *)task->privdata;
+  redisReply *r = (redisReply *)arena->alloc(sizeof(redisReply));
+  memset(r, 0, sizeof(redisReply));
+  r->type = type;
+  if (task->parent != NULL) {
+    redisReply *parent = (redisReply *)task->parent->obj;
+    parent->element[task->idx] = r;
+  }
+  return r;
+}
+
+static void* create_string(const redisReadTask *task, char *str, size_t len) {
+  RedisReplyArena *arena = (RedisReplyArena *)task->privdata;
+  char *buf = (char *)arena->alloc(len + 1);
+  memcpy(buf, str, len);
+  buf[len] = '\0';
+  //task->type为REDIS_REPLY_STRING/STATUS/ERROR
+  redisReply *r = create_reply(task, task->type);
+  r->str = buf;
+  r->len = len;
+  return r;
+}
+
+static void* create_array(const redisReadTask *task, int elements) {
+  RedisReplyArena *arena = (RedisReplyArena *)task->privdata;
+  redisReply **element = NULL;
+  if (elements > 0) {
+    element = (redisReply **)arena->alloc(elements * sizeof(redisReply *));
+    memset(element, 0, elements * sizeof(redisReply *));
+  }
+  redisReply *r = create_reply(task, REDIS_REPLY_ARRAY);
+  r->element = element;
+  r->elements = elements;
+  return r;
+}
+
+static void* create_integer(const redisReadTask *task, long long value) {
+  redisReply *r = create_reply(task, REDIS_REPLY_INTEGER);
+  r->integer = value;
+  return r;
+}
+
+static void* create_nil(const redisReadTask *task) {
+  return create_reply(task, REDIS_REPLY_NIL);
+}
+
+static void free_object(void *reply) {
+  //由RedisReplyArena::reset统一释放
+}
+
+static redisReplyObjectFunctions ARENA_FUNCTIONS = {
+  create_string,
+  create_array,
+  create_integer,
+  create_nil,
+  free_object
+};
+
+RedisReplyArena::RedisReplyArena(size_t block_size, size_t retain_size)
+  : _current(0), _block_size(block_size), _retain_size(retain_size) {
+}
+
+RedisReplyArena::~RedisReplyArena() {
+  for (size_t i = 0; i < _blocks.size(); ++i) {
+    free(_blocks[i].data);
+  }
+}
+
+void* RedisReplyArena::alloc(size_t size) {
+  size = (size + 7) & ~(size_t)7;
+  while (_current < _blocks.size()) {
+    Block &block = _blocks[_current];
+    if (block.size - block.used >= size) {
+      void *ptr = block.data + block.used;
+      block.used += size;
+      return ptr;
+    }
+    ++_current;
+  }
+
+  //大的value单独申请一个block
+  Block block;
+  block.size = size > _block_size ? size : _block_size;
+  block.data = (char *)malloc(block.size);
+  block.used = size;
+  _blocks.push_back(block);
+  _current = _blocks.size() - 1;
+  return block.data;
+}
+
+void RedisReplyArena::reset() {
+  size_t retained = 0;
+  size_t kept = 0;
+  for (size_t i = 0; i < _blocks.size(); ++i) {
+    if (retained + _blocks[i].size <= _retain_size) {
+      retained += _blocks[i].size;
+      _blocks[i].used = 0;
+      _blocks[kept++] = _blocks[i];
+    } else {
+      free(_blocks[i].data);
+    }
+  }
+  _blocks.resize(kept);
+  _current = 0;
+}
+
+redisReplyObjectFunctions* RedisReplyArena::functions() {
+  return &ARENA_FUNCTIONS;
+}
+
+RedisReplyArenaScope::RedisReplyArenaScope(redisContext *context, RedisReplyArena *arena)
+  : _reader(NULL), _fn(NULL), _privdata(NULL) {
+  if (context == NULL || context->reader == NULL) {
+    return;
+  }
+  _reader = context->reader;
+  _fn = _reader->fn;
+  _privdata = _reader->privdata;
+  _reader->fn = RedisReplyArena::functions();
+  _reader->privdata = arena;
+}
+
+RedisReplyArenaScope::~RedisReplyArenaScope() {
+  if (_reader == NULL) {
+    return;
+  }
+  //读取中途出错时reader中可能残留arena中的reply，不能交给默认的freeObject
+  _reader->reply = NULL;
+  _reader->fn = _fn;
+  _reader->privdata = _privdata;
+}
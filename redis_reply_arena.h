@@ -0,0 +1,85 @@
+
+#ifndef AFANTI_REDIS_REPLY_ARENA_H_
+#define AFANTI_REDIS_REPLY_ARENA_H_
+
+#include <hircluster.h>
+#include <vector>
+#include <cstddef>
+
+/**
+ * RedisReplyArena
+ * 在一块连续内存中构造redisReply，一次reset释放一次调用中的所有reply，
+ * 代替hiredis默认的每个reply、每个字符串各一次malloc/free。
+ * 通过RedisReplyArenaScope临时替换redisContext的reply构造函数。
+ * @note 线程不安全；arena中的reply不能调用freeReplyObject
+ **/
+class RedisReplyArena {
+
+public:
+
+  /**
+   * @param [in]  block_size，每次向系统申请的内存块大小
+   * @param [in]  retain_size，reset后最多保留的内存大小，超出部分归还系统
+   **/
+  RedisReplyArena(size_t block_size = 64 * 1024, size_t retain_size = 4 * 1024 * 1024);
+
+  ~RedisReplyArena();
+
+  /**
+   * @brief 分配size字节，按8字节对齐，内存未初始化
+   **/
+  void* alloc(size_t size);
+
+  /**
+   * @brief 释放arena中的所有reply
+   **/
+  void reset();
+
+  /**
+   * @brief 使用arena构造reply的函数集合，privdata为RedisReplyArena*
+   **/
+  static redisReplyObjectFunctions* functions();
+
+private:
+
+  struct Block {
+    char *data;
+    size_t size;
+    size_t used;
+  };
+
+  std::vector<Block> _blocks;
+  //当前分配所在的block
+  size_t _current;
+  size_t _block_size;
+  size_t _retain_size;
+
+  //不允许拷贝和赋值操作
+  RedisReplyArena(const RedisReplyArena &other);
+  RedisReplyArena& operator= (const RedisReplyArena &other);
+};
+
+/**
+ * RedisReplyArenaScope
+ * 作用域内redisContext读取的reply都构造在arena中，析构时恢复hiredis默认的构造函数
+ **/
+class RedisReplyArenaScope {
+
+public:
+
+  RedisReplyArenaScope(redisContext *context, RedisReplyArena *arena);
+
+  ~RedisReplyArenaScope();
+
+private:
+
+  redisReader *_reader;
+  redisReplyObjectFunctions *_fn;
+  void *_privdata;
+
+  //不允许拷贝和赋值操作
+  RedisReplyArenaScope(const RedisReplyArenaScope &other);
+  RedisReplyArenaScope& operator= (const RedisReplyArenaScope &other);
+};
+
+#endif
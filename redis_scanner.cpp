@@ -0,0 +1,322 @@
+
+#include "Logger.h"
+#include "redis_scanner.h"
+#include "redis_slot.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+RedisScanner::RedisScanner()
+  : _timeout(0), _db(0), _hash(false), _with_values(false),
+    _node(0), _cursor("0"), _finished(true), _redis_context(NULL) {
+}
+
+RedisScanner::~RedisScanner() {
+  _close();
+}
+
+bool RedisScanner::init(bool cluster, const std::string &server_info,
+    const std::string &password, long timeout) {
+  _close();
+  _nodes.clear();
+  _password = password;
+  _timeout = timeout;
+  _db = 0;
+
+  if (cluster) {
+    return _load_cluster_nodes(server_info);
+  }
+
+  //ip:port:db 或者 ip:port
+  size_t idx1 = server_info.find(':');
+  if (idx1 == std::string::npos) {
+    return false;
+  }
+  Node node;
+  node.host = server_info.substr(0, idx1);
+  node.port = atoi(server_info.c_str() + idx1 + 1);
+  size_t idx2 = server_info.find(':', idx1 + 1);
+  if (idx2 != std::string::npos) {
+    _db = atoi(server_info.c_str() + idx2 + 1);
+  }
+  node.slots.push_back(std::make_pair(0, REDIS_CLUSTER_SLOT_NUM - 1));
+  _nodes.push_back(node);
+  return true;
+}
+
+bool RedisScanner::_load_cluster_nodes(const std::string &server_info) {
+  //依次尝试每个种子节点，直到读到CLUSTER NODES
+  std::stringstream seeds(server_info);
+  std::string seed;
+  while (std::getline(seeds, seed, ',')) {
+    size_t idx = seed.rfind(':');
+    if (idx == std::string::npos) {
+      continue;
+    }
+    Node node;
+    node.host = seed.substr(0, idx);
+    node.port = atoi(seed.c_str() + idx + 1);
+    if (!_connect(node)) {
+      continue;
+    }
+    redisReply *reply = (redisReply *)redisCommand(_redis_context, "CLUSTER NODES");
+    if (reply == NULL || reply->type != REDIS_REPLY_STRING) {
+      freeReplyObject(reply);
+      _close();
+      continue;
+    }
+
+    //<id> <ip:port@cport> <flags> <master> <ping-sent> <pong-recv> <epoch> <link> <slot> ...
+    std::stringstream lines(std::string(reply->str, reply->len));
+    freeReplyObject(reply);
+    _close();
+    std::string line;
+    while (std::getline(lines, line)) {
+      std::stringstream fields(line);
+      std::string id, addr, flags, master, ping, pong, epoch, link, slot;
+      fields >> id >> addr >> flags >> master >> ping >> pong >> epoch >> link;
+      if (flags.find("master") == std::string::npos || flags.find("fail") != std::string::npos) {
+        continue;
+      }
+      size_t at = addr.find('@');
+      if (at != std::string::npos) {
+        addr.erase(at);
+      }
+      idx = addr.rfind(':');
+      if (idx == std::string::npos) {
+        continue;
+      }
+      Node master_node;
+      master_node.host = addr.substr(0, idx);
+      master_node.port = atoi(addr.c_str() + idx + 1);
+      while (fields >> slot) {
+        if (slot[0] == '[') {
+          //正在迁移的slot，数据仍由源节点遍历
+          continue;
+        }
+        size_t dash = slot.find('-');
+        int first = atoi(slot.c_str());
+        int last = dash == std::string::npos ? first : atoi(slot.c_str() + dash + 1);
+        master_node.slots.push_back(std::make_pair(first, last));
+      }
+      if (!master_node.slots.empty()) {
+        _nodes.push_back(master_node);
+      }
+    }
+    if (!_nodes.empty()) {
+      return true;
+    }
+  }
+  LOG_ERROR(debug_log, "redis scanner: load cluster nodes from %s failed", server_info.c_str());
+  return false;
+}
+
+bool RedisScanner::_connect(const Node &node) {
+  _close();
+  if (_timeout > 0) {
+    struct timeval tv;
+    tv.tv_sec = _timeout / 1000;
+    tv.tv_usec = (_timeout % 1000) * 1000;
+    _redis_context = redisConnectWithTimeout(node.host.c_str(), node.port, tv);
+  } else {
+    _redis_context = redisConnect(node.host.c_str(), node.port);
+  }
+  if (_redis_context == NULL || _redis_context->err) {
+    _close();
+    return false;
+  }
+  redisEnableKeepAlive(_redis_context);
+
+  redisReply *reply = NULL;
+  if (!_password.empty()) {
+    //需要密码验证
+    reply = (redisReply *)redisCommand(_redis_context, "AUTH %s", _password.c_str());
+    bool bval = reply != NULL && reply->type == REDIS_REPLY_STATUS && strcmp(reply->str, "OK") == 0;
+    freeReplyObject(reply);
+    if (!bval) {
+      _close();
+      return false;
+    }
+  }
+
+  if (_db != 0) {
+    //切换到指定db
+    reply = (redisReply *)redisCommand(_redis_context, "SELECT %d", _db);
+    bool bval = reply != NULL && reply->type == REDIS_REPLY_STATUS && strcmp(reply->str, "OK") == 0;
+    freeReplyObject(reply);
+    if (!bval) {
+      _close();
+      return false;
+    }
+  }
+  return true;
+}
+
+void RedisScanner::_close() {
+  if (_redis_context != NULL) {
+    redisFree(_redis_context);
+    _redis_context = NULL;
+  }
+}
+
+void RedisScanner::scan(const std::string &pattern, int count, bool with_values) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%d", count > 0 ? count : 10);
+  _close();
+  _hash = false;
+  _key.clear();
+  _pattern = pattern;
+  _count = buf;
+  _with_values = with_values;
+  _node = 0;
+  _cursor = "0";
+  _finished = _nodes.empty();
+}
+
+void RedisScanner::hscan(const std::string &key, const std::string &pattern, int count) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%d", count > 0 ? count : 10);
+  _close();
+  _hash = true;
+  _key = key;
+  _pattern = pattern;
+  _count = buf;
+  _with_values = true;
+  _cursor = "0";
+  _finished = true;
+
+  //只遍历key所在的节点
+  int slot = redis_key_slot(key);
+  for (size_t i = 0; i < _nodes.size() && _finished; ++i) {
+    for (size_t j = 0; j < _nodes[i].slots.size(); ++j) {
+      if (slot >= _nodes[i].slots[j].first && slot <= _nodes[i].slots[j].second) {
+        _node = i;
+        _finished = false;
+        break;
+      }
+    }
+  }
+}
+
+bool RedisScanner::_append_scan(const std::string &cursor) {
+  std::vector<const char *> argv;
+  std::vector<size_t> argv_len;
+  if (_hash) {
+    argv.push_back("HSCAN");
+    argv_len.push_back(5);
+    argv.push_back(_key.c_str());
+    argv_len.push_back(_key.length());
+  } else {
+    argv.push_back("SCAN");
+    argv_len.push_back(4);
+  }
+  argv.push_back(cursor.c_str());
+  argv_len.push_back(cursor.length());
+  if (!_pattern.empty()) {
+    argv.push_back("MATCH");
+    argv_len.push_back(5);
+    argv.push_back(_pattern.c_str());
+    argv_len.push_back(_pattern.length());
+  }
+  argv.push_back("COUNT");
+  argv_len.push_back(5);
+  argv.push_back(_count.c_str());
+  argv_len.push_back(_count.length());
+  return redisAppendCommandArgv(_redis_context, argv.size(), &argv[0], &argv_len[0]) == REDIS_OK;
+}
+
+int RedisScanner::_read_page(std::vector<std::string> &keys, std::vector<std::string> &values,
+    std::string &cursor) {
+  redisReply *reply = NULL;
+  if (redisGetReply(_redis_context, (void **)&reply) != REDIS_OK || reply == NULL) {
+    return -1;
+  }
+  //[cursor, [key0, key1, ...]]，HSCAN为[cursor, [field0, value0, ...]]
+  if (reply->type != REDIS_REPLY_ARRAY || reply->elements != 2
+      || reply->element[0]->type != REDIS_REPLY_STRING
+      || reply->element[1]->type != REDIS_REPLY_ARRAY) {
+    LOG_ERROR(debug_log, "redis scanner: unexpected scan reply, %s",
+        reply->type == REDIS_REPLY_ERROR ? reply->str : "bad format");
+    freeReplyObject(reply);
+    return -1;
+  }
+  cursor.assign(reply->element[0]->str, reply->element[0]->len);
+  redisReply *page = reply->element[1];
+  size_t step = _hash ? 2 : 1;
+  for (size_t i = 0; i + step <= page->elements; i += step) {
+    keys.push_back(std::string(page->element[i]->str, page->element[i]->len));
+    if (_hash) {
+      values.push_back(std::string(page->element[i + 1]->str, page->element[i + 1]->len));
+    }
+  }
+  freeReplyObject(reply);
+
+  if (!_hash && _with_values) {
+    //本页的GET和下一页的SCAN一起发出
+    for (size_t i = 0; i < keys.size(); ++i) {
+      if (redisAppendCommand(_redis_context, "GET %b", keys[i].c_str(), keys[i].size()) != REDIS_OK) {
+        return -1;
+      }
+    }
+  }
+  if (cursor != "0" && !_append_scan(cursor)) {
+    return -1;
+  }
+
+  if (!_hash && _with_values) {
+    values.resize(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+      reply = NULL;
+      if (redisGetReply(_redis_context, (void **)&reply) != REDIS_OK || reply == NULL) {
+        return -1;
+      }
+      if (reply->type == REDIS_REPLY_STRING) {
+        values[i].assign(reply->str, reply->len);
+      }
+      //key已经被删除或者不是字符串类型时为""
+      freeReplyObject(reply);
+    }
+  }
+  return 0;
+}
+
+int RedisScanner::next(std::vector<std::string> &keys, std::vector<std::string> &values) {
+  keys.clear();
+  values.clear();
+  while (!_finished) {
+    if (_redis_context == NULL) {
+      //新的节点或者出错后重连，从_cursor继续
+      if (!_connect(_nodes[_node]) || !_append_scan(_cursor)) {
+        _close();
+        return -1;
+      }
+    }
+
+    std::string cursor;
+    if (_read_page(keys, values, cursor) != 0) {
+      //下次从本页重新开始
+      LOG_ERROR(debug_log, "redis scanner: read page from %s:%d failed, cursor=%s",
+          _nodes[_node].host.c_str(), _nodes[_node].port, _cursor.c_str());
+      _close();
+      keys.clear();
+      values.clear();
+      return -1;
+    }
+
+    if (cursor == "0") {
+      //当前节点遍历结束
+      _close();
+      _cursor = "0";
+      if (_hash || ++_node >= _nodes.size()) {
+        _finished = true;
+      }
+    } else {
+      _cursor = cursor;
+    }
+    if (!keys.empty()) {
+      return 0;
+    }
+  }
+  return 1;
+}
@@ -0,0 +1,116 @@
+
+#ifndef AFANTI_REDIS_SCANNER_H_
+#define AFANTI_REDIS_SCANNER_H_
+
+#include <hircluster.h>
+#include <string>
+#include <vector>
+
+/**
+ * RedisScanner
+ * 基于SCAN/HSCAN逐页遍历key（或hash的field），每次next只持有一页数据，
+ * 遍历千万级的key也不需要KEYS *或者把所有数据读入内存。
+ * 读取value时，一页key的GET和下一页的SCAN在一次写操作中pipeline发出，每页一次往返。
+ * 集群模式下依次遍历每个master节点（通过CLUSTER NODES获取）。
+ * 出错后再次调用next从出错的那一页重新开始，SCAN保证不丢key，但可能重复。
+ * @note 线程不安全；使用独立的连接，不影响RedisClient
+ **/
+class RedisScanner {
+
+public:
+
+  RedisScanner();
+
+  ~RedisScanner();
+
+  /**
+   * @brief 初始化方法，获取需要遍历的节点，不建立连接
+   * @param [in]  cluster，true：server_info为集群格式 ip0:port0,ip1:port1,...
+   * @param [in]  server_info，非集群格式 ip:port:db or ip:port
+   * @param [in]  password
+   * @param [in]  timeout，连接server的超时时间（单位ms）：<=0，无超时判断
+   * @return bool
+   **/
+  bool init(bool cluster, const std::string &server_info,
+      const std::string &password = "", long timeout = 0);
+
+  /**
+   * @brief 开始遍历所有key
+   * @param [in]  pattern，SCAN的MATCH参数：为空，不过滤
+   * @param [in]  count，SCAN的COUNT参数，每页key数量的参考值
+   * @param [in]  with_values，true：同时读取value，不是字符串类型的key的value为""
+   **/
+  void scan(const std::string &pattern = "", int count = 1000, bool with_values = true);
+
+  /**
+   * @brief 开始遍历一个hash的所有field
+   * @param [in]  key
+   * @param [in]  pattern，HSCAN的MATCH参数：为空，不过滤
+   * @param [in]  count，HSCAN的COUNT参数
+   **/
+  void hscan(const std::string &key, const std::string &pattern = "", int count = 1000);
+
+  /**
+   * @brief 读取下一页，不会返回空页
+   * @param [out] keys，scan时为key，hscan时为field
+   * @param [out] values，scan时with_values为false则为空
+   * @return int
+   *  0：读取成功
+   *  1：遍历结束
+   *  -1：redis-server执行命令失败，可以再次调用next重试
+   **/
+  int next(std::vector<std::string> &keys, std::vector<std::string> &values);
+
+private:
+
+  struct Node {
+    std::string host;
+    int port;
+    //该节点负责的slot范围，[first, second]
+    std::vector<std::pair<int, int> > slots;
+  };
+
+  bool _load_cluster_nodes(const std::string &server_info);
+
+  bool _connect(const Node &node);
+
+  void _close();
+
+  /**
+   * @brief 追加一条SCAN/HSCAN命令，不发出
+   **/
+  bool _append_scan(const std::string &cursor);
+
+  /**
+   * @brief 读取一页，cursor为下一页的cursor
+   **/
+  int _read_page(std::vector<std::string> &keys, std::vector<std::string> &values,
+      std::string &cursor);
+
+  //不允许拷贝和赋值操作
+  RedisScanner(const RedisScanner &other);
+  RedisScanner& operator= (const RedisScanner &other);
+
+private:
+
+  std::vector<Node> _nodes;
+  std::string _password;
+  long _timeout;
+  int _db;
+
+  //本次遍历的参数
+  bool _hash;
+  std::string _key;
+  std::string _pattern;
+  std::string _count;
+  bool _with_values;
+
+  //当前遍历的节点和已经发出的SCAN的cursor
+  size_t _node;
+  std::string _cursor;
+  bool _finished;
+
+  redisContext *_redis_context;
+};
+
+#endif
@@ -0,0 +1,111 @@
+
+#include "redis_script.h"
+#include "AutoLock.h"
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+
+/**
+ * @brief 计算SHA1，返回40个字符的小写十六进制
+ **/
+static std::string sha1_hex(const std::string &data) {
+  uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+  //补位：0x80，若干0，64位大端的比特长度，总长度为64的倍数
+  std::string msg(data);
+  uint64_t bits = (uint64_t)data.size() * 8;
+  msg.push_back((char)0x80);
+  while (msg.size() % 64 != 56) {
+    msg.push_back('\0');
+  }
+  for (int i = 7; i >= 0; --i) {
+    msg.push_back((char)((bits >> (8 * i)) & 0xFF));
+  }
+
+  uint32_t w[80];
+  for (size_t block = 0; block < msg.size(); block += 64) {
+    const unsigned char *p = (const unsigned char *)msg.data() + block;
+    for (int i = 0; i < 16; ++i) {
+      w[i] = ((uint32_t)p[4 * i] << 24) | ((uint32_t)p[4 * i + 1] << 16)
+          | ((uint32_t)p[4 * i + 2] << 8) | (uint32_t)p[4 * i + 3];
+    }
+    for (int i = 16; i < 80; ++i) {
+      uint32_t x = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+      w[i] = (x << 1) | (x >> 31);
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; ++i) {
+      uint32_t f = 0, k = 0;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      uint32_t t = ((a << 5) | (a >> 27)) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = (b << 30) | (b >> 2);
+      b = a;
+      a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+
+  char hex[41];
+  for (int i = 0; i < 5; ++i) {
+    snprintf(hex + 8 * i, 9, "%08x", h[i]);
+  }
+  return std::string(hex, 40);
+}
+
+RedisScript::RedisScript(const std::string &source)
+  : _source(source), _sha(sha1_hex(source)) {
+}
+
+RedisScriptRegistry& RedisScriptRegistry::instance() {
+  //第一次调用发生在多线程启动之前（一般在初始化时注册脚本）
+  static RedisScriptRegistry registry;
+  return registry;
+}
+
+RedisScriptRegistry::~RedisScriptRegistry() {
+  for (std::map<std::string, RedisScript *>::iterator it = _scripts.begin();
+      it != _scripts.end(); ++it) {
+    delete it->second;
+  }
+  for (size_t i = 0; i < _replaced.size(); ++i) {
+    delete _replaced[i];
+  }
+}
+
+const RedisScript* RedisScriptRegistry::add(const std::string &name, const std::string &source) {
+  RedisScript *script = new RedisScript(source);
+  AutoLock<Mutex> lock(&_mutex);
+  std::map<std::string, RedisScript *>::iterator it = _scripts.find(name);
+  if (it != _scripts.end()) {
+    _replaced.push_back(it->second);
+    it->second = script;
+  } else {
+    _scripts[name] = script;
+  }
+  return script;
+}
+
+const RedisScript* RedisScriptRegistry::find(const std::string &name) {
+  AutoLock<Mutex> lock(&_mutex);
+  std::map<std::string, RedisScript *>::iterator it = _scripts.find(name);
+  return it == _scripts.end() ? NULL : it->second;
+}
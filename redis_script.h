@@ -0,0 +1,92 @@
+
+#ifndef AFANTI_REDIS_SCRIPT_H_
+#define AFANTI_REDIS_SCRIPT_H_
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "Mutex.h"
+
+/**
+ * RedisScript
+ * 一个Lua脚本，构造时在本地计算SHA1，调用时先EVALSHA，
+ * 脚本不在server的缓存中（NOSCRIPT）时用EVAL发送源码，之后server缓存该脚本
+ **/
+class RedisScript {
+
+public:
+
+  explicit RedisScript(const std::string &source);
+
+  const std::string& source() const {
+    return _source;
+  }
+
+  /**
+   * @brief 40个字符的小写十六进制SHA1，与SCRIPT LOAD的返回值一致
+   **/
+  const std::string& sha() const {
+    return _sha;
+  }
+
+private:
+
+  std::string _source;
+  std::string _sha;
+};
+
+/**
+ * RedisScriptCall
+ * 批量调用脚本时的一次调用，集群模式下所有keys必须在同一个slot
+ **/
+struct RedisScriptCall {
+  std::vector<std::string> keys;
+  std::vector<std::string> args;
+};
+
+/**
+ * RedisScriptRegistry
+ * 按名字注册脚本，进程内所有RedisClient共享，注册后的脚本不会释放
+ * @note 线程安全
+ **/
+class RedisScriptRegistry {
+
+public:
+
+  /**
+   * @brief 进程内共享的实例
+   **/
+  static RedisScriptRegistry& instance();
+
+  ~RedisScriptRegistry();
+
+  /**
+   * @brief 注册脚本，同名脚本已经存在时替换为新的源码
+   * @return const RedisScript*，在registry的生命周期内有效
+   **/
+  const RedisScript* add(const std::string &name, const std::string &source);
+
+  /**
+   * @brief 查找脚本
+   * @return const RedisScript*，NULL：没有注册
+   **/
+  const RedisScript* find(const std::string &name);
+
+private:
+
+  RedisScriptRegistry() {}
+
+  //不允许拷贝和赋值操作
+  RedisScriptRegistry(const RedisScriptRegistry &other);
+  RedisScriptRegistry& operator= (const RedisScriptRegistry &other);
+
+private:
+
+  Mutex _mutex;
+  std::map<std::string, RedisScript *> _scripts;
+  //被替换的旧脚本，调用方可能仍持有指针，不释放
+  std::vector<RedisScript *> _replaced;
+};
+
+#endif
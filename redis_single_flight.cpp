@@ -0,0 +1,101 @@
+
+#include "redis_single_flight.h"
+#include <cstdio>
+
+RedisSingleFlight::RedisSingleFlight() : _shared(0) {
+  pthread_mutex_init(&_mutex, NULL);
+}
+
+RedisSingleFlight::~RedisSingleFlight() {
+  pthread_mutex_destroy(&_mutex);
+}
+
+int RedisSingleFlight::get(RedisClient *client, const std::string &key, std::string &value) {
+  if (key.empty()) {
+    return -2;
+  }
+  std::string flight_key("GET");
+  flight_key.push_back('\0');
+  flight_key.append(key);
+  return _do(flight_key, RedisSingleFlight::_get, client, key, "", value);
+}
+
+int RedisSingleFlight::hget(RedisClient *client, const std::string &key,
+    const std::string &h_key, std::string &h_value) {
+  if (key.empty() || h_key.empty()) {
+    return -2;
+  }
+  //key中可能包含任意字节，用长度前缀区分key和h_key的边界
+  char len[16];
+  snprintf(len, sizeof(len), "%u", (unsigned int)key.length());
+  std::string flight_key("HGET");
+  flight_key.push_back('\0');
+  flight_key.append(len);
+  flight_key.push_back('\0');
+  flight_key.append(key);
+  flight_key.append(h_key);
+  return _do(flight_key, RedisSingleFlight::_hget, client, key, h_key, h_value);
+}
+
+int RedisSingleFlight::_do(const std::string &flight_key, Fetch fetch, RedisClient *client,
+    const std::string &key, const std::string &h_key, std::string &value) {
+  pthread_mutex_lock(&_mutex);
+  std::map<std::string, Call *>::iterator it = _calls.find(flight_key);
+  if (it != _calls.end()) {
+    //已经有线程在读取该key，等待其结果
+    Call *call = it->second;
+    ++call->refs;
+    while (!call->done) {
+      pthread_cond_wait(&call->cond, &_mutex);
+    }
+    int ret = call->ret;
+    if (ret == 0) {
+      value = call->value;
+    }
+    bool last = --call->refs == 0;
+    pthread_mutex_unlock(&_mutex);
+    __sync_fetch_and_add(&_shared, 1);
+    if (last) {
+      pthread_cond_destroy(&call->cond);
+      delete call;
+    }
+    return ret;
+  }
+
+  Call *call = new Call;
+  pthread_cond_init(&call->cond, NULL);
+  call->done = false;
+  call->ret = -1;
+  call->refs = 1;
+  _calls[flight_key] = call;
+  pthread_mutex_unlock(&_mutex);
+
+  int ret = fetch(client, key, h_key, value);
+
+  pthread_mutex_lock(&_mutex);
+  //结果返回后新的请求重新读取redis，不会读到旧值
+  _calls.erase(flight_key);
+  call->ret = ret;
+  if (call->refs > 1 && ret == 0) {
+    call->value = value;
+  }
+  call->done = true;
+  pthread_cond_broadcast(&call->cond);
+  bool last = --call->refs == 0;
+  pthread_mutex_unlock(&_mutex);
+  if (last) {
+    pthread_cond_destroy(&call->cond);
+    delete call;
+  }
+  return ret;
+}
+
+int RedisSingleFlight::_get(RedisClient *client, const std::string &key,
+    const std::string &h_key, std::string &value) {
+  return client->get(key, value);
+}
+
+int RedisSingleFlight::_hget(RedisClient *client, const std::string &key,
+    const std::string &h_key, std::string &value) {
+  return client->hget(key, h_key, value);
+}
@@ -0,0 +1,74 @@
+
+#ifndef AFANTI_REDIS_SINGLE_FLIGHT_H_
+#define AFANTI_REDIS_SINGLE_FLIGHT_H_
+
+#include <pthread.h>
+#include <string>
+#include <map>
+#include "redis_client.h"
+
+/**
+ * RedisSingleFlight
+ * 合并对同一个key的并发读取：同一命令+key同一时刻只有一个请求发往redis，
+ * 其他线程等待并共享该请求的结果，缓解热点key失效时的并发穿透。
+ * @note 线程安全；各线程使用自己的client，执行请求的线程使用自己的client
+ **/
+class RedisSingleFlight {
+
+public:
+
+  RedisSingleFlight();
+
+  ~RedisSingleFlight();
+
+  /**
+   * @brief 参数和返回值与RedisClient::get一致
+   **/
+  int get(RedisClient *client, const std::string &key, std::string &value);
+
+  /**
+   * @brief 参数和返回值与RedisClient::hget一致
+   **/
+  int hget(RedisClient *client, const std::string &key, const std::string &h_key,
+      std::string &h_value);
+
+  /**
+   * @brief 统计信息，共享了其他线程请求结果的次数
+   **/
+  long shared() { return _shared; }
+
+private:
+
+  typedef int (*Fetch)(RedisClient *client, const std::string &key,
+      const std::string &h_key, std::string &value);
+
+  struct Call {
+    pthread_cond_t cond;
+    bool done;
+    int ret;
+    std::string value;
+    //等待结果的线程数（包括执行请求的线程）
+    int refs;
+  };
+
+  int _do(const std::string &flight_key, Fetch fetch, RedisClient *client,
+      const std::string &key, const std::string &h_key, std::string &value);
+
+  static int _get(RedisClient *client, const std::string &key,
+      const std::string &h_key, std::string &value);
+
+  static int _hget(RedisClient *client, const std::string &key,
+      const std::string &h_key, std::string &value);
+
+  //不允许拷贝和赋值操作
+  RedisSingleFlight(const RedisSingleFlight &other);
+  RedisSingleFlight& operator= (const RedisSingleFlight &other);
+
+private:
+
+  pthread_mutex_t _mutex;
+  std::map<std::string, Call *> _calls;
+  volatile long _shared;
+};
+
+#endif
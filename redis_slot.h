@@ -0,0 +1,34 @@
+
+#ifndef AFANTI_REDIS_SLOT_H_
+#define AFANTI_REDIS_SLOT_H_
+
+#include <string>
+#include <vector>
+#include <utility>
+
+const int REDIS_CLUSTER_SLOT_NUM = 16384;
+
+/**
+ * @brief 计算key在redis集群中的hash slot，规则与redis-server一致：
+ *        key中包含非空的{tag}时只对第一个tag计算CRC16
+ * @param [in]  key
+ * @param [in]  len
+ * @return unsigned int，[0, REDIS_CLUSTER_SLOT_NUM)
+ **/
+unsigned int redis_key_slot(const char *key, size_t len);
+
+inline unsigned int redis_key_slot(const std::string &key) {
+  return redis_key_slot(key.c_str(), key.length());
+}
+
+/**
+ * @brief 对keys中下标为indexes的key按hash slot分组
+ * @param [in]  keys
+ * @param [in]  indexes，参与分组的key的下标
+ * @param [out] groups，每个元素为<slot, keys中的下标>，按slot排序，同一slot的下标连续且按从小到大排列
+ * @param [out] starts，每组在groups中的起始位置，最后一个元素为groups.size()
+ **/
+void redis_group_by_slot(const std::vector<std::string> &keys, const std::vector<int> &indexes,
+    std::vector<std::pair<unsigned int, int> > &groups, std::vector<size_t> &starts);
+
+#endif
@@ -0,0 +1,186 @@
+
+#include "redis_stats.h"
+#include <cstdio>
+#include <cstring>
+
+volatile bool RedisStats::_enabled = true;
+RedisStats::ThreadBlock *volatile RedisStats::_blocks = NULL;
+std::vector<RedisStats::ThreadBlock *> RedisStats::_free_blocks;
+pthread_mutex_t RedisStats::_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t RedisStats::_key;
+pthread_once_t RedisStats::_once = PTHREAD_ONCE_INIT;
+
+static const char *COMMAND_NAMES[REDIS_CMD_NUM] = {
+  "SET", "GET", "MSET", "MGET", "HSET", "HGET", "HMSET", "DEL", "HMGET", "HGETALL", "EVAL",
+  "SCRIPT LOAD"
+};
+
+unsigned long long RedisCommandStats::percentile(double p) const {
+  unsigned long long total = 0;
+  for (int i = 0; i < REDIS_LATENCY_BUCKETS; ++i) {
+    total += latency_hist[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  unsigned long long rank = (unsigned long long)(p * total);
+  unsigned long long count = 0;
+  for (int i = 0; i < REDIS_LATENCY_BUCKETS; ++i) {
+    count += latency_hist[i];
+    if (count > rank) {
+      return 1ULL << (i + 1);
+    }
+  }
+  return 1ULL << REDIS_LATENCY_BUCKETS;
+}
+
+void RedisStats::_create_key() {
+  pthread_key_create(&_key, RedisStats::_release);
+}
+
+void RedisStats::_release(void *block) {
+  pthread_mutex_lock(&_mutex);
+  _free_blocks.push_back((ThreadBlock *)block);
+  pthread_mutex_unlock(&_mutex);
+}
+
+RedisStats::ThreadBlock* RedisStats::_local() {
+  pthread_once(&_once, RedisStats::_create_key);
+  ThreadBlock *block = (ThreadBlock *)pthread_getspecific(_key);
+  if (block != NULL) {
+    return block;
+  }
+
+  pthread_mutex_lock(&_mutex);
+  if (!_free_blocks.empty()) {
+    //计数器继续累加，保证抓取到的值单调递增
+    block = _free_blocks.back();
+    _free_blocks.pop_back();
+  } else {
+    block = new ThreadBlock;
+    memset(block, 0, sizeof(ThreadBlock));
+    block->current = REDIS_CMD_NUM;
+    block->next = _blocks;
+    __sync_synchronize();
+    _blocks = block;
+  }
+  pthread_mutex_unlock(&_mutex);
+  pthread_setspecific(_key, block);
+  return block;
+}
+
+void RedisStats::snapshot(std::vector<RedisCommandStats> &stats) {
+  RedisCommandStats empty;
+  memset(&empty, 0, sizeof(empty));
+  stats.assign(REDIS_CMD_NUM, empty);
+  for (ThreadBlock *block = _blocks; block != NULL; block = block->next) {
+    for (int c = 0; c < REDIS_CMD_NUM; ++c) {
+      const ThreadStats &from = block->commands[c];
+      RedisCommandStats &to = stats[c];
+      to.calls += from.calls;
+      to.errors += from.errors;
+      to.keys += from.keys;
+      to.bytes_out += from.bytes_out;
+      to.bytes_in += from.bytes_in;
+      to.retries += from.retries;
+      to.reconnects += from.reconnects;
+      to.latency_us += from.latency_us;
+      for (int i = 0; i < REDIS_LATENCY_BUCKETS; ++i) {
+        to.latency_hist[i] += from.latency_hist[i];
+      }
+    }
+  }
+}
+
+std::string RedisStats::dump() {
+  std::vector<RedisCommandStats> stats;
+  snapshot(stats);
+
+  std::string out;
+  char line[256];
+  for (int c = 0; c < REDIS_CMD_NUM; ++c) {
+    const RedisCommandStats &s = stats[c];
+    if (s.calls == 0) {
+      continue;
+    }
+    const char *name = COMMAND_NAMES[c];
+    snprintf(line, sizeof(line),
+        "redis_calls{cmd=\"%s\"} %llu\n"
+        "redis_errors{cmd=\"%s\"} %llu\n"
+        "redis_keys{cmd=\"%s\"} %llu\n"
+        "redis_bytes_out{cmd=\"%s\"} %llu\n",
+        name, s.calls, name, s.errors, name, s.keys, name, s.bytes_out);
+    out += line;
+    snprintf(line, sizeof(line),
+        "redis_bytes_in{cmd=\"%s\"} %llu\n"
+        "redis_retries{cmd=\"%s\"} %llu\n"
+        "redis_reconnects{cmd=\"%s\"} %llu\n"
+        "redis_latency_us{cmd=\"%s\"} %llu\n",
+        name, s.bytes_in, name, s.retries, name, s.reconnects, name, s.latency_us);
+    out += line;
+    snprintf(line, sizeof(line),
+        "redis_latency_p50_us{cmd=\"%s\"} %llu\n"
+        "redis_latency_p99_us{cmd=\"%s\"} %llu\n"
+        "redis_latency_p999_us{cmd=\"%s\"} %llu\n",
+        name, s.percentile(0.5), name, s.percentile(0.99), name, s.percentile(0.999));
+    out += line;
+  }
+  return out;
+}
+
+const char* RedisStats::command_name(int cmd) {
+  if (cmd < 0 || cmd >= REDIS_CMD_NUM) {
+    return "UNKNOWN";
+  }
+  return COMMAND_NAMES[cmd];
+}
+
+void RedisStats::retry() {
+  if (!_enabled) {
+    return;
+  }
+  ThreadBlock *block = _local();
+  if (block->current < REDIS_CMD_NUM) {
+    block->commands[block->current].retries += 1;
+  }
+}
+
+void RedisStats::reconnect() {
+  if (!_enabled) {
+    return;
+  }
+  ThreadBlock *block = _local();
+  if (block->current < REDIS_CMD_NUM) {
+    block->commands[block->current].reconnects += 1;
+  }
+}
+
+RedisStatsScope::~RedisStatsScope() {
+  if (_block == NULL) {
+    return;
+  }
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  long long us = (end.tv_sec - _begin.tv_sec) * 1000000LL
+      + (end.tv_nsec - _begin.tv_nsec) / 1000;
+  if (us < 0) {
+    us = 0;
+  }
+
+  //[2^i, 2^(i+1)) us落在第i个桶，小于1us的算在第0个桶
+  int bucket = us > 1 ? 63 - __builtin_clzll((unsigned long long)us) : 0;
+  if (bucket >= REDIS_LATENCY_BUCKETS) {
+    bucket = REDIS_LATENCY_BUCKETS - 1;
+  }
+
+  RedisStats::ThreadStats &stats = _block->commands[_cmd];
+  stats.calls += 1;
+  if (_ret < 0) {
+    stats.errors += 1;
+  }
+  stats.bytes_out += _bytes_out;
+  stats.bytes_in += _bytes_in;
+  stats.latency_us += us;
+  stats.latency_hist[bucket] += 1;
+  _block->current = _prev;
+}
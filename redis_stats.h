@@ -0,0 +1,195 @@
+
+#ifndef AFANTI_REDIS_STATS_H_
+#define AFANTI_REDIS_STATS_H_
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <time.h>
+
+enum RedisCommandType {
+  REDIS_CMD_SET = 0,
+  REDIS_CMD_GET,
+  REDIS_CMD_MSET,
+  REDIS_CMD_MGET,
+  REDIS_CMD_HSET,
+  REDIS_CMD_HGET,
+  REDIS_CMD_HMSET,
+  REDIS_CMD_DEL,
+  REDIS_CMD_HMGET,
+  REDIS_CMD_HGETALL,
+  REDIS_CMD_EVAL,
+  REDIS_CMD_SCRIPT_LOAD,
+  REDIS_CMD_NUM
+};
+
+//延迟直方图的桶数，第i个桶为[2^i, 2^(i+1)) us，最后一个桶包含更大的值
+const int REDIS_LATENCY_BUCKETS = 24;
+
+/**
+ * RedisCommandStats
+ * 某个命令的累计统计，由RedisStats::snapshot汇总所有线程得到
+ **/
+struct RedisCommandStats {
+  //调用次数，返回值<0的次数
+  unsigned long long calls;
+  unsigned long long errors;
+  //批量操作的key（field）个数之和
+  unsigned long long keys;
+  //发送的key/value字节数，读到的value字节数
+  unsigned long long bytes_out;
+  unsigned long long bytes_in;
+  //集群批量操作重试的轮数，请求失败后的重连次数
+  unsigned long long retries;
+  unsigned long long reconnects;
+  //总耗时（单位us）
+  unsigned long long latency_us;
+  unsigned long long latency_hist[REDIS_LATENCY_BUCKETS];
+
+  /**
+   * @brief 按直方图估算的延迟分位数（单位us），取所在桶的上界
+   * @param [in]  p，0~1，例如0.99
+   **/
+  unsigned long long percentile(double p) const;
+};
+
+/**
+ * RedisStats
+ * RedisClient各命令的延迟、数据量、批量大小、重试和重连统计。
+ * 每个线程只写自己的计数器，不加锁也没有原子操作；
+ * snapshot/dump汇总所有线程（包括已经退出的线程）的计数器，可以定期抓取。
+ * @note 线程安全；抓取到的是近似值，计数器只增不减
+ **/
+class RedisStats {
+
+public:
+
+  /**
+   * @brief 打开/关闭统计，默认打开
+   **/
+  static void set_enabled(bool enabled) {
+    _enabled = enabled;
+  }
+
+  static bool enabled() {
+    return _enabled;
+  }
+
+  /**
+   * @brief 汇总所有线程的统计
+   * @param [out] stats，下标为RedisCommandType
+   **/
+  static void snapshot(std::vector<RedisCommandStats> &stats);
+
+  /**
+   * @brief 所有命令的统计，每行一个指标，格式为 redis_<指标>{cmd="GET"} <值>
+   **/
+  static std::string dump();
+
+  static const char* command_name(int cmd);
+
+  /**
+   * @brief 记录当前线程正在执行的命令的一次重试/重连
+   **/
+  static void retry();
+  static void reconnect();
+
+private:
+
+  friend class RedisStatsScope;
+
+  struct ThreadStats {
+    volatile unsigned long long calls;
+    volatile unsigned long long errors;
+    volatile unsigned long long keys;
+    volatile unsigned long long bytes_out;
+    volatile unsigned long long bytes_in;
+    volatile unsigned long long retries;
+    volatile unsigned long long reconnects;
+    volatile unsigned long long latency_us;
+    volatile unsigned long long latency_hist[REDIS_LATENCY_BUCKETS];
+  };
+
+  struct ThreadBlock {
+    ThreadStats commands[REDIS_CMD_NUM];
+    //当前正在执行的命令，REDIS_CMD_NUM表示没有
+    int current;
+    ThreadBlock *next;
+  };
+
+  /**
+   * @brief 当前线程的计数器，第一次调用时分配，线程退出后留给新线程复用
+   **/
+  static ThreadBlock* _local();
+
+  static void _create_key();
+
+  static void _release(void *block);
+
+  static volatile bool _enabled;
+
+  //所有线程的计数器，只增加不释放，抓取时不需要加锁遍历
+  static ThreadBlock *volatile _blocks;
+  //已经退出的线程留下的计数器，新线程优先复用
+  static std::vector<ThreadBlock *> _free_blocks;
+  static pthread_mutex_t _mutex;
+  static pthread_key_t _key;
+  static pthread_once_t _once;
+};
+
+/**
+ * RedisStatsScope
+ * 在命令方法的作用域内计时，析构时记录到当前线程的计数器
+ **/
+class RedisStatsScope {
+
+public:
+
+  explicit RedisStatsScope(RedisCommandType cmd, size_t keys = 1)
+    : _block(NULL), _cmd(cmd), _ret(-1), _bytes_out(0), _bytes_in(0) {
+    if (!RedisStats::_enabled) {
+      return;
+    }
+    _block = RedisStats::_local();
+    _prev = _block->current;
+    _block->current = cmd;
+    _block->commands[cmd].keys += keys;
+    clock_gettime(CLOCK_MONOTONIC, &_begin);
+  }
+
+  ~RedisStatsScope();
+
+  void add_bytes_out(size_t bytes) {
+    _bytes_out += bytes;
+  }
+
+  void add_bytes_in(size_t bytes) {
+    _bytes_in += bytes;
+  }
+
+  /**
+   * @brief 记录命令的返回值并原样返回，没有调用时按失败统计
+   **/
+  int done(int ret) {
+    _ret = ret;
+    return ret;
+  }
+
+private:
+
+  //不允许拷贝和赋值操作
+  RedisStatsScope(const RedisStatsScope &other);
+  RedisStatsScope& operator= (const RedisStatsScope &other);
+
+private:
+
+  RedisStats::ThreadBlock *_block;
+  RedisCommandType _cmd;
+  int _prev;
+  int _ret;
+  size_t _bytes_out;
+  size_t _bytes_in;
+  struct timespec _begin;
+};
+
+#endif
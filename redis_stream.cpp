@@ -0,0 +1,431 @@
+
+#include "Logger.h"
+#include "redis_stream.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+
+bool RedisStreamConnection::init(const std::string &server_info, const std::string &password,
+    long timeout) {
+  _close();
+  _password = password;
+  _timeout = timeout;
+
+  //ip:port:db 或者 ip:port
+  size_t idx1 = server_info.find(':');
+  if (idx1 == std::string::npos) {
+    return false;
+  }
+  _host = server_info.substr(0, idx1);
+  _port = atoi(server_info.c_str() + idx1 + 1);
+  size_t idx2 = server_info.find(':', idx1 + 1);
+  _db = idx2 == std::string::npos ? 0 : atoi(server_info.c_str() + idx2 + 1);
+  return _connect();
+}
+
+bool RedisStreamConnection::_connect() {
+  _close();
+  if (_timeout > 0) {
+    struct timeval tv;
+    tv.tv_sec = _timeout / 1000;
+    tv.tv_usec = (_timeout % 1000) * 1000;
+    _redis_context = redisConnectWithTimeout(_host.c_str(), _port, tv);
+    if (_redis_context != NULL && !_redis_context->err) {
+      redisSetTimeout(_redis_context, tv);
+    }
+  } else {
+    _redis_context = redisConnect(_host.c_str(), _port);
+  }
+  if (_redis_context == NULL || _redis_context->err) {
+    LOG_ERROR(debug_log, "redis stream: connect %s:%d failed", _host.c_str(), _port);
+    _close();
+    return false;
+  }
+  redisEnableKeepAlive(_redis_context);
+
+  redisReply *reply = NULL;
+  if (!_password.empty()) {
+    //需要密码验证
+    reply = (redisReply *)redisCommand(_redis_context, "AUTH %s", _password.c_str());
+    bool bval = reply != NULL && reply->type == REDIS_REPLY_STATUS && strcmp(reply->str, "OK") == 0;
+    freeReplyObject(reply);
+    if (!bval) {
+      _close();
+      return false;
+    }
+  }
+  if (_db != 0) {
+    //切换到指定db
+    reply = (redisReply *)redisCommand(_redis_context, "SELECT %d", _db);
+    bool bval = reply != NULL && reply->type == REDIS_REPLY_STATUS && strcmp(reply->str, "OK") == 0;
+    freeReplyObject(reply);
+    if (!bval) {
+      _close();
+      return false;
+    }
+  }
+  return true;
+}
+
+void RedisStreamConnection::_close() {
+  if (_redis_context != NULL) {
+    redisFree(_redis_context);
+    _redis_context = NULL;
+  }
+}
+
+bool RedisStreamConnection::_append(const std::vector<std::string> &argv) {
+  _argv.clear();
+  _argv_len.clear();
+  for (size_t i = 0; i < argv.size(); ++i) {
+    _argv.push_back(argv[i].c_str());
+    _argv_len.push_back(argv[i].length());
+  }
+  return redisAppendCommandArgv(_redis_context, _argv.size(), &_argv[0], &_argv_len[0]) == REDIS_OK;
+}
+
+redisReply* RedisStreamConnection::command(const std::vector<std::string> &argv, long block) {
+  if (_redis_context == NULL && !_connect()) {
+    return NULL;
+  }
+
+  //阻塞命令的读超时延长block，block<0时一直等待
+  bool extend = block != 0 && _timeout > 0;
+  if (extend) {
+    struct timeval tv;
+    long timeout = block > 0 ? _timeout + block : 0;
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+    redisSetTimeout(_redis_context, tv);
+  }
+
+  redisReply *reply = NULL;
+  if (!_append(argv) || redisGetReply(_redis_context, (void **)&reply) != REDIS_OK) {
+    //连接失败，下一次调用时重连
+    freeReplyObject(reply);
+    _close();
+    return NULL;
+  }
+
+  if (extend) {
+    struct timeval tv;
+    tv.tv_sec = _timeout / 1000;
+    tv.tv_usec = (_timeout % 1000) * 1000;
+    redisSetTimeout(_redis_context, tv);
+  }
+  return reply;
+}
+
+bool RedisStreamConnection::pipeline(const std::vector<std::vector<std::string> > &commands,
+    std::vector<redisReply *> &replies) {
+  replies.assign(commands.size(), NULL);
+  if (_redis_context == NULL && !_connect()) {
+    return false;
+  }
+
+  size_t appended = 0;
+  while (appended < commands.size() && _append(commands[appended])) {
+    ++appended;
+  }
+  //第一次redisGetReply时所有命令在一次写操作中发出
+  bool ret = appended == commands.size();
+  for (size_t i = 0; i < appended; ++i) {
+    redisReply *reply = NULL;
+    if (redisGetReply(_redis_context, (void **)&reply) != REDIS_OK) {
+      ret = false;
+      break;
+    }
+    replies[i] = reply;
+  }
+  if (!ret) {
+    _close();
+  }
+  return ret;
+}
+
+RedisStreamProducer::RedisStreamProducer(const std::string &stream, long max_len)
+  : _stream(stream) {
+  if (max_len > 0) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%ld", max_len);
+    _max_len = buf;
+  }
+}
+
+void RedisStreamProducer::_build(const std::string &message, std::vector<std::string> &argv) {
+  argv.clear();
+  argv.push_back("XADD");
+  argv.push_back(_stream);
+  if (!_max_len.empty()) {
+    //近似裁剪，只在整个宏节点可以删除时裁剪，开销远小于精确裁剪
+    argv.push_back("MAXLEN");
+    argv.push_back("~");
+    argv.push_back(_max_len);
+  }
+  argv.push_back("*");
+  argv.push_back("body");
+  argv.push_back(message);
+}
+
+int RedisStreamProducer::push(const std::string &message, int deliver_mode) {
+  std::vector<std::string> argv;
+  _build(message, argv);
+  redisReply *reply = _conn.command(argv);
+  int ret = reply != NULL && reply->type == REDIS_REPLY_STRING ? 0 : -1;
+  if (reply != NULL && reply->type == REDIS_REPLY_ERROR) {
+    LOG_ERROR(debug_log, "redis stream: XADD %s failed, %s", _stream.c_str(), reply->str);
+  }
+  freeReplyObject(reply);
+  return ret;
+}
+
+int RedisStreamProducer::push_batch(const std::vector<std::string> &messages) {
+  if (messages.empty()) {
+    return 0;
+  }
+  std::vector<std::vector<std::string> > commands(messages.size());
+  for (size_t i = 0; i < messages.size(); ++i) {
+    _build(messages[i], commands[i]);
+  }
+
+  std::vector<redisReply *> replies;
+  int ret = _conn.pipeline(commands, replies) ? 0 : -1;
+  for (size_t i = 0; i < replies.size(); ++i) {
+    if (replies[i] == NULL || replies[i]->type != REDIS_REPLY_STRING) {
+      ret = ret == 0 ? -3 : ret;
+    }
+    freeReplyObject(replies[i]);
+  }
+  return ret;
+}
+
+RedisStreamConsumer::RedisStreamConsumer(const std::string &stream, const std::string &group,
+    const std::string &name, int count, long min_idle)
+  : _stream(stream), _group(group), _name(name), _min_idle_ms(min_idle > 0 ? min_idle : 1),
+    _claim_cursor("0-0"), _next_claim(0) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%d", count > 0 ? count : 1);
+  _count = buf;
+  snprintf(buf, sizeof(buf), "%ld", _min_idle_ms);
+  _min_idle = buf;
+}
+
+long long RedisStreamConsumer::_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+bool RedisStreamConsumer::init(const std::string &server_info, const std::string &password,
+    long timeout) {
+  if (!_conn.init(server_info, password, timeout)) {
+    return false;
+  }
+  return _create_group();
+}
+
+bool RedisStreamConsumer::_create_group() {
+  //从第一条消息开始消费，与RabbitMQ的durable队列一致：消费者启动前推送的消息不丢失
+  std::vector<std::string> argv;
+  argv.push_back("XGROUP");
+  argv.push_back("CREATE");
+  argv.push_back(_stream);
+  argv.push_back(_group);
+  argv.push_back("0");
+  argv.push_back("MKSTREAM");
+  redisReply *reply = _conn.command(argv);
+  bool bval = reply != NULL && (reply->type == REDIS_REPLY_STATUS
+      || (reply->type == REDIS_REPLY_ERROR && strncmp(reply->str, "BUSYGROUP", 9) == 0));
+  if (!bval) {
+    LOG_ERROR(debug_log, "redis stream: create group %s on %s failed, %s", _group.c_str(),
+        _stream.c_str(), reply != NULL && reply->type == REDIS_REPLY_ERROR ? reply->str : "");
+  }
+  freeReplyObject(reply);
+  return bval;
+}
+
+void RedisStreamConsumer::_parse_entries(const redisReply *reply,
+    std::vector<std::string> &deleted) {
+  if (reply == NULL || reply->type != REDIS_REPLY_ARRAY) {
+    return;
+  }
+  for (size_t i = 0; i < reply->elements; ++i) {
+    const redisReply *entry = reply->element[i];
+    if (entry->type != REDIS_REPLY_ARRAY || entry->elements < 2
+        || entry->element[0]->type != REDIS_REPLY_STRING) {
+      continue;
+    }
+    std::string id(entry->element[0]->str, entry->element[0]->len);
+    const redisReply *fields = entry->element[1];
+    if (fields->type != REDIS_REPLY_ARRAY) {
+      //消息已经被MAXLEN裁剪，只剩下PEL中的id
+      deleted.push_back(id);
+      continue;
+    }
+    _entries.push_back(Entry());
+    Entry &e = _entries.back();
+    e.id.swap(id);
+    for (size_t j = 0; j + 1 < fields->elements; j += 2) {
+      const redisReply *field = fields->element[j];
+      const redisReply *value = fields->element[j + 1];
+      if (field->type == REDIS_REPLY_STRING && field->len == 4
+          && memcmp(field->str, "body", 4) == 0 && value->type == REDIS_REPLY_STRING) {
+        e.body.assign(value->str, value->len);
+        break;
+      }
+    }
+  }
+}
+
+int RedisStreamConsumer::_claim() {
+  //XAUTOCLAIM stream group name min_idle cursor COUNT count
+  //-> [next_cursor, [[id, [field, value, ...]], ...], [deleted_id, ...]（7.0以上）]
+  std::vector<std::string> argv;
+  argv.push_back("XAUTOCLAIM");
+  argv.push_back(_stream);
+  argv.push_back(_group);
+  argv.push_back(_name);
+  argv.push_back(_min_idle);
+  argv.push_back(_claim_cursor);
+  argv.push_back("COUNT");
+  argv.push_back(_count);
+  redisReply *reply = _conn.command(argv);
+  if (reply == NULL) {
+    return -1;
+  }
+  if (reply->type == REDIS_REPLY_ARRAY && reply->elements >= 2
+      && reply->element[0]->type == REDIS_REPLY_STRING) {
+    _claim_cursor.assign(reply->element[0]->str, reply->element[0]->len);
+    std::vector<std::string> deleted;
+    _parse_entries(reply->element[1], deleted);
+    if (!deleted.empty()) {
+      //已经不存在的消息不会再被投递，直接确认，避免留在PEL中
+      ack(deleted);
+    }
+  } else if (reply->type == REDIS_REPLY_ERROR) {
+    //redis-server低于6.2时不支持XAUTOCLAIM，不影响读取新消息
+    LOG_ERROR(debug_log, "redis stream: XAUTOCLAIM %s failed, %s", _stream.c_str(), reply->str);
+  }
+  freeReplyObject(reply);
+  return 0;
+}
+
+int RedisStreamConsumer::_fill(int timeout) {
+  long long now = _now_ms();
+  if (now >= _next_claim) {
+    //游标回到0-0表示一轮认领结束，等待min_idle后开始下一轮
+    if (_claim() != 0) {
+      return -1;
+    }
+    if (_claim_cursor == "0-0") {
+      _next_claim = now + _min_idle_ms;
+    }
+    if (!_entries.empty()) {
+      return 0;
+    }
+  }
+
+  //XREADGROUP GROUP group name COUNT count [BLOCK timeout] STREAMS stream >
+  std::vector<std::string> argv;
+  argv.push_back("XREADGROUP");
+  argv.push_back("GROUP");
+  argv.push_back(_group);
+  argv.push_back(_name);
+  argv.push_back("COUNT");
+  argv.push_back(_count);
+  if (timeout != 0) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%d", timeout > 0 ? timeout : 0);
+    argv.push_back("BLOCK");
+    argv.push_back(buf);
+  }
+  argv.push_back("STREAMS");
+  argv.push_back(_stream);
+  argv.push_back(">");
+  redisReply *reply = _conn.command(argv, timeout);
+  if (reply == NULL) {
+    return -1;
+  }
+
+  int ret = 0;
+  if (reply->type == REDIS_REPLY_ARRAY && reply->elements > 0) {
+    //[[stream, [[id, [field, value, ...]], ...]]]
+    redisReply *stream = reply->element[0];
+    if (stream->type == REDIS_REPLY_ARRAY && stream->elements >= 2) {
+      std::vector<std::string> deleted;
+      _parse_entries(stream->element[1], deleted);
+    }
+  } else if (reply->type == REDIS_REPLY_ERROR) {
+    LOG_ERROR(debug_log, "redis stream: XREADGROUP %s failed, %s", _stream.c_str(), reply->str);
+    if (strncmp(reply->str, "NOGROUP", 7) == 0) {
+      //stream被删除后消费组也不存在了，重新创建
+      _create_group();
+    }
+    ret = -1;
+  }
+  //NIL：超时没有新消息
+  freeReplyObject(reply);
+  return ret;
+}
+
+int RedisStreamConsumer::pull(std::string &message, int timeout) {
+  if (_entries.empty() && _fill(timeout) != 0) {
+    return -1;
+  }
+  if (_entries.empty()) {
+    return -1;
+  }
+  Entry &entry = _entries.front();
+  message.swap(entry.body);
+  _last_id.swap(entry.id);
+  _entries.pop_front();
+  return 0;
+}
+
+void RedisStreamConsumer::ack() {
+  if (_last_id.empty()) {
+    return;
+  }
+  std::vector<std::string> ids(1, _last_id);
+  _last_id.clear();
+  ack(ids);
+}
+
+int RedisStreamConsumer::pull_batch(std::vector<std::string> &messages,
+    std::vector<std::string> &ids, int max_messages, int timeout) {
+  messages.clear();
+  ids.clear();
+  if (_entries.empty() && _fill(timeout) != 0) {
+    return -1;
+  }
+  while (!_entries.empty() && (int)messages.size() < max_messages) {
+    Entry &entry = _entries.front();
+    messages.push_back(std::string());
+    messages.back().swap(entry.body);
+    ids.push_back(std::string());
+    ids.back().swap(entry.id);
+    _entries.pop_front();
+  }
+  return messages.size();
+}
+
+int RedisStreamConsumer::ack(const std::vector<std::string> &ids) {
+  if (ids.empty()) {
+    return 0;
+  }
+  std::vector<std::string> argv;
+  argv.reserve(ids.size() + 3);
+  argv.push_back("XACK");
+  argv.push_back(_stream);
+  argv.push_back(_group);
+  argv.insert(argv.end(), ids.begin(), ids.end());
+  redisReply *reply = _conn.command(argv);
+  int ret = reply != NULL && reply->type == REDIS_REPLY_INTEGER ? 0 : -1;
+  if (ret != 0) {
+    LOG_ERROR(debug_log, "redis stream: XACK %d messages on %s failed", (int)ids.size(),
+        _stream.c_str());
+  }
+  freeReplyObject(reply);
+  return ret;
+}
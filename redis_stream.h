@@ -0,0 +1,226 @@
+
+#ifndef AFANTI_REDIS_STREAM_H_
+#define AFANTI_REDIS_STREAM_H_
+
+#include <hiredis.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "MQInterface.h"
+
+/**
+ * RedisStreamConnection
+ * Streams生产者和消费者使用的独立连接（XREADGROUP BLOCK会占用连接）。
+ * 命令失败后关闭连接，下一次调用时重连。
+ * @note 线程不安全；只支持非集群（hiredis-vip的命令表不支持Streams命令的路由）
+ **/
+class RedisStreamConnection {
+
+public:
+
+  RedisStreamConnection() : _port(0), _db(0), _timeout(0), _redis_context(NULL) {}
+
+  ~RedisStreamConnection() {
+    _close();
+  }
+
+  /**
+   * @brief 初始化方法，参数与RedisNonClusterClient::init一致
+   * @return bool
+   **/
+  bool init(const std::string &server_info, const std::string &password = "", long timeout = 0);
+
+  /**
+   * @brief 执行一条命令
+   * @param [in]  block，命令在server端阻塞的最长时间（单位ms），读超时相应延长
+   * @return redisReply*，由调用方freeReplyObject，NULL：连接失败
+   **/
+  redisReply* command(const std::vector<std::string> &argv, long block = 0);
+
+  /**
+   * @brief pipeline执行多条命令，一次写出
+   * @param [out] replies，与commands一一对应，失败的为NULL，由调用方freeReplyObject
+   * @return bool，false：连接失败
+   **/
+  bool pipeline(const std::vector<std::vector<std::string> > &commands,
+      std::vector<redisReply *> &replies);
+
+private:
+
+  bool _connect();
+
+  void _close();
+
+  bool _append(const std::vector<std::string> &argv);
+
+  //不允许拷贝和赋值操作
+  RedisStreamConnection(const RedisStreamConnection &other);
+  RedisStreamConnection& operator= (const RedisStreamConnection &other);
+
+private:
+
+  std::string _host;
+  int _port;
+  int _db;
+  std::string _password;
+  long _timeout;
+  redisContext *_redis_context;
+  //复用参数缓冲区
+  std::vector<const char *> _argv;
+  std::vector<size_t> _argv_len;
+};
+
+/**
+ * RedisStreamProducer
+ * 基于Redis Streams的生产者：XADD stream MAXLEN ~ max_len * body message
+ * @note 线程不安全
+ **/
+class RedisStreamProducer : public MessageProducer {
+
+public:
+
+  /**
+   * @param [in]  stream，stream的key，相当于队列名
+   * @param [in]  max_len，stream保留的消息数（近似裁剪），<=0：不裁剪
+   **/
+  RedisStreamProducer(const std::string &stream, long max_len = 1000000);
+
+  bool init(const std::string &server_info, const std::string &password = "", long timeout = 0) {
+    return _conn.init(server_info, password, timeout);
+  }
+
+  /**
+   * @brief 实现MessageProducer接口；持久化由redis-server的AOF/RDB配置决定，deliver_mode被忽略
+   * @return 成功为0，失败为-1
+   **/
+  int push(const std::string &message, int deliver_mode = DM_NONPERSISTENT);
+
+  /**
+   * @brief 批量推送，所有XADD在一次写操作中pipeline发出
+   * @return 成功为0，失败为-1，个别消息失败为-3
+   **/
+  int push_batch(const std::vector<std::string> &messages);
+
+private:
+
+  void _build(const std::string &message, std::vector<std::string> &argv);
+
+  //不允许拷贝和赋值操作
+  RedisStreamProducer(const RedisStreamProducer &other);
+  RedisStreamProducer& operator= (const RedisStreamProducer &other);
+
+private:
+
+  RedisStreamConnection _conn;
+  std::string _stream;
+  std::string _max_len;
+};
+
+/**
+ * RedisStreamConsumer
+ * 基于Redis Streams消费组的消费者：XREADGROUP一次读取count条消息缓存在本地，
+ * pull逐条返回，ack通过XACK确认。
+ * 其他消费者（例如已经退出的进程）读取后超过min_idle没有确认的消息，
+ * 每隔min_idle通过XAUTOCLAIM（redis-server >= 6.2）转给自己，优先于新消息返回。
+ * 消息至少投递一次，调用方需要能处理重复消息。
+ * @note 线程不安全
+ **/
+class RedisStreamConsumer : public MessageConsumer {
+
+public:
+
+  /**
+   * @param [in]  stream，stream的key
+   * @param [in]  group，消费组，不存在时从stream的第一条消息开始创建
+   * @param [in]  name，组内消费者的名字，同一个组内唯一
+   * @param [in]  count，每次XREADGROUP/XAUTOCLAIM读取的消息数
+   * @param [in]  min_idle，未确认的消息超过该时间（单位ms）后可以被其他消费者认领
+   **/
+  RedisStreamConsumer(const std::string &stream, const std::string &group,
+      const std::string &name, int count = 100, long min_idle = 60000);
+
+  /**
+   * @brief 初始化方法，建立连接并创建消费组
+   * @return bool
+   **/
+  bool init(const std::string &server_info, const std::string &password = "", long timeout = 0);
+
+  /**
+   * @brief 实现MessageConsumer接口
+   * @param [in]  timeout，本地缓存为空时的等待时间（单位ms）：<0，一直等待；0，不等待
+   * @return 成功为0，超时或者失败为-1
+   **/
+  int pull(std::string &message, int timeout);
+
+  /**
+   * @brief 实现MessageConsumer接口，确认上一次pull到的消息
+   **/
+  void ack();
+
+  /**
+   * @brief 批量拉取，返回本地缓存的消息，缓存为空时等待最多timeout毫秒
+   * @param [out] messages
+   * @param [out] ids，消息的id，用于ack
+   * @param [in]  max_messages
+   * @return int，拉取到的消息数，-1：失败
+   **/
+  int pull_batch(std::vector<std::string> &messages, std::vector<std::string> &ids,
+      int max_messages, int timeout);
+
+  /**
+   * @brief 一条XACK确认多条消息
+   * @return 成功为0，失败为-1
+   **/
+  int ack(const std::vector<std::string> &ids);
+
+private:
+
+  struct Entry {
+    std::string id;
+    std::string body;
+  };
+
+  /**
+   * @brief 本地缓存为空时认领超时的消息，仍为空时读取新消息
+   * @return 成功为0，失败为-1
+   **/
+  int _fill(int timeout);
+
+  /**
+   * @brief 创建消费组，已经存在（BUSYGROUP）时认为成功
+   **/
+  bool _create_group();
+
+  int _claim();
+
+  /**
+   * @brief 解析[[id, [field, value, ...]], ...]，追加到_entries，
+   *        已经被MAXLEN裁剪的消息（字段为nil）记入deleted
+   **/
+  void _parse_entries(const redisReply *reply, std::vector<std::string> &deleted);
+
+  static long long _now_ms();
+
+  //不允许拷贝和赋值操作
+  RedisStreamConsumer(const RedisStreamConsumer &other);
+  RedisStreamConsumer& operator= (const RedisStreamConsumer &other);
+
+private:
+
+  RedisStreamConnection _conn;
+  std::string _stream;
+  std::string _group;
+  std::string _name;
+  std::string _count;
+  std::string _min_idle;
+  long _min_idle_ms;
+
+  std::deque<Entry> _entries;
+  //上一次pull到的消息id
+  std::string _last_id;
+  //XAUTOCLAIM的游标和下一次认领的时间
+  std::string _claim_cursor;
+  long long _next_claim;
+};
+
+#endif
@@ -0,0 +1,242 @@
+
+#include "Logger.h"
+#include "redis_write_behind.h"
+#include <errno.h>
+#include <time.h>
+
+static void add_ms(struct timespec &ts, long ms) {
+  long nsec = ts.tv_nsec + (ms % 1000) * 1000000;
+  ts.tv_sec += ms / 1000 + nsec / 1000000000;
+  ts.tv_nsec = nsec % 1000000000;
+}
+
+static bool before(const struct timespec &a, const struct timespec &b) {
+  return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+RedisWriteBehind::RedisWriteBehind(RedisClient *client, size_t capacity, int batch_size,
+    long interval, long ttl)
+  : _client(client), _capacity(capacity > 0 ? capacity : 1),
+    _batch_size(batch_size > 0 ? batch_size : 1), _interval(interval), _ttl(ttl),
+    _flush_requested(0), _flush_done(0), _running(false),
+    _written(0), _failed(0), _dropped(0) {
+  pthread_mutex_init(&_mutex, NULL);
+  pthread_cond_init(&_cond, NULL);
+  pthread_cond_init(&_space_cond, NULL);
+  _first_write.tv_sec = 0;
+  _first_write.tv_nsec = 0;
+  _retry_after = _first_write;
+}
+
+RedisWriteBehind::~RedisWriteBehind() {
+  stop();
+  pthread_mutex_destroy(&_mutex);
+  pthread_cond_destroy(&_cond);
+  pthread_cond_destroy(&_space_cond);
+}
+
+bool RedisWriteBehind::start() {
+  pthread_mutex_lock(&_mutex);
+  if (_running) {
+    pthread_mutex_unlock(&_mutex);
+    return true;
+  }
+  _running = true;
+  pthread_mutex_unlock(&_mutex);
+
+  if (pthread_create(&_thread, NULL, RedisWriteBehind::_loop, this) != 0) {
+    pthread_mutex_lock(&_mutex);
+    _running = false;
+    pthread_mutex_unlock(&_mutex);
+    return false;
+  }
+  return true;
+}
+
+void RedisWriteBehind::stop() {
+  pthread_mutex_lock(&_mutex);
+  if (!_running) {
+    pthread_mutex_unlock(&_mutex);
+    return;
+  }
+  _running = false;
+  pthread_cond_signal(&_cond);
+  pthread_cond_broadcast(&_space_cond);
+  pthread_mutex_unlock(&_mutex);
+  //刷写线程退出前写出缓冲区中剩余的数据
+  pthread_join(_thread, NULL);
+}
+
+int RedisWriteBehind::set(const std::string &key, const std::string &value, long timeout) {
+  if (key.empty() || value.empty()) {
+    return -2;
+  }
+
+  pthread_mutex_lock(&_mutex);
+  if (!_running) {
+    pthread_mutex_unlock(&_mutex);
+    return -1;
+  }
+  std::map<std::string, std::string>::iterator it = _pending.find(key);
+  if (it != _pending.end()) {
+    //覆盖缓冲区中的旧值，不占用新的空间
+    it->second = value;
+    pthread_mutex_unlock(&_mutex);
+    return 0;
+  }
+
+  //缓冲区已满，等待刷写线程取走数据
+  struct timespec deadline;
+  if (timeout > 0) {
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    add_ms(deadline, timeout);
+  }
+  while (_running && _pending.size() >= _capacity) {
+    int ret = 0;
+    if (timeout == 0) {
+      ret = ETIMEDOUT;
+    } else if (timeout < 0) {
+      ret = pthread_cond_wait(&_space_cond, &_mutex);
+    } else {
+      ret = pthread_cond_timedwait(&_space_cond, &_mutex, &deadline);
+    }
+    if (ret == ETIMEDOUT) {
+      pthread_mutex_unlock(&_mutex);
+      return 1;
+    }
+  }
+  if (!_running) {
+    pthread_mutex_unlock(&_mutex);
+    return -1;
+  }
+
+  if (_pending.empty()) {
+    clock_gettime(CLOCK_REALTIME, &_first_write);
+  }
+  _pending[key] = value;
+  //第一个key开始计时，攒够batch_size个key立即刷写
+  if (_pending.size() == 1 || _pending.size() >= _batch_size) {
+    pthread_cond_signal(&_cond);
+  }
+  pthread_mutex_unlock(&_mutex);
+  return 0;
+}
+
+void RedisWriteBehind::flush() {
+  pthread_mutex_lock(&_mutex);
+  long long seq = ++_flush_requested;
+  pthread_cond_signal(&_cond);
+  while (_running && _flush_done < seq) {
+    pthread_cond_wait(&_space_cond, &_mutex);
+  }
+  pthread_mutex_unlock(&_mutex);
+}
+
+void* RedisWriteBehind::_loop(void *param) {
+  RedisWriteBehind *writer = (RedisWriteBehind *)param;
+  writer->_run();
+  return NULL;
+}
+
+void RedisWriteBehind::_run() {
+  std::map<std::string, std::string> batch;
+  pthread_mutex_lock(&_mutex);
+  while (_running) {
+    //等待flush请求、攒够batch_size个key或者刷写间隔结束，写入失败后等待_retry_after
+    while (_running && _flush_requested == _flush_done) {
+      if (_pending.empty()) {
+        pthread_cond_wait(&_cond, &_mutex);
+        continue;
+      }
+      struct timespec now;
+      clock_gettime(CLOCK_REALTIME, &now);
+      if (_pending.size() >= _batch_size && !before(now, _retry_after)) {
+        break;
+      }
+      struct timespec deadline = _first_write;
+      add_ms(deadline, _interval);
+      if (before(deadline, _retry_after)) {
+        deadline = _retry_after;
+      }
+      if (pthread_cond_timedwait(&_cond, &_mutex, &deadline) == ETIMEDOUT) {
+        break;
+      }
+    }
+    if (!_running) {
+      break;
+    }
+
+    long long seq = _flush_requested;
+    batch.swap(_pending);
+    pthread_cond_broadcast(&_space_cond);
+    pthread_mutex_unlock(&_mutex);
+
+    _write(batch, true);
+    batch.clear();
+
+    pthread_mutex_lock(&_mutex);
+    if (_flush_done < seq) {
+      _flush_done = seq;
+    }
+    pthread_cond_broadcast(&_space_cond);
+  }
+
+  //停止前写出剩余的数据，失败不再重试
+  batch.swap(_pending);
+  pthread_mutex_unlock(&_mutex);
+  _write(batch, false);
+
+  pthread_mutex_lock(&_mutex);
+  _flush_done = _flush_requested;
+  pthread_cond_broadcast(&_space_cond);
+  pthread_mutex_unlock(&_mutex);
+}
+
+void RedisWriteBehind::_write(std::map<std::string, std::string> &batch, bool retry) {
+  std::vector<std::string> keys;
+  std::vector<std::string> values;
+  keys.reserve(_batch_size);
+  values.reserve(_batch_size);
+
+  std::map<std::string, std::string>::iterator it = batch.begin();
+  while (it != batch.end()) {
+    keys.clear();
+    values.clear();
+    for (; it != batch.end() && keys.size() < _batch_size; ++it) {
+      keys.push_back(it->first);
+      //value不拷贝，失败时再交换回缓冲区
+      values.push_back(std::string());
+      values.back().swap(it->second);
+    }
+
+    int ret = _client->mset(keys, values, _ttl);
+    if (ret == 0) {
+      __sync_fetch_and_add(&_written, (long long)keys.size());
+      continue;
+    }
+    __sync_fetch_and_add(&_failed, 1);
+    LOG_ERROR(debug_log, "redis write behind: mset %d keys failed, ret=%d",
+        (int)keys.size(), ret);
+    if (!retry) {
+      __sync_fetch_and_add(&_dropped, (long long)keys.size());
+      continue;
+    }
+
+    //mset部分失败时无法知道哪些key失败，整批放回；已经有新值的key不放回
+    pthread_mutex_lock(&_mutex);
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (_pending.empty()) {
+      _first_write = now;
+    }
+    for (size_t i = 0; i < keys.size(); ++i) {
+      std::map<std::string, std::string>::iterator pending = _pending.find(keys[i]);
+      if (pending == _pending.end()) {
+        _pending[keys[i]].swap(values[i]);
+      }
+    }
+    _retry_after = now;
+    add_ms(_retry_after, _interval);
+    pthread_mutex_unlock(&_mutex);
+  }
+}
@@ -0,0 +1,126 @@
+
+#ifndef AFANTI_REDIS_WRITE_BEHIND_H_
+#define AFANTI_REDIS_WRITE_BEHIND_H_
+
+#include <pthread.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "redis_client.h"
+
+/**
+ * RedisWriteBehind
+ * 异步批量写入：set只把key-value放入内存缓冲区，同一个key只保留最后一次写入，
+ * 缓冲区中的key达到batch_size个，或者第一次写入后经过interval毫秒，
+ * 由刷写线程通过client->mset分批写入（RedisClusterClient的mset会再按hash slot分组）。
+ * 缓冲区中的key达到capacity个时set阻塞（背压），直到刷写线程取走数据。
+ * 写入失败的key（没有被更新的写入覆盖时）放回缓冲区，等待interval后重试。
+ * 写入redis的延迟最多约为interval加上一次mset的耗时，期间通过client读不到新值。
+ * @note 线程安全；client只在刷写线程中使用，不能再被其他线程使用
+ **/
+class RedisWriteBehind {
+
+public:
+
+  /**
+   * @param [in]  client，由调用方创建并init，生命周期长于RedisWriteBehind
+   * @param [in]  capacity，缓冲区中的key数上限
+   * @param [in]  batch_size，一次mset的最大key数
+   * @param [in]  interval，最长刷写间隔（单位ms）
+   * @param [in]  ttl，过期时间（单位s）：<=0，不过期
+   **/
+  RedisWriteBehind(RedisClient *client, size_t capacity = 100000, int batch_size = 500,
+      long interval = 100, long ttl = 0);
+
+  ~RedisWriteBehind();
+
+  /**
+   * @brief 启动刷写线程
+   * @return bool
+   **/
+  bool start();
+
+  /**
+   * @brief 写出缓冲区中的数据（失败不重试）后停止刷写线程，仍然失败的写入被丢弃
+   **/
+  void stop();
+
+  /**
+   * @brief 写入缓冲区
+   * @param [in]  key
+   * @param [in]  value
+   * @param [in]  timeout，缓冲区已满时的最长等待时间（单位ms）：<0，一直等待；0，不等待
+   * @return int
+   *  0：已经放入缓冲区
+   *  1：缓冲区已满，等待超时
+   *  -1：刷写线程未启动
+   *  -2：key或者value为空，与RedisClient::set一致，不支持空value
+   **/
+  int set(const std::string &key, const std::string &value, long timeout = -1);
+
+  /**
+   * @brief 立即刷写，等待调用前写入缓冲区的数据写出（成功或者失败后放回缓冲区）
+   **/
+  void flush();
+
+  /**
+   * @brief 统计：写入redis成功的key数、写入失败的次数、stop时丢弃的key数
+   **/
+  long long written() {
+    return __sync_fetch_and_add(&_written, 0);
+  }
+
+  long long failed() {
+    return __sync_fetch_and_add(&_failed, 0);
+  }
+
+  long long dropped() {
+    return __sync_fetch_and_add(&_dropped, 0);
+  }
+
+private:
+
+  static void* _loop(void *param);
+
+  void _run();
+
+  /**
+   * @brief 分批写入，失败的key放回_pending
+   **/
+  void _write(std::map<std::string, std::string> &batch, bool retry);
+
+  //不允许拷贝和赋值操作
+  RedisWriteBehind(const RedisWriteBehind &other);
+  RedisWriteBehind& operator= (const RedisWriteBehind &other);
+
+private:
+
+  RedisClient *_client;
+  size_t _capacity;
+  size_t _batch_size;
+  long _interval;
+  long _ttl;
+
+  pthread_mutex_t _mutex;
+  //通知刷写线程
+  pthread_cond_t _cond;
+  //通知等待缓冲区空间和等待flush的线程
+  pthread_cond_t _space_cond;
+  std::map<std::string, std::string> _pending;
+  //缓冲区由空变为非空的时间
+  struct timespec _first_write;
+  //写入失败后在该时间之前不再刷写
+  struct timespec _retry_after;
+  //flush请求的序号和已经完成的序号
+  long long _flush_requested;
+  long long _flush_done;
+
+  pthread_t _thread;
+  bool _running;
+
+  long long _written;
+  long long _failed;
+  long long _dropped;
+};
+
+#endif